@@ -1,13 +1,15 @@
 #include <optix_world.h>
 #include "structures.h"
 #include "utils_device.h"
+#include "ray_stats.h"
 
 using namespace optix;
 
 rtDeclareVariable(Ray, ray, rtCurrentRay, );
 rtDeclareVariable(rtObject, topGroup, , );
 rtDeclareVariable(Payload, pld, rtPayload, );
-rtDeclareVariable(int, randSeed, , );
+rtDeclareVariable(uint, sampleIndex, , );
+rtDeclareVariable(uint, frameIndex, , );
 rtDeclareVariable(uint, rayTypeRadiance, , );
 rtDeclareVariable(uint, nSuperSampling, , );
 rtDeclareVariable(uint2, launchIdx, rtLaunchIndex, );
@@ -15,14 +17,29 @@ rtDeclareVariable(uint2, launchDim, rtLaunchDim, );
 rtDeclareVariable(float, rayEpsilonT, , );
 
 rtBuffer<float3, 2> accuBuffer;
+// passes this pixel takes part in; all of them unless temporal reuse is on
+rtBuffer<uint, 2> sampleBudgetBuffer;
+rtDeclareVariable(int, restirEnabled, , );
+rtBuffer<Reservoir, 2> restirReservoirs;
 
 rtDeclareVariable(CamParams, camParams, , );
 
 RT_PROGRAM void camera() {
+  // pixels that miss or skip this pass leave no reservoir to reuse
+  if (restirEnabled) {
+    restirReservoirs[launchIdx].M = 0.f;
+  }
+  if (sampleIndex >= sampleBudgetBuffer[launchIdx]) {
+    return;
+  }
   Payload pld;
   pld.depth = 1;
-  pld.randSeed = tea<16>(launchIdx.y * launchDim.x + launchIdx.x, randSeed);
+  // seeds depend only on (pixel, sample, frame), so any sample range can be
+  // rendered separately and the partial sums added up later
+  pld.randSeed = tea<16>(launchIdx.y * launchDim.x + launchIdx.x, tea<4>(sampleIndex, frameIndex));
   pld.color = make_float3(1.f);
+  pld.bsdfPdf = 0.f;
+  pld.causticState = CAUSTIC_BEFORE_DIFFUSE;
 
   float3 randInLens = camParams.lensRadius * randInUnitDisk(pld.randSeed);
   float3 offset = camParams.u * randInLens.x + camParams.v * randInLens.y;
@@ -34,7 +51,11 @@ RT_PROGRAM void camera() {
     rayEpsilonT
   );
 
+  RAY_STAT(RAY_STAT_PATHS);
+  RAY_STAT(RAY_STAT_RADIANCE_RAYS);
+  RAY_COST_TIMER_BEGIN();
   rtTrace(topGroup, ray, pld);
+  RAY_COST_TIMER_END();
 
   pld.color = clamp(pld.color, make_float3(0.f), make_float3(1.f));
 
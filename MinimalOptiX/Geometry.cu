@@ -117,8 +117,10 @@ rtBuffer<float2> texcoordBuffer;
 rtBuffer<int3>   vertIdxBuffer;
 rtBuffer<int3>   texIdxBuffer;
 rtBuffer<int3>   normIdxBuffer;
+rtBuffer<int>    mtlIdxBuffer; // only bound for merged meshes
+rtDeclareVariable(int, mtlIdx, attribute mtlIdx, );
 
-RT_PROGRAM void meshIntersect(int primIdx) {
+__device__ __inline__ void intersectMeshPrim(int primIdx, int materialIdx) {
   int3 vertIdx = vertIdxBuffer[primIdx];
   int3 texIdx = texIdxBuffer[primIdx];
   int3 normIdx = normIdxBuffer[primIdx];
@@ -133,12 +135,14 @@ RT_PROGRAM void meshIntersect(int primIdx) {
   if (intersect_triangle(ray, p0, p1, p2, n, t, beta, gamma)) {
     if (rtPotentialIntersection(t)) {
       geoNormal = normalize(n);
-      if(normalBuffer.size() == 0) {
+      // merged meshes share the attribute buffers, so a shape without normals
+      // or texcoords is marked by negative indices instead of an empty buffer
+      if(normalBuffer.size() == 0 || normIdx.x < 0) {
         shadingNormal = geoNormal;
       } else {
         shadingNormal = normalize(normalBuffer[normIdx.y] * beta + normalBuffer[normIdx.z] * gamma + normalBuffer[normIdx.x] * (1.f - beta - gamma));
       }
-      if (texcoordBuffer.size() == 0) {
+      if (texcoordBuffer.size() == 0 || texIdx.x < 0) {
         texcoord = make_float3(0.f);
       } else {
         float2 t0 = texcoordBuffer[texIdx.x];
@@ -154,11 +158,20 @@ RT_PROGRAM void meshIntersect(int primIdx) {
         backHitPoint,
         frontHitPoint
       );
+      mtlIdx = materialIdx;
       rtReportIntersection(0);
     }
   }
 }
 
+RT_PROGRAM void meshIntersect(int primIdx) {
+  intersectMeshPrim(primIdx, 0);
+}
+
+RT_PROGRAM void mergedMeshIntersect(int primIdx) {
+  intersectMeshPrim(primIdx, mtlIdxBuffer[primIdx]);
+}
+
 RT_PROGRAM void meshBBox (int primIdx, float result[6]) {
   int3 vertIdx = vertIdxBuffer[primIdx];
   float3 v0 = vertexBuffer[vertIdx.x];
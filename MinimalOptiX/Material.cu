@@ -1,6 +1,13 @@
 #include <optix_world.h>
 #include "structures.h"
 #include "disney.h"
+#include "light_sampling.h"
+#include "environment.h"
+#include "guiding.h"
+#include "photon_grid.h"
+#include "restir.h"
+#include "projection.h"
+#include "ray_stats.h"
 #include "utils_device.h"
 
 using namespace optix;
@@ -20,40 +27,309 @@ rtDeclareVariable(float3, geoNormal, attribute geoNormal, );
 rtDeclareVariable(float3, shadingNormal, attribute shadingNormal, );
 rtDeclareVariable(float3, frontHitPoint, attribute frontHitPoint, );
 rtDeclareVariable(float3, backHitPoint, attribute backHitPoint, );
+rtDeclareVariable(uint2, launchIdx, rtLaunchIndex, );
+rtDeclareVariable(uint2, launchDim, rtLaunchDim, );
+
+rtDeclareVariable(int, objectId, , );
+
+// first-hit feature buffers for the denoiser, accumulated like accuBuffer
+rtBuffer<float3, 2> albedoAovBuffer;
+rtBuffer<float3, 2> normalAovBuffer;
+// first-hit position and object id for temporal reprojection, last sample wins
+rtBuffer<float4, 2> gBuffer;
+
+__device__ __inline__ void recordFirstHit(const float3& albedo, const float3& normal) {
+  if (payload.depth == 1) {
+    albedoAovBuffer[launchIdx] += albedo;
+    normalAovBuffer[launchIdx] += normal;
+    gBuffer[launchIdx] = make_float4(ray.origin + t * ray.direction, float(objectId));
+  }
+}
+
+// ================== direct lighting ====================
+
+rtBuffer<LightParams> lights;
+
+// spatiotemporal resampling of the first diffuse hit's light samples
+rtDeclareVariable(int, restirEnabled, , );
+rtDeclareVariable(int, restirCandidates, , );
+rtDeclareVariable(float, restirMaxM, , );
+rtDeclareVariable(CamParams, prevCamParams, , );
+// written by this launch and by the previous one, swapped by the host
+rtBuffer<Reservoir, 2> restirReservoirs;
+rtBuffer<Reservoir, 2> restirPrevReservoirs;
+
+#define RESTIR_SPATIAL_NEIGHBOURS 3
+#define RESTIR_SPATIAL_RADIUS 16.f
+
+struct PayloadRand {
+  int& seed;
+  __device__ float operator()() { return rand(seed); }
+};
+
+// One shadow ray for all lights: merges fresh candidates with the previous
+// launch's reservoir at the reprojected pixel and a few around it, shades
+// the selected point and keeps the reservoir for the next launch. Reusing
+// the previous launch for the spatial neighbours too keeps everything in a
+// single pass, where the surface's BSDF is at hand.
+template <typename Bsdf>
+__device__ __inline__ float3 restirDirectLight(const float3& hitPoint, const float3& N, Bsdf& bsdf) {
+  PayloadRand rng = { payload.randSeed };
+  Reservoir neighbours[1 + RESTIR_SPATIAL_NEIGHBOURS];
+  int nNeighbours = 0;
+  int px, py;
+  if (projectToPixel(prevCamParams, hitPoint, launchDim.x, launchDim.y, px, py)) {
+    neighbours[nNeighbours++] = restirPrevReservoirs[make_uint2(px, py)];
+    for (int k = 0; k < RESTIR_SPATIAL_NEIGHBOURS; ++k) {
+      float3 offset = RESTIR_SPATIAL_RADIUS * randInUnitDisk(payload.randSeed);
+      int qx = clamp(px + int(offset.x), 0, int(launchDim.x) - 1);
+      int qy = clamp(py + int(offset.y), 0, int(launchDim.y) - 1);
+      neighbours[nNeighbours++] = restirPrevReservoirs[make_uint2(qx, qy)];
+    }
+  }
+  Reservoir r = restirResample(hitPoint, N, bsdf, lights, restirCandidates, neighbours, nNeighbours, 0.05f * t, restirMaxM, rng);
+
+  float3 color = make_float3(0.f);
+  if (r.W > 0.f) {
+    LightParams light = lights[r.lightIdx];
+    float3 L;
+    float dist;
+    float G = restirGeometry(light, r.lightPoint, hitPoint, L, dist);
+    Ray newRay(hitPoint, L, rayTypeShadow, rayEpsilonT, dist - rayEpsilonT);
+    Payload newPayload;
+    newPayload.depth = payload.depth + 1;
+    newPayload.attenuation = make_float3(1.f);
+    newPayload.randSeed = tea<16>(payload.randSeed, newPayload.depth);
+    RAY_STAT(RAY_STAT_SHADOW_RAYS);
+    rtTrace(topGroup, newRay, newPayload);
+    if (length(newPayload.attenuation)) {
+      color = bsdf.eval(L) * light.emission * newPayload.attenuation * G * r.W;
+    } else {
+      // occluded samples are not passed on
+      r.W = 0.f;
+    }
+  }
+  restirReservoirs[launchIdx] = r;
+  return color;
+}
+
+// Next-event estimation: one shadow ray towards every light, sampled over
+// the solid angle it covers and weighted against the BSDF strategy with the
+// power heuristic. The Bsdf functor provides eval(L), the factor applied to
+// radiance arriving along L, and pdf(L), the solid angle density of
+// sampling L by the BSDF. With resampling on, the first diffuse hit sends
+// a single shadow ray for the whole light list instead.
+template <typename Bsdf>
+__device__ __inline__ float3 sampleDirectLight(const float3& hitPoint, const float3& N, Bsdf& bsdf) {
+  float3 directLightColor = make_float3(0.f);
+  if (restirEnabled && payload.depth == 1) {
+    directLightColor = restirDirectLight(hitPoint, N, bsdf);
+  } else {
+    for (int i = 0; i < lights.size(); ++i) {
+      LightParams light = lights[i];
+      float u1 = rand(payload.randSeed);
+      float u2 = rand(payload.randSeed);
+      LightSample sample = sampleLight(light, hitPoint, u1, u2);
+      float3 L = sample.direction;
+      if (sample.pdf > 0.f && dot(L, N) > 0.f) {
+        Ray newRay(hitPoint, L, rayTypeShadow, rayEpsilonT, sample.distance - rayEpsilonT);
+        Payload newPayload;
+        newPayload.depth = payload.depth + 1;
+        newPayload.attenuation = make_float3(1.f);
+        newPayload.randSeed = tea<16>(payload.randSeed, newPayload.depth);
+        RAY_STAT(RAY_STAT_SHADOW_RAYS);
+        rtTrace(topGroup, newRay, newPayload);
+        if (length(newPayload.attenuation)) {
+          directLightColor += powerHeuristic(sample.pdf, bsdf.pdf(L)) * bsdf.eval(L) * light.emission * newPayload.attenuation / sample.pdf;
+        }
+      }
+    }
+  }
+  if (envEnabled) {
+    float u1 = rand(payload.randSeed);
+    float u2 = rand(payload.randSeed);
+    float pdf;
+    float3 L = sampleEnv(u1, u2, pdf);
+    if (pdf > 0.f && dot(L, N) > 0.f) {
+      Ray newRay(hitPoint, L, rayTypeShadow, rayEpsilonT);
+      Payload newPayload;
+      newPayload.depth = payload.depth + 1;
+      newPayload.attenuation = make_float3(1.f);
+      newPayload.randSeed = tea<16>(payload.randSeed, newPayload.depth);
+      RAY_STAT(RAY_STAT_SHADOW_RAYS);
+      rtTrace(topGroup, newRay, newPayload);
+      if (length(newPayload.attenuation)) {
+        directLightColor += powerHeuristic(pdf, bsdf.pdf(L)) * bsdf.eval(L) * envLookup(L) * newPayload.attenuation / pdf;
+      }
+    }
+  }
+  return directLightColor;
+}
+
+// shadow rays stop at the simple materials, glass included: light behind
+// glass is only reached by refracted paths, which keep full MIS weight
+RT_PROGRAM void opaqueShadow() {
+  payload.attenuation = make_float3(0.f);
+  rtTerminateRay();
+}
+
+// ================== caustic photons ====================
+
+rtDeclareVariable(PhotonPayload, photon, rtPayload, );
+rtDeclareVariable(uint, rayTypePhoton, , );
+rtDeclareVariable(int, causticsEnabled, , );
+rtDeclareVariable(float, causticRadius, , );
+rtDeclareVariable(float, photonCellSize, , );
+rtDeclareVariable(uint, photonTableMask, , );
+// written by the photon pass, one slot per emitted photon
+rtBuffer<PhotonRecord> photonBuffer;
+// the same photons sorted by hash bucket on the host, see photon_grid.h
+rtBuffer<uint> photonCellStart;
+rtBuffer<PhotonRecord> photonMap;
+
+#define PHOTON_MAX_DEPTH 16
+
+// diffuse surfaces end photon paths and keep the ones that came through
+// at least one specular bounce
+__device__ __inline__ void storePhoton() {
+  if (photon.specularBounces > 0) {
+    PhotonRecord record = { ray.origin + t * ray.direction, ray.direction, photon.power };
+    photonBuffer[photon.slot] = record;
+  }
+}
+
+__device__ __inline__ void continuePhoton(const float3& origin, const float3& direction, const float3& filter) {
+  if (photon.depth >= PHOTON_MAX_DEPTH) {
+    return;
+  }
+  PhotonPayload newPhoton = photon;
+  newPhoton.power = photon.power * filter;
+  newPhoton.depth = photon.depth + 1;
+  newPhoton.specularBounces = photon.specularBounces + 1;
+  Ray newRay(origin, direction, rayTypePhoton, rayEpsilonT);
+  RAY_STAT(RAY_STAT_PHOTON_RAYS);
+  rtTrace(topGroup, newRay, newPhoton);
+}
+
+// Density estimate of the caustic radiance leaving p towards the camera,
+// sum of eval(L) / cos(L) * power over the photons within causticRadius
+// divided by the disc area. Photons arriving from behind N are skipped.
+template <typename Bsdf>
+__device__ __inline__ float3 gatherCaustics(const float3& p, const float3& N, Bsdf& bsdf) {
+  float3 sum = make_float3(0.f);
+  float r2 = causticRadius * causticRadius;
+  float3 c = p / photonCellSize;
+  int3 base = make_int3(photonCellCoord(p.x, photonCellSize), photonCellCoord(p.y, photonCellSize), photonCellCoord(p.z, photonCellSize));
+  int3 side = make_int3(c.x - base.x < 0.5f ? -1 : 1, c.y - base.y < 0.5f ? -1 : 1, c.z - base.z < 0.5f ? -1 : 1);
+  uint visited[8];
+  for (int k = 0; k < 8; ++k) {
+    uint bucket = photonCellHash(base.x + (k & 1) * side.x, base.y + ((k >> 1) & 1) * side.y, base.z + (k >> 2) * side.z, photonTableMask);
+    // neighbouring cells may share a bucket
+    bool seen = false;
+    for (int j = 0; j < k; ++j) {
+      seen = seen || visited[j] == bucket;
+    }
+    visited[k] = bucket;
+    if (seen) {
+      continue;
+    }
+    for (uint i = photonCellStart[bucket]; i < photonCellStart[bucket + 1]; ++i) {
+      PhotonRecord record = photonMap[i];
+      float3 d = record.position - p;
+      float3 L = -record.direction;
+      float cosL = dot(N, L);
+      if (dot(d, d) <= r2 && cosL > 0.f) {
+        sum += bsdf.eval(L) / cosL * record.power;
+      }
+    }
+  }
+  return sum / (M_PIf * r2);
+}
 
 // =================== lambertian ======================
 
 rtDeclareVariable(LambertianParams, lambParams, , );
 
+struct LambertianBsdf {
+  float3 albedo;
+  float3 N;
+  __device__ float3 eval(const float3& L) { return albedo * max(dot(N, L), 0.f) / M_PIf; }
+  __device__ float pdf(const float3& L) { return max(dot(N, L), 0.f) / M_PIf; }
+};
+
 RT_PROGRAM void lambertian() {
   if (payload.depth > rayMaxDepth || length(payload.color) < rayMinIntensity) {
+    RAY_STAT_PATH_END(payload.depth > rayMaxDepth ? RAY_STAT_END_MAX_DEPTH : RAY_STAT_END_MIN_INTENSITY, payload.depth);
     payload.color = absorbColor;
     return;
   }
-  float3 tmpColor = { 0.f, 0.f, 0.f };
-  Ray newRay(
-    ray.origin + t * ray.direction,
-    normalize(geoNormal + randInUnitSphere(payload.randSeed)),
-    rayTypeRadiance,
-    rayEpsilonT
-  );
+  float3 N = faceforward(geoNormal, -ray.direction, geoNormal);
+  recordFirstHit(lambParams.albedo, faceforward(shadingNormal, -ray.direction, geoNormal));
+  LambertianBsdf bsdf = { lambParams.albedo, N };
+  float3 directLightColor = sampleDirectLight(frontHitPoint, N, bsdf);
+  if (causticsEnabled && payload.causticState == CAUSTIC_BEFORE_DIFFUSE) {
+    directLightColor += gatherCaustics(frontHitPoint, N, bsdf);
+  }
+
+  // a point on the unit sphere around N gives an exact cosine distribution
+  float3 L = normalize(N + normalize(randInUnitSphere(payload.randSeed)));
+  Ray newRay(frontHitPoint, L, rayTypeRadiance, rayEpsilonT);
   Payload newPayload = folkPayload(payload);
+  newPayload.bsdfPdf = bsdf.pdf(L);
+  newPayload.causticState = causticAfterDiffuse(payload.causticState);
+  RAY_STAT(RAY_STAT_RADIANCE_RAYS);
   rtTrace(topGroup, newRay, newPayload);
-  payload.color = newPayload.color * lambParams.albedo;
+  payload.color = newPayload.color * lambParams.albedo + directLightColor;
+}
+
+RT_PROGRAM void lambertianPhoton() {
+  storePhoton();
 }
 
 // ====================== metal ==========================
 
 rtDeclareVariable(MetalParams, metalParams, , );
 
+// Directions are sampled as normalize(R + fuzz * p) with p uniform in the
+// unit ball, so the density of L is the ball volume seen along L.
+struct MetalBsdf {
+  float3 albedo;
+  float3 R;
+  float fuzz;
+  __device__ float pdf(const float3& L) {
+    float cosTheta = dot(R, L);
+    float disc = fuzz * fuzz - (1.f - cosTheta * cosTheta);
+    if (disc < 0.f) {
+      return 0.f;
+    }
+    float s1 = max(cosTheta - sqrtf(disc), 0.f);
+    float s2 = cosTheta + sqrtf(disc);
+    if (s2 <= 0.f) {
+      return 0.f;
+    }
+    return (s2 * s2 * s2 - s1 * s1 * s1) / (4.f * M_PIf * fuzz * fuzz * fuzz);
+  }
+  __device__ float3 eval(const float3& L) { return albedo * pdf(L); }
+};
+
 RT_PROGRAM void metal() {
   if (payload.depth > rayMaxDepth || length(payload.color) < rayMinIntensity) {
+    RAY_STAT_PATH_END(payload.depth > rayMaxDepth ? RAY_STAT_END_MAX_DEPTH : RAY_STAT_END_MIN_INTENSITY, payload.depth);
     payload.color = absorbColor;
     return;
   }
+  recordFirstHit(metalParams.albedo, faceforward(shadingNormal, -ray.direction, geoNormal));
+  MetalBsdf bsdf = { metalParams.albedo, reflect(ray.direction, geoNormal), metalParams.fuzz };
+  // a perfect mirror is a delta lobe that light samples can never hit, and
+  // light over specular chains behind a diffuse vertex comes from photons
+  int causticState = causticAfterSpecular(payload.causticState);
+  float3 directLightColor = make_float3(0.f);
+  if (metalParams.fuzz > 0.f && !(causticsEnabled && causticState == CAUSTIC_SPECULAR_CHAIN)) {
+    directLightColor = sampleDirectLight(frontHitPoint, faceforward(geoNormal, -ray.direction, geoNormal), bsdf);
+  }
   Ray newRay(
     ray.origin + t * ray.direction,
-    normalize(reflect(ray.direction, geoNormal) + metalParams.fuzz * randInUnitSphere(payload.randSeed)),
+    normalize(bsdf.R + metalParams.fuzz * randInUnitSphere(payload.randSeed)),
     rayTypeRadiance,
     rayEpsilonT
   );
@@ -61,35 +337,57 @@ RT_PROGRAM void metal() {
   newPayload.depth = payload.depth + 1;
   newPayload.color = make_float3(1.f);
   newPayload.randSeed = tea<16>(payload.randSeed, newPayload.depth);
+  newPayload.bsdfPdf = metalParams.fuzz > 0.f ? bsdf.pdf(newRay.direction) : 0.f;
+  newPayload.causticState = causticState;
+  RAY_STAT(RAY_STAT_RADIANCE_RAYS);
   rtTrace(topGroup, newRay, newPayload);
-  payload.color = metalParams.albedo * newPayload.color;
+  payload.color = metalParams.albedo * newPayload.color + directLightColor;
+}
+
+RT_PROGRAM void metalPhoton() {
+  float3 direction = normalize(reflect(ray.direction, geoNormal) + metalParams.fuzz * randInUnitSphere(photon.randSeed));
+  continuePhoton(ray.origin + t * ray.direction, direction, metalParams.albedo);
 }
 
 // ====================== glass ==========================
 
 rtDeclareVariable(GlassParams, glassParams, , );
 
+// Picks reflection or refraction by Fresnel, origin is offset to the side
+// the new direction leaves from
+__device__ __inline__ void scatterDielectric(float refIdxInside, int& seed, float3& origin, float3& direction) {
+  float3 normal = shadingNormal;
+  float cosThetaI = -dot(ray.direction, normal);
+  float refIdx;
+  if (cosThetaI > 0.f) {
+    refIdx = refIdxInside;
+  } else {
+    refIdx = 1.f / refIdxInside;
+    cosThetaI = -cosThetaI;
+    normal = -normal;
+  }
+
+  float3 refracted;
+  float totalReflection = !refract(refracted, ray.direction, normal, refIdx);
+  float cosThetaT = -dot(normal, refracted);
+  float reflectProb =  totalReflection ? 1.f : fresnel(cosThetaI, cosThetaT, refIdx);
+  if (rand(seed) < reflectProb) {
+    origin = frontHitPoint;
+    direction = reflect(ray.direction, normal);
+  } else {
+    origin = backHitPoint;
+    direction = refracted;
+  }
+}
+
 RT_PROGRAM void glass() {
   if (payload.depth > rayMaxDepth || length(payload.color) < rayMinIntensity) {
+    RAY_STAT_PATH_END(payload.depth > rayMaxDepth ? RAY_STAT_END_MAX_DEPTH : RAY_STAT_END_MIN_INTENSITY, payload.depth);
     payload.color = absorbColor;
     return;
   }
+  recordFirstHit(glassParams.albedo, faceforward(shadingNormal, -ray.direction, geoNormal));
 
-  float3 normal = shadingNormal;
-	float cosThetaI = -dot(ray.direction, normal);
-	float refIdx;
-	if (cosThetaI > 0.f) {
-		refIdx = glassParams.refIdx;
-	} else {
-		refIdx = 1.f / glassParams.refIdx;
-		cosThetaI = -cosThetaI;
-		normal = -normal;
-	}
-
-	float3 refracted;
-  float totalReflection = !refract(refracted, ray.direction, normal, refIdx);
-	float cosThetaT = -dot(normal, refracted);
-	float reflectProb =  totalReflection ? 1.f : fresnel(cosThetaI, cosThetaT, refIdx);
   Ray newRay;
   newRay.ray_type = rayTypeRadiance;
   newRay.tmin = rayEpsilonT;
@@ -98,25 +396,70 @@ RT_PROGRAM void glass() {
   newPayload.depth = payload.depth + 1;
   newPayload.color = make_float3(1.f);
   newPayload.randSeed = tea<16>(payload.randSeed, newPayload.depth);
-  if (rand(payload.randSeed) < reflectProb) {
-    newRay.origin = frontHitPoint;
-    newRay.direction = reflect(ray.direction, normal);
-  } else {
-    newRay.origin = backHitPoint;
-    newRay.direction = refracted;
-  }
+  newPayload.bsdfPdf = 0.f;
+  newPayload.causticState = causticAfterSpecular(payload.causticState);
+  scatterDielectric(glassParams.refIdx, payload.randSeed, newRay.origin, newRay.direction);
+  RAY_STAT(RAY_STAT_RADIANCE_RAYS);
   rtTrace(topGroup, newRay, newPayload);
   payload.color = newPayload.color * glassParams.albedo;
 }
 
+RT_PROGRAM void glassPhoton() {
+  float3 origin, direction;
+  scatterDielectric(glassParams.refIdx, photon.randSeed, origin, direction);
+  continuePhoton(origin, direction, glassParams.albedo);
+}
+
 // ====================== Disney =========================
 
 rtDeclareVariable(DisneyParams, disneyParams, , );
 rtDeclareVariable(float3, texcoord, attribute texcoord, );
-rtBuffer<LightParams> lights;
 
-RT_PROGRAM void disney() {
+rtDeclareVariable(GuideParams, guideParams, , );
+rtBuffer<float> guideCdf;
+rtBuffer<float> guideCellFraction;
+rtBuffer<float> guideAccum;
+
+struct GuideCdf {
+  int cell;
+  __device__ float operator()(int i) const { return guideCdf[cell * (GUIDE_BINS + 1) + i]; }
+};
+
+// pdf() is the density of the whole indirect strategy, BSDF sampling mixed
+// with the cell's guiding histogram
+struct DisneyBsdf {
+  DisneyParams params;
+  float3 baseColor;
+  float3 N;
+  float3 V;
+  GuideCdf guide;
+  float guideFraction;
+  __device__ float3 eval(float3 L) {
+    float3 H = normalize(L + V);
+    return disneyEval(params, baseColor, N, L, V, H);
+  }
+  __device__ float pdf(float3 L) {
+    float3 H = normalize(L + V);
+    float bsdfPdf = disneyPdf(params, N, L, V, H);
+    if (guideFraction > 0.f) {
+      return guideFraction * guidePdf(guide, L) + (1.f - guideFraction) * bsdfPdf;
+    }
+    return bsdfPdf;
+  }
+};
+
+#define DISNEY_GLASS_IOR 1.45f
+
+__device__ __inline__ float3 disneyBaseColor(const DisneyParams& disneyParams) {
+  if (disneyParams.albedoID == RT_TEXTURE_ID_NULL) {
+    return disneyParams.color;
+  }
+  return make_float3(optix::rtTex2D<float4>(disneyParams.albedoID, texcoord.x, texcoord.y));
+}
+
+__device__ __inline__ void shadeDisney(DisneyParams& disneyParams) {
   if (payload.depth > rayMaxDepth || length(payload.color) < rayMinIntensity) {
+    RAY_STAT_PATH_END(payload.depth > rayMaxDepth ? RAY_STAT_END_MAX_DEPTH : RAY_STAT_END_MIN_INTENSITY, payload.depth);
     payload.color = absorbColor;
     return;
   }
@@ -124,29 +467,10 @@ RT_PROGRAM void disney() {
   float3 N, L, V, H;
   N = faceforward(shadingNormal, -ray.direction, geoNormal);
   V = -ray.direction;
-  float3 baseColor;
-  if (disneyParams.albedoID == RT_TEXTURE_ID_NULL) {
-    baseColor = disneyParams.color;
-  } else {
-    baseColor = make_float3(optix::rtTex2D<float4>(disneyParams.albedoID, texcoord.x, texcoord.y));
-  }
+  float3 baseColor = disneyBaseColor(disneyParams);
+  recordFirstHit(baseColor, N);
 
   if (disneyParams.brdfType == GLASS) {
-    float3 normal = shadingNormal;
-    float cosThetaI = -dot(ray.direction, normal);
-    float refIdx;
-    if (cosThetaI > 0.f) {
-      refIdx = 1.45f;
-    } else {
-      refIdx = 1.f / 1.45f;
-      cosThetaI = -cosThetaI;
-      normal = -normal;
-    }
-
-    float3 refracted;
-    float totalReflection = !refract(refracted, ray.direction, normal, refIdx);
-    float cosThetaT = -dot(normal, refracted);
-    float reflectProb =  totalReflection ? 1.f : fresnel(cosThetaI, cosThetaT, refIdx);
     Ray newRay;
     newRay.ray_type = rayTypeRadiance;
     newRay.tmin = rayEpsilonT;
@@ -155,75 +479,62 @@ RT_PROGRAM void disney() {
     newPayload.depth = payload.depth + 1;
     newPayload.color = make_float3(1.f);
     newPayload.randSeed = tea<16>(payload.randSeed, newPayload.depth);
-    if (rand(payload.randSeed) < reflectProb) {
-      newRay.origin = frontHitPoint;
-      newRay.direction = reflect(ray.direction, normal);
-    } else {
-      newRay.origin = backHitPoint;
-      newRay.direction = refracted;
-    }
+    newPayload.bsdfPdf = 0.f;
+    newPayload.causticState = causticAfterSpecular(payload.causticState);
+    scatterDielectric(DISNEY_GLASS_IOR, payload.randSeed, newRay.origin, newRay.direction);
+    RAY_STAT(RAY_STAT_RADIANCE_RAYS);
     rtTrace(topGroup, newRay, newPayload);
     payload.color = newPayload.color * baseColor;
     return;
   }
 
-  // direct light sample
-  float3 directLightColor = make_float3(0.f);
-  for (int i = 0; i < lights.size(); ++i) {
-    LightParams light = lights[i];
-    float3 pointOnLight;
-    float3 normalOnLight;
-    if (light.shape == SPHERE) {
-      pointOnLight = light.position + randInUnitSphere(payload.randSeed) * light.radius;
-      normalOnLight = normalize(pointOnLight - light.position);
-    } else {
-      pointOnLight = light.position + light.u * rand(payload.randSeed) + light.v * rand(payload.randSeed);
-      normalOnLight = normalize(light.normal);
-    }
-    L = pointOnLight - frontHitPoint;
-    float lightDst = length(L);
-    L = normalize(L);
-    if (dot(L, N) > 0.f && dot(L, normalOnLight) < 0.f) {
-      Ray newRay(frontHitPoint, L, rayTypeShadow, rayEpsilonT, lightDst - rayEpsilonT);
-      Payload newPayload;
-      newPayload.depth = payload.depth + 1;
-      newPayload.attenuation = make_float3(1.f);
-      newPayload.randSeed = tea<16>(payload.randSeed, newPayload.depth);
-      rtTrace(topGroup, newRay, newPayload);
-      if (length(newPayload.attenuation)) {
-        H = normalize(L + V);
-        float lightPdf = lightDst * lightDst / light.area / dot(normalOnLight, -L);
-        float objPdf = disneyPdf(disneyParams, N, L, V, H);
-        if (lightPdf > 0 && objPdf > 0) {
-          float3 brdf = disneyEval(disneyParams, baseColor, N, L, V, H);
-          directLightColor += powerHeuristic(lightPdf, objPdf) * brdf * light.emission * newPayload.attenuation / max(0.001f, lightPdf);
-        }
-      }
-    }
+  int cell = guideParams.enabled ? guideCell(guideParams, frontHitPoint) : -1;
+  GuideCdf guide = { cell };
+  DisneyBsdf bsdf = { disneyParams, baseColor, N, V, guide, cell >= 0 ? guideCellFraction[cell] : 0.f };
+  float3 directLightColor = sampleDirectLight(frontHitPoint, N, bsdf);
+  if (causticsEnabled && payload.causticState == CAUSTIC_BEFORE_DIFFUSE) {
+    directLightColor += gatherCaustics(frontHitPoint, N, bsdf);
   }
 
   float3 indirectColor = make_float3(0.f);
-  disneySample(payload.randSeed, disneyParams, N, L, V, H);
+  if (rand(payload.randSeed) < bsdf.guideFraction) {
+    float u0 = rand(payload.randSeed);
+    float u1 = rand(payload.randSeed);
+    float u2 = rand(payload.randSeed);
+    L = sampleGuide(guide, u0, u1, u2);
+  } else {
+    disneySample(payload.randSeed, disneyParams, N, L, V, H);
+  }
   if (dot(N, L) > 0.0f && dot(N, V) > 0.0f) {
     Ray newRay(frontHitPoint, L, rayTypeRadiance, rayEpsilonT);
     Payload newPayload;
     newPayload.depth = payload.depth + 1;
     newPayload.color = make_float3(1.f);
     newPayload.randSeed = tea<16>(payload.randSeed, newPayload.depth);
+    float pdf = bsdf.pdf(L);
+    newPayload.bsdfPdf = pdf;
+    newPayload.causticState = causticAfterDiffuse(payload.causticState);
+    RAY_STAT(RAY_STAT_RADIANCE_RAYS);
     rtTrace(topGroup, newRay, newPayload);
 
-    float pdf = disneyPdf(disneyParams, N, L, V, H);
     if (pdf > 0) {
-      float3 brdf = disneyEval(disneyParams, baseColor, N, L, V, H);
-      indirectColor = brdf * newPayload.color / pdf;
+      indirectColor = bsdf.eval(L) * newPayload.color / pdf;
+      // training data: incident radiance over the density it was sampled with
+      if (guideParams.training && cell >= 0) {
+        float luminance = dot(newPayload.color, make_float3(0.2126f, 0.7152f, 0.0722f));
+        atomicAdd(&guideAccum[cell * GUIDE_BINS + guideBin(L)], luminance / pdf);
+      }
     }
+  } else {
+    RAY_STAT_PATH_END(RAY_STAT_END_ABSORBED, payload.depth);
   }
 
   payload.color = indirectColor + directLightColor + disneyParams.emission;
 }
 
-RT_PROGRAM void disneyAnyHit() {
-  if (disneyParams.brdfType == GLASS) {
+// with caustics on, light through glass is carried by photons instead
+__device__ __inline__ void disneyShadow(DisneyParams& disneyParams) {
+  if (disneyParams.brdfType == GLASS && !causticsEnabled) {
     payload.attenuation *= disneyParams.color;
   } else {
     payload.attenuation = make_float3(0.f);
@@ -231,11 +542,69 @@ RT_PROGRAM void disneyAnyHit() {
   }
 }
 
+__device__ __inline__ void disneyPhotonHit(DisneyParams& disneyParams) {
+  if (disneyParams.brdfType == GLASS) {
+    float3 origin, direction;
+    scatterDielectric(DISNEY_GLASS_IOR, photon.randSeed, origin, direction);
+    continuePhoton(origin, direction, disneyBaseColor(disneyParams));
+  } else {
+    storePhoton();
+  }
+}
+
+RT_PROGRAM void disney() {
+  shadeDisney(disneyParams);
+}
+
+RT_PROGRAM void disneyAnyHit() {
+  disneyShadow(disneyParams);
+}
+
+RT_PROGRAM void disneyPhoton() {
+  disneyPhotonHit(disneyParams);
+}
+
+// merged meshes look their material up by the per-triangle index
+rtBuffer<DisneyParams> disneyParamsBuffer;
+rtDeclareVariable(int, mtlIdx, attribute mtlIdx, );
+
+RT_PROGRAM void disneyMerged() {
+  DisneyParams params = disneyParamsBuffer[mtlIdx];
+  shadeDisney(params);
+}
+
+RT_PROGRAM void disneyMergedAnyHit() {
+  DisneyParams params = disneyParamsBuffer[mtlIdx];
+  disneyShadow(params);
+}
+
+RT_PROGRAM void disneyMergedPhoton() {
+  DisneyParams params = disneyParamsBuffer[mtlIdx];
+  disneyPhotonHit(params);
+}
+
 // ====================== light ==========================
 
 rtDeclareVariable(LightParams, lightParams, , );
 
 RT_PROGRAM void light() {
-  payload.color = lightParams.emission;
+  recordFirstHit(make_float3(1.f), faceforward(shadingNormal, -ray.direction, geoNormal));
+  RAY_STAT_PATH_END(RAY_STAT_END_LIGHT, payload.depth);
+  // rays sampled by a BSDF that also did next-event estimation share this
+  // light with the shadow ray estimate; the back side is never light sampled
+  // specular chains behind the first diffuse vertex are photon mapped
+  if (causticsEnabled && payload.causticState == CAUSTIC_SPECULAR_CHAIN) {
+    payload.color = make_float3(0.f);
+    return;
+  }
+  float weight = 1.f;
+  if (payload.bsdfPdf > 0.f) {
+    float pdf = lightPdf(lightParams, ray.origin, ray.direction, t);
+    if (pdf > 0.f) {
+      // resampled first hits count every light they could sample themselves
+      weight = restirEnabled && payload.depth == 2 ? 0.f : powerHeuristic(payload.bsdfPdf, pdf);
+    }
+  }
+  payload.color = lightParams.emission * weight;
 }
 
@@ -1,11 +1,57 @@
+#include <chrono>
 #include <random>
+#include <set>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
 #include "MinimalOptiX.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
-
 using namespace optix;
 
+static const std::vector<std::pair<QString, MinimalOptiX::SceneId>> kScenePresets = {
+  { "spheres", MinimalOptiX::SCENE_SPHERES },
+  { "coffee", MinimalOptiX::SCENE_COFFEE },
+  { "bedroom", MinimalOptiX::SCENE_BEDROOM },
+  { "diningroom", MinimalOptiX::SCENE_DININGROOM },
+  { "stormtrooper", MinimalOptiX::SCENE_STORMTROOPER },
+  { "spaceship", MinimalOptiX::SCENE_SPACESHIP },
+  { "cornell", MinimalOptiX::SCENE_CORNELL },
+  { "hyperion", MinimalOptiX::SCENE_HYPERION },
+  { "dragon", MinimalOptiX::SCENE_DRAGON },
+  { "video", MinimalOptiX::SCENE_SPHERES_VIDEO },
+  { "stress", MinimalOptiX::SCENE_STRESS }
+};
+
+// frame index of --make-reference renders, no video reaches it
+static const uint kReferenceFrameIndex = 0xffffffffu;
+
+// value following a command line option, or an empty string
+static QString argValue(const QStringList& args, const QString& option, int offset = 1) {
+  int idx = args.indexOf(option);
+  if (idx < 0 || idx + offset >= args.size()) {
+    return QString();
+  }
+  return args[idx + offset];
+}
+
+static QString sceneName(MinimalOptiX::SceneId id) {
+  for (auto& preset : kScenePresets) {
+    if (preset.second == id) {
+      return preset.first;
+    }
+  }
+  return QString();
+}
+
+static MinimalOptiX::SceneId sceneIdFromName(const QString& name) {
+  for (auto& preset : kScenePresets) {
+    if (preset.first == name) {
+      return preset.second;
+    }
+  }
+  throw std::invalid_argument("Unknown scene " + name.toStdString() + ".");
+}
+
 MinimalOptiX::MinimalOptiX(QWidget *parent)
   : QMainWindow(parent)
 {
@@ -22,42 +68,178 @@ MinimalOptiX::MinimalOptiX(QWidget *parent)
 
   canvas = QImage(ui.view->size(), QImage::Format_RGB888);
 
+  QStringList args = QCoreApplication::arguments();
+  resume = args.contains("--resume");
+  denoise = args.contains("--denoise");
+  if (resume && denoise) {
+    // checkpoints hold only the radiance, the resumed albedo and normal
+    // sums would miss the samples before the checkpoint
+    throw std::runtime_error("--resume cannot be combined with --denoise.");
+  }
+  temporalReuse = args.contains("--temporal");
+  pathGuiding = args.contains("--guiding");
+  mergeMeshes = args.contains("--merge-meshes");
+  caustics = args.contains("--caustics");
+  restir = args.contains("--restir");
+  rayStatsEnabled = args.contains("--ray-stats");
+  checkExceptions = args.contains("--check-exceptions");
+  if (args.contains("--heatmap")) {
+    heatmap = true;
+    QString channel = argValue(args, "--heatmap");
+    heatmapChannel = channel == "shadow" ? COST_SHADOW_RAYS : channel == "time" ? COST_KILOCYCLES : COST_BOUNCES;
+  }
+  if (args.contains("--envmap")) {
+    envMapFile = argValue(args, "--envmap").toStdString();
+  }
+  if (args.contains("--env-scale")) {
+    envMapScale = argValue(args, "--env-scale").toFloat();
+  }
+  if (args.contains("--scene")) {
+    sceneId = sceneIdFromName(argValue(args, "--scene"));
+  } else {
+    sceneId = SCENE_SPHERES;
+  }
+  if (args.contains("--spp")) {
+    nSuperSampling = argValue(args, "--spp").toUInt();
+  }
+
+  if (args.contains("--workers")) {
+    videoWorkers = argValue(args, "--workers").toUInt();
+  }
+  if (args.contains("--device")) {
+    deviceOrdinal = argValue(args, "--device").toInt();
+  }
+
+  if (args.contains("--fanout")) {
+    // the workers compile and render on their own, this process only merges
+    headless = true;
+    fanOutRender(argValue(args, "--fanout").toUInt(), argValue(args, "--fanout", 2).toStdString());
+    return;
+  }
+
+  if (args.contains("--cpu-trace")) {
+    // runs on the host only, no context is created
+    headless = true;
+    QString out = argValue(args, "--cpu-trace");
+    runCpuTrace(out.startsWith("--") ? std::string() : out.toStdString());
+    return;
+  }
+
   compilePtx();
   setupContext();
 
-  sceneId = SCENE_SPHERES;
-  renderScene();
-
-  //imageDemo();
-  // videoDemo();
+  if (args.contains("--references")) {
+    referenceFolder = argValue(args, "--references").toStdString() + "/";
+  }
+  if (args.contains("--benchmark")) {
+    headless = true;
+    runBenchmark(argValue(args, "--benchmark").toStdString());
+  } else if (args.contains("--make-reference")) {
+    headless = true;
+    renderReference();
+  } else if (args.contains("--quality")) {
+    // --quality <out.json> [seconds per scene]
+    headless = true;
+    QString seconds = argValue(args, "--quality", 2);
+    runQualityBenchmark(argValue(args, "--quality").toStdString(), seconds.isEmpty() || seconds.startsWith("--") ? 16.0 : seconds.toDouble());
+  } else if (args.contains("--light-sampling-report")) {
+    headless = true;
+    lightSamplingReport(args.contains("--spp") ? nSuperSampling : 4096u);
+  } else if (args.contains("--frames")) {
+    // video worker: --frames <first> <count> <stride>
+    headless = true;
+    sceneId = SCENE_SPHERES_VIDEO;
+    setupScene();
+    validateContext();
+    renderVideoFrames(argValue(args, "--frames").toUInt(), argValue(args, "--frames", 2).toUInt(), argValue(args, "--frames", 3).toUInt());
+  } else if (args.contains("--partial")) {
+    headless = true;
+    renderPartial(argValue(args, "--samples").toUInt(), argValue(args, "--samples", 2).toUInt(), argValue(args, "--partial").toStdString());
+  } else if (args.contains("--image-demo")) {
+    imageDemo();
+  } else if (args.contains("--video-demo")) {
+    videoDemo();
+  } else {
+    renderScene();
+  }
 }
 
 void MinimalOptiX::compilePtx() {
+  TraceSpan span("compilePtx");
   std::string value;
+  std::vector<std::string> defines;
+  if (rayStatsEnabled) {
+    defines.push_back("-DRAY_STATS");
+  }
+  if (heatmap) {
+    defines.push_back("-DCOST_HEATMAP");
+  }
   for (auto& key : cuFiles) {
-    cuFileToPtxStr(key, value);
+    TraceSpan fileSpan("compile", key);
+    cuFileToPtxStr(key, value, defines);
     ptxStrs.insert(std::make_pair(key, value));
   }
 }
 
 void MinimalOptiX::updateContent(float nAccumulation, bool clearBuffer) {
-  float* bufferData = (float*)context["accuBuffer"]->getBuffer()->map();
+  TraceSpan span("updateContent");
+  Buffer accuBuffer = context["accuBuffer"]->getBuffer();
+  Buffer albedoBuffer = context["albedoAovBuffer"]->getBuffer();
+  Buffer normalBuffer = context["normalAovBuffer"]->getBuffer();
+  float* bufferData = (float*)accuBuffer->map();
+  float* albedoData = (float*)albedoBuffer->map();
+  float* normalData = (float*)normalBuffer->map();
+  size_t nValues = 3 * size_t(fixedWidth) * fixedHeight;
+
+  // src is scaled by srcScale to get the displayed radiance
+  const float* src = bufferData;
+  float srcScale = 1.f / nAccumulation;
+  std::vector<float> denoised;
+  if (denoise) {
+    std::vector<float> color(nValues), albedo(nValues), normal(nValues);
+    for (size_t i = 0; i < nValues; ++i) {
+      color[i] = bufferData[i] / nAccumulation;
+      albedo[i] = albedoData[i] / nAccumulation;
+      normal[i] = normalData[i] / nAccumulation;
+    }
+    denoised.resize(nValues);
+    ::denoise(color.data(), albedo.data(), normal.data(), fixedWidth, fixedHeight, denoiserSettings, denoised.data());
+    src = denoised.data();
+    srcScale = 1.f;
+  }
+
   QColor color;
   for (uint i = 0; i < fixedHeight; ++i) {
     for (uint j = 0; j < fixedWidth; ++j) {
-      float* src = bufferData + 3 * (i * fixedWidth + j);
-      color.setRedF(clamp(src[0] / nAccumulation, 0.f, 1.f));
-      color.setGreenF(clamp(src[1] / nAccumulation, 0.f, 1.f));
-      color.setBlueF(clamp(src[2] / nAccumulation, 0.f, 1.f));
+      const float* pixel = src + 3 * (i * fixedWidth + j);
+      color.setRedF(clamp(pixel[0] * srcScale, 0.f, 1.f));
+      color.setGreenF(clamp(pixel[1] * srcScale, 0.f, 1.f));
+      color.setBlueF(clamp(pixel[2] * srcScale, 0.f, 1.f));
       canvas.setPixelColor(j, fixedHeight - i - 1, color);
-      if (clearBuffer) {
-        src[0] = 0.0f;
-        src[1] = 0.0f;
-        src[2] = 0.0f;
-      }
     }
   }
-  context["accuBuffer"]->getBuffer()->unmap();
+  if (clearBuffer) {
+    memset(bufferData, 0, sizeof(float) * nValues);
+    memset(albedoData, 0, sizeof(float) * nValues);
+    memset(normalData, 0, sizeof(float) * nValues);
+  }
+  accuBuffer->unmap();
+  albedoBuffer->unmap();
+  normalBuffer->unmap();
+
+  if (heatmap) {
+    Buffer costBuffer = context["costBuffer"]->getBuffer();
+    float* costData = (float*)costBuffer->map();
+    averageCost(costData, fixedWidth, fixedHeight, costImage);
+    float scale = drawHeatmap(costImage, heatmapChannel, fixedWidth, fixedHeight, canvas);
+    // the title shows the scale instead of the log, this runs every frame
+    setWindowTitle(QString("MinimalOptiX - red is %1 %2 per path").arg(scale)
+      .arg(heatmapChannel == COST_BOUNCES ? "bounces" : heatmapChannel == COST_SHADOW_RAYS ? "shadow rays" : "kilocycles"));
+    if (clearBuffer) {
+      memset(costData, 0, sizeof(float) * 4 * fixedWidth * fixedHeight);
+    }
+    costBuffer->unmap();
+  }
 
   QPixmap tmpPixmap = QPixmap::fromImage(canvas);
   qgscene.clear();
@@ -65,42 +247,53 @@ void MinimalOptiX::updateContent(float nAccumulation, bool clearBuffer) {
   ui.view->update();
 }
 
-void MinimalOptiX::saveCurrentFrame(bool popUpDialog, std::string fileNamePrefix) {
-  QString fileName;
+void MinimalOptiX::saveCurrentFrame(bool popUpDialog, std::string fileNamePrefix, ImageWriter::Compression compression) {
+  TraceSpan span("saveCurrentFrame");
   if (fileNamePrefix.empty()) {
-    fileName = QString::number(QDateTime::currentMSecsSinceEpoch()) + QString(".png");
-  } else {
-    fileName = QString::fromStdString(fileNamePrefix) + QString(".png");
+    fileNamePrefix = std::to_string(QDateTime::currentMSecsSinceEpoch());
   }
-  canvas.save(fileName);
-  if (popUpDialog) {
-    QMessageBox::information(
-      this,
-      "Save",
-      "Image saved to " + fileName,
-      QMessageBox::Ok
-    );
+  QString fileName = QString::fromStdString(fileNamePrefix) + QString(".png");
+  if (heatmap && !costImage.empty()) {
+    // bounces, shadow rays and kilocycles per path as the RGB channels
+    writePfm(fileNamePrefix + ".cost.pfm", costImage.data(), fixedWidth, fixedHeight);
   }
+  if (!popUpDialog) {
+    // batch saves go through the background writer
+    imageWriter.save(canvas.copy(), fileName, compression);
+    return;
+  }
+  canvas.save(fileName);
+  QMessageBox::information(
+    this,
+    "Save",
+    "Image saved to " + fileName,
+    QMessageBox::Ok
+  );
 }
 
 void MinimalOptiX::imageDemo() {
-  nSuperSampling = 4096u;
-  sceneId = SCENE_COFFEE;
-  renderScene(true, "coffee");
-  sceneId = SCENE_BEDROOM;
-  renderScene(true, "bedroom");
-  sceneId = SCENE_DININGROOM;
-  renderScene(true, "diningroom");
-  sceneId = SCENE_STORMTROOPER;
-  renderScene(true, "stormtrooper");
-  sceneId = SCENE_SPACESHIP;
-  renderScene(true, "spaceship");
-  sceneId = SCENE_CORNELL;
-  renderScene(true, "cornell");
-  sceneId = SCENE_HYPERION;
-  renderScene(true, "hyperion");
-  sceneId = SCENE_DRAGON;
-  renderScene(true, "dragon");
+  nSuperSampling = denoise ? 128u : 4096u;
+  std::vector<std::pair<SceneId, std::string>> batch = {
+    { SCENE_COFFEE, "coffee" },
+    { SCENE_BEDROOM, "bedroom" },
+    { SCENE_DININGROOM, "diningroom" },
+    { SCENE_STORMTROOPER, "stormtrooper" },
+    { SCENE_SPACESHIP, "spaceship" },
+    { SCENE_CORNELL, "cornell" },
+    { SCENE_HYPERION, "hyperion" },
+    { SCENE_DRAGON, "dragon" }
+  };
+  // the preloader parses scene N + 1 while scene N is rendering, scenes
+  // sharing a folder (hyperion and dragon) are parsed once
+  for (auto& job : batch) {
+    std::string name = sceneFolderName(job.first);
+    preloader.enqueue(baseSceneFolder + name + "/", name);
+  }
+  for (auto& job : batch) {
+    sceneId = job.first;
+    renderScene(true, job.second);
+  }
+  imageWriter.flush();
   QMessageBox::information(
     this,
     "Done",
@@ -112,10 +305,195 @@ void MinimalOptiX::imageDemo() {
 void MinimalOptiX::videoDemo() {
   nSuperSampling = 128u;
   sceneId = SCENE_SPHERES_VIDEO;
+  if (videoWorkers > 1) {
+    recordParallel(1000, "test.mp4", videoWorkers);
+    return;
+  }
   renderScene(false, "VIDEO");
   record(1000, "test.mp4", true);
 }
 
+void MinimalOptiX::lightSamplingReport(uint nSamples) {
+  // builds every preset to compare light sampling on the lights it really uploads
+  for (auto& preset : kScenePresets) {
+    sceneId = preset.second;
+    try {
+      setupScene();
+    } catch (std::exception& e) {
+      printf("%-14s skipped: %s\n", preset.first.toStdString().c_str(), e.what());
+      continue;
+    }
+    Buffer lightBuffer = context["lights"]->getBuffer();
+    RTsize nLights;
+    lightBuffer->getSize(nLights);
+    std::vector<LightParams> lights(nLights);
+    if (nLights) {
+      memcpy(lights.data(), lightBuffer->map(), sizeof(LightParams) * nLights);
+      lightBuffer->unmap();
+    }
+    compareLightSampling(preset.first.toStdString(), lights, nSamples);
+    compareLightResampling(preset.first.toStdString(), lights, nSamples, restirCandidates, restirMaxMFactor * restirCandidates);
+  }
+}
+
+// renders the --scene preset like the window does and writes the timings,
+// the exception counts and the memory report, plus the ray counters when
+// --ray-stats is on, to fileName
+void MinimalOptiX::runBenchmark(const std::string& fileName) {
+  cameraLaunchSeconds = 0.0;
+  rayStats = RayStats();
+  exceptionStats = ExceptionStats();
+  auto begin = std::chrono::steady_clock::now();
+  renderScene();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  QJsonObject report;
+  report["scene"] = sceneName(sceneId);
+  report["width"] = int(fixedWidth);
+  report["height"] = int(fixedHeight);
+  report["spp"] = int(nSuperSampling);
+  report["seconds"] = seconds;
+  report["cameraLaunchSeconds"] = cameraLaunchSeconds;
+  report["samplesPerSecond"] = cameraLaunchSeconds > 0.0 ? double(fixedWidth) * fixedHeight * nSuperSampling / cameraLaunchSeconds : 0.0;
+  if (rayStatsEnabled) {
+    report["rayStats"] = rayStats.toJson();
+  }
+  report["exceptions"] = exceptionStats.toJson();
+  report["memory"] = memory.toJson();
+  writeJson(fileName, report);
+}
+
+// renders the --scene preset at --spp and writes its mean image to
+// <referenceFolder>/<scene>.pfm for runQualityBenchmark()
+void MinimalOptiX::renderReference() {
+  std::string fileName = referenceFolder + sceneName(sceneId).toStdString() + ".pfm";
+  QDir().mkpath(QString::fromStdString(referenceFolder));
+  // Seeds depend only on pixel, sample and frame index. On frame 0 the
+  // first k samples of a --quality render would be the reference's own,
+  // and its error would shrink toward 0 at the reference's sample count.
+  uint savedFrame = context["frameIndex"]->getUint();
+  context["frameIndex"]->setUint(kReferenceFrameIndex);
+  passObserver = [&](uint samples) {
+    if (samples == nSuperSampling) {
+      // the accumulation is cleared once renderScene() displays it
+      Buffer accuBuffer = context["accuBuffer"]->getBuffer();
+      const float* accu = (const float*)accuBuffer->map();
+      std::vector<float> mean(accu, accu + 3 * size_t(fixedWidth) * fixedHeight);
+      accuBuffer->unmap();
+      for (auto& value : mean) {
+        value /= samples;
+      }
+      writePfm(fileName, mean.data(), fixedWidth, fixedHeight);
+    }
+    return true;
+  };
+  renderScene();
+  passObserver = nullptr;
+  context["frameIndex"]->setUint(savedFrame);
+  qDebug() << "reference" << QString::fromStdString(fileName) << "at" << nSuperSampling << "samples";
+}
+
+// Equal-time convergence: every preset with a reference renders for
+// maxSeconds, and its error is measured whenever the elapsed render time
+// passes 1/64, 1/32, ... of that. Measuring is not counted as render time;
+// the first pass, which builds the BVHs, is, and is reported separately.
+void MinimalOptiX::runQualityBenchmark(const std::string& fileName, double maxSeconds) {
+  QJsonArray scenes;
+  uint savedSamples = nSuperSampling;
+  for (auto& preset : kScenePresets) {
+    std::string referenceName = referenceFolder + preset.first.toStdString() + ".pfm";
+    std::vector<float> reference;
+    int width, height;
+    if (!QFileInfo::exists(QString::fromStdString(referenceName))) {
+      continue;
+    }
+    if (!readPfm(referenceName, reference, width, height) || width != int(fixedWidth) || height != int(fixedHeight)) {
+      qDebug() << "skipping" << preset.first << "reference is not" << fixedWidth << "x" << fixedHeight;
+      continue;
+    }
+
+    QJsonArray curve;
+    double budget = maxSeconds / 64.0;
+    double elapsed = 0.0;
+    double firstPassSeconds = 0.0;
+    auto last = std::chrono::steady_clock::now();
+    passObserver = [&](uint samples) {
+      if (samples > 0) {
+        elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count();
+        if (samples == 1) {
+          firstPassSeconds = elapsed;
+        }
+      }
+      if (samples > 0 && elapsed >= budget) {
+        Buffer accuBuffer = context["accuBuffer"]->getBuffer();
+        ImageError error = imageError((const float*)accuBuffer->map(), 1.f / samples, reference.data(), reference.size());
+        accuBuffer->unmap();
+        QJsonObject point;
+        point["seconds"] = elapsed;
+        point["samples"] = int(samples);
+        point["rmse"] = error.rmse;
+        point["relMse"] = error.relMse;
+        curve.append(point);
+        while (budget <= elapsed) {
+          budget *= 2.0;
+        }
+      }
+      last = std::chrono::steady_clock::now();
+      return elapsed < maxSeconds;
+    };
+    sceneId = preset.second;
+    nSuperSampling = 1u << 30;
+    renderScene();
+    nSuperSampling = savedSamples;
+    passObserver = nullptr;
+
+    QJsonObject scene;
+    scene["scene"] = preset.first;
+    scene["reference"] = QString::fromStdString(referenceName);
+    scene["firstPassSeconds"] = firstPassSeconds;
+    scene["curve"] = curve;
+    scenes.append(scene);
+  }
+
+  // the features that change convergence, to tell runs apart
+  QJsonObject settings;
+  settings["guiding"] = pathGuiding;
+  settings["caustics"] = caustics;
+  settings["restir"] = restir;
+  settings["envMap"] = QString::fromStdString(envMapFile);
+  QJsonObject report;
+  report["width"] = int(fixedWidth);
+  report["height"] = int(fixedHeight);
+  report["maxSeconds"] = maxSeconds;
+  report["settings"] = settings;
+  report["scenes"] = scenes;
+  writeJson(fileName, report);
+}
+
+// Parses the --scene meshes once and traces them on the host, without a
+// context. The camera is framed by presetCamera() on the triangles' bounds.
+void MinimalOptiX::runCpuTrace(const std::string& fileName) {
+  std::string name = sceneFolderName(sceneId);
+  if (name.empty()) {
+    throw std::runtime_error("--cpu-trace needs a scene loaded from meshes.");
+  }
+  // only the triangles are kept, the parsed scene is freed before the build
+  std::vector<float3> vertices;
+  std::vector<int> indices;
+  {
+    SceneAssets assets(baseSceneFolder + name + "/", name);
+    sceneTriangles(assets, vertices, indices);
+  }
+  // the same bounds setupScene() frames the preset camera on
+  Aabb bounds;
+  bounds.invalidate();
+  for (int index : indices) {
+    bounds.include(vertices[index]);
+  }
+  CamParams camParams = presetCamera(bounds);
+  runCpuTraceBenchmark(sceneName(sceneId).toStdString(), vertices, indices, camParams, fixedWidth, fixedHeight, rayEpsilonT, fileName);
+}
+
 void MinimalOptiX::keyPressEvent(QKeyEvent* e) {
   switch (e->key()) {
   case Qt::Key_Space:
@@ -127,32 +505,290 @@ void MinimalOptiX::keyPressEvent(QKeyEvent* e) {
   }
 }
 
+Program MinimalOptiX::getProgram(const std::string& cuFileName, const std::string& programName) {
+  std::string key = cuFileName + ":" + programName;
+  auto it = programs.find(key);
+  if (it != programs.end()) {
+    return it->second;
+  }
+  Program program = context->createProgramFromPTXString(ptxStrs[cuFileName], programName);
+  programs.insert(std::make_pair(key, program));
+  return program;
+}
+
+void MinimalOptiX::setupCamera(CamParams& camParams) {
+  // camParams lives on the context so that per-frame updates only rewrite
+  // the variable instead of creating a new ray generation program
+  context["camParams"]->setUserData(sizeof(CamParams), &camParams);
+  context->setRayGenerationProgram(0, getProgram(camCuFileName, "camera"));
+}
+
 void MinimalOptiX::setupContext() {
+  programs.clear();
   context = Context::create();
-  context->setRayTypeCount(2);
-  context->setEntryPointCount(1);
+  if (deviceOrdinal >= 0) {
+    context->setDevices(&deviceOrdinal, &deviceOrdinal + 1);
+  }
+  context->setRayTypeCount(3);
+  // entry 0 traces camera paths, entry 1 the caustic photons
+  context->setEntryPointCount(2);
   context->setStackSize(9608);
 
   context["rayTypeRadiance"]->setUint(RAY_TYPE_RADIANCE);
   context["rayTypeShadow"]->setUint(RAY_TYPE_SHADOW);
+  context["rayTypePhoton"]->setUint(RAY_TYPE_PHOTON);
   context["rayMaxDepth"]->setUint(rayMaxDepth);
   context["rayMinIntensity"]->setFloat(rayMinIntensity);
   context["rayEpsilonT"]->setFloat(rayEpsilonT);
   context["absorbColor"]->setFloat(0.f, 0.f, 0.f);
   context["nSuperSampling"]->setUint(nSuperSampling);
+  context["sampleIndex"]->setUint(0u);
+  context["frameIndex"]->setUint(0u);
 
   Buffer accuBuffer = context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_FLOAT3, fixedWidth, fixedHeight);
   memset((float*)accuBuffer->map(), 0, sizeof(float) * 3 * fixedWidth * fixedHeight);
   accuBuffer->unmap();
   context["accuBuffer"]->set(accuBuffer);
 
-  Program exptProgram = context->createProgramFromPTXString(ptxStrs[exCuFileName], "exception");
+  // first-hit albedo and normal sums, only read when denoising
+  const char* aovNames[] = { "albedoAovBuffer", "normalAovBuffer" };
+  for (auto name : aovNames) {
+    Buffer aovBuffer = context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_FLOAT3, fixedWidth, fixedHeight);
+    memset(aovBuffer->map(), 0, sizeof(float) * 3 * fixedWidth * fixedHeight);
+    aovBuffer->unmap();
+    context[name]->set(aovBuffer);
+  }
+  Buffer gBuffer = context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_FLOAT4, fixedWidth, fixedHeight);
+  memset(gBuffer->map(), 0, sizeof(float) * 4 * fixedWidth * fixedHeight);
+  gBuffer->unmap();
+  context["gBuffer"]->set(gBuffer);
+  context["objectId"]->setInt(-1);
+  setLights({});
+
+  // 1x1 placeholders until setupEnvMap() uploads a real map
+  context["envEnabled"]->setInt(0);
+  context["envScale"]->setFloat(envMapScale);
+  Buffer envBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT3, 1, 1);
+  memset(envBuffer->map(), 0, sizeof(float) * 3);
+  envBuffer->unmap();
+  context["envMap"]->set(envBuffer);
+  float unitCdf[2] = { 0.f, 1.f };
+  Buffer conditionalBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT, 2, 1);
+  memcpy(conditionalBuffer->map(), unitCdf, sizeof(unitCdf));
+  conditionalBuffer->unmap();
+  context["envConditionalCdf"]->set(conditionalBuffer);
+  Buffer marginalBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT, 2);
+  memcpy(marginalBuffer->map(), unitCdf, sizeof(unitCdf));
+  marginalBuffer->unmap();
+  context["envMarginalCdf"]->set(marginalBuffer);
+
+  // path guiding stays off until renderScene() sets up a PathGuide
+  GuideParams guideParams = {};
+  context["guideParams"]->setUserData(sizeof(GuideParams), &guideParams);
+  const char* guideNames[] = { "guideCdf", "guideCellFraction", "guideAccum" };
+  for (auto name : guideNames) {
+    Buffer guideBuffer = context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_FLOAT, 1);
+    memset(guideBuffer->map(), 0, sizeof(float));
+    guideBuffer->unmap();
+    context[name]->set(guideBuffer);
+  }
+
+  // every pixel takes every pass until temporal reuse lowers its budget
+  Buffer budgetBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_INT, fixedWidth, fixedHeight);
+  memset(budgetBuffer->map(), 0xff, sizeof(uint) * fixedWidth * fixedHeight);
+  budgetBuffer->unmap();
+  context["sampleBudgetBuffer"]->set(budgetBuffer);
+
+  if (rayStatsEnabled) {
+    Buffer statsBuffer = context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_UNSIGNED_INT, RAY_STATS_STRIPES * RAY_STAT_COUNT);
+    memset(statsBuffer->map(), 0, sizeof(uint) * RAY_STATS_STRIPES * RAY_STAT_COUNT);
+    statsBuffer->unmap();
+    context["rayStats"]->set(statsBuffer);
+  }
+  if (heatmap) {
+    Buffer costBuffer = context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_FLOAT4, fixedWidth, fixedHeight);
+    memset(costBuffer->map(), 0, sizeof(float) * 4 * fixedWidth * fixedHeight);
+    costBuffer->unmap();
+    context["costBuffer"]->set(costBuffer);
+  }
+
+  // light reservoirs, empty (M == 0) until the first resampled launch
+  context["restirEnabled"]->setInt(restir);
+  context["restirCandidates"]->setInt(restirCandidates);
+  context["restirMaxM"]->setFloat(restirMaxMFactor * restirCandidates);
+  CamParams noCamera = {};
+  context["prevCamParams"]->setUserData(sizeof(CamParams), &noCamera);
+  const char* reservoirNames[] = { "restirReservoirs", "restirPrevReservoirs" };
+  for (auto name : reservoirNames) {
+    Buffer reservoirBuffer = context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_USER, fixedWidth, fixedHeight);
+    reservoirBuffer->setElementSize(sizeof(Reservoir));
+    memset(reservoirBuffer->map(), 0, sizeof(Reservoir) * fixedWidth * fixedHeight);
+    reservoirBuffer->unmap();
+    context[name]->set(reservoirBuffer);
+  }
+
+  // caustic photon map stays empty until renderScene() traces photons
+  context["causticsEnabled"]->setInt(0);
+  context["causticRadius"]->setFloat(1.f);
+  context["photonCellSize"]->setFloat(2.f);
+  context["photonTableMask"]->setUint(0u);
+  const char* photonNames[] = { "photonBuffer", "photonMap" };
+  for (auto name : photonNames) {
+    Buffer photonBuffer = context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_USER);
+    photonBuffer->setElementSize(sizeof(PhotonRecord));
+    photonBuffer->setSize(1);
+    memset(photonBuffer->map(), 0, sizeof(PhotonRecord));
+    photonBuffer->unmap();
+    context[name]->set(photonBuffer);
+  }
+  Buffer cellStartBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_INT, 2);
+  memset(cellStartBuffer->map(), 0, sizeof(uint) * 2);
+  cellStartBuffer->unmap();
+  context["photonCellStart"]->set(cellStartBuffer);
+  context->setRayGenerationProgram(1, getProgram(phCuFileName, "photonEmit"));
+
+  Program exptProgram = getProgram(exCuFileName, "exception");
   context->setExceptionProgram(0, exptProgram);
-  context["badColor"]->setFloat(1.f, 1.f, 1.f);
+  context->setExceptionProgram(1, getProgram(phCuFileName, "photonException"));
+
+  // stack overflow is the only check OptiX enables by default
+  if (checkExceptions) {
+    context->setExceptionEnabled(RT_EXCEPTION_ALL, true);
+  }
+  Buffer exceptionCount = context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_UNSIGNED_INT, 1);
+  memset(exceptionCount->map(), 0, sizeof(uint));
+  exceptionCount->unmap();
+  context["exceptionCount"]->set(exceptionCount);
+  Buffer exceptionLog = context->createBuffer(RT_BUFFER_OUTPUT, RT_FORMAT_USER, EXCEPTION_LOG_CAPACITY);
+  exceptionLog->setElementSize(sizeof(ExceptionRecord));
+  context["exceptionLog"]->set(exceptionLog);
+
+  memory = MemoryReport();
+  const char* framebufferNames[] = {
+    "accuBuffer", "albedoAovBuffer", "normalAovBuffer", "gBuffer", "sampleBudgetBuffer", "restirReservoirs", "restirPrevReservoirs"
+  };
+  for (auto name : framebufferNames) {
+    trackBuffer(MEMORY_FRAMEBUFFERS, name);
+  }
+  if (heatmap) {
+    trackBuffer(MEMORY_FRAMEBUFFERS, "costBuffer");
+  }
+  if (rayStatsEnabled) {
+    trackBuffer(MEMORY_OTHER, "rayStats");
+  }
+  trackBuffer(MEMORY_OTHER, "exceptionLog");
+}
+
+// Every launch goes through here. The first one after setupScene(), of
+// whichever entry point, uploads the buffers and builds the BVHs; height 0
+// launches a 1D entry point.
+void MinimalOptiX::launch(uint entryPoint, RTsize width, RTsize height, const char* spanName) {
+  int device = sceneLaunches == 0 ? context->getEnabledDevices()[0] : 0;
+  RTsize freeBefore = sceneLaunches == 0 ? context->getAvailableDeviceMemory(device) : 0;
+  {
+    TraceSpan span(sceneLaunches == 0 ? "first launch (acceleration build)" : spanName);
+    if (height == 0) {
+      context->launch(entryPoint, width);
+    } else {
+      context->launch(entryPoint, width, height);
+    }
+  }
+  if (sceneLaunches == 0) {
+    RTsize freeAfter = context->getAvailableDeviceMemory(device);
+    memory.firstLaunchDeviceBytes = freeBefore > freeAfter ? freeBefore - freeAfter : 0;
+  }
+  ++sceneLaunches;
+}
+
+// one camera pass; with resampling on, the reservoirs it wrote and its
+// camera become the history of the next pass
+void MinimalOptiX::launchCamera() {
+  auto begin = std::chrono::steady_clock::now();
+  launch(0, fixedWidth, fixedHeight, "launch");
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  cameraLaunchSeconds += seconds;
+  collectRayStats(seconds);
+  collectExceptions("camera");
+  if (restir) {
+    Buffer written = context["restirReservoirs"]->getBuffer();
+    context["restirReservoirs"]->set(context["restirPrevReservoirs"]->getBuffer());
+    context["restirPrevReservoirs"]->set(written);
+    CamParams camParams;
+    context["camParams"]->getUserData(sizeof(CamParams), &camParams);
+    context["prevCamParams"]->setUserData(sizeof(CamParams), &camParams);
+  }
+}
+
+// reports the exceptions of the launch that just finished and clears the counter
+void MinimalOptiX::collectExceptions(const char* launchName) {
+  Buffer countBuffer = context["exceptionCount"]->getBuffer();
+  uint* count = (uint*)countBuffer->map();
+  if (*count > 0) {
+    Buffer logBuffer = context["exceptionLog"]->getBuffer();
+    std::string summary = exceptionStats.collect(launchName, *count, (const ExceptionRecord*)logBuffer->map());
+    logBuffer->unmap();
+    qDebug() << summary.c_str();
+    *count = 0;
+  } else {
+    exceptionStats.collect(launchName, 0, nullptr);
+  }
+  countBuffer->unmap();
+}
+
+// the buffer currently bound to variableName, by that name
+void MinimalOptiX::trackBuffer(MemoryCategory category, const char* variableName) {
+  memory.set(category, variableName, bufferBytes(context[variableName]->getBuffer()));
+}
+
+void MinimalOptiX::validateContext() {
+  TraceSpan span("validate");
+  context->validate();
+}
+
+// adds the counters of the launch that just finished to rayStats and clears them
+void MinimalOptiX::collectRayStats(double launchSeconds) {
+  if (!rayStatsEnabled) {
+    return;
+  }
+  Buffer statsBuffer = context["rayStats"]->getBuffer();
+  uint* stripes = (uint*)statsBuffer->map();
+  rayStats.accumulate(stripes);
+  memset(stripes, 0, sizeof(uint) * RAY_STATS_STRIPES * RAY_STAT_COUNT);
+  statsBuffer->unmap();
+  rayStats.launchSeconds += launchSeconds;
+}
+
+void MinimalOptiX::setLights(const std::vector<LightParams>& lightsParams) {
+  Buffer lightBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
+  lightBuffer->setElementSize(sizeof(LightParams));
+  lightBuffer->setSize(lightsParams.size());
+  if (!lightsParams.empty()) {
+    memcpy(lightBuffer->map(), lightsParams.data(), sizeof(LightParams) * lightsParams.size());
+    lightBuffer->unmap();
+  }
+  context["lights"]->setBuffer(lightBuffer);
+  trackBuffer(MEMORY_LIGHTS, "lights");
+}
+
+const char* MinimalOptiX::sceneFolderName(SceneId id) {
+  switch (id) {
+  case SCENE_COFFEE: return "coffee";
+  case SCENE_BEDROOM: return "bedroom";
+  case SCENE_DININGROOM: return "diningroom";
+  case SCENE_STORMTROOPER: return "stormtrooper";
+  case SCENE_SPACESHIP: return "spaceship";
+  case SCENE_CORNELL: return "cornell";
+  case SCENE_HYPERION: return "hyperion";
+  case SCENE_DRAGON: return "hyperion";
+  case SCENE_STRESS: return "stress";
+  default: return "";
+  }
 }
 
 void MinimalOptiX::setupScene() {
+  TraceSpan span("setupScene", tracing() ? sceneName(sceneId).toStdString() : std::string());
   aabb.invalidate();
+  sceneLaunches = 0u;
   if (sceneId == SCENE_SPHERES) {
     SphereParams sphereParams[3] = {
       { 0.5f,{ 0.f, 0.f, -1.f },{ 0.f, 0.f, 0.f } } ,
@@ -160,19 +796,20 @@ void MinimalOptiX::setupScene() {
     { 0.5f,{ -1.f, 0.f, -1.f },{ 0.f, -1.5f, 0.f } }
     };
 
-    Program missProgram = context->createProgramFromPTXString(ptxStrs[msCuFileName], "staticMiss");
+    Program missProgram = getProgram(msCuFileName, "staticMiss");
     context->setMissProgram(0, missProgram);
     missProgram["bgColor"]->setFloat(0.5f, 0.5f, 0.5f);
 
     // objects
-    Program sphereIntersect = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "sphereIntersect");
-    Program sphereBBox = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "sphereBBox");
-    Program quadIntersect = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "quadIntersect");
-    Program quadBBox = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "quadBBox");
-    Program lambMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "lambertian");
-    Program metalMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "metal");
-    Program lightMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "light");
-    Program glassMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "glass");
+    Program sphereIntersect = getProgram(geoCuFileName, "sphereIntersect");
+    Program sphereBBox = getProgram(geoCuFileName, "sphereBBox");
+    Program quadIntersect = getProgram(geoCuFileName, "quadIntersect");
+    Program quadBBox = getProgram(geoCuFileName, "quadBBox");
+    Program lambMtl = getProgram(mtlCuFileName, "lambertian");
+    Program metalMtl = getProgram(mtlCuFileName, "metal");
+    Program lightMtl = getProgram(mtlCuFileName, "light");
+    Program glassMtl = getProgram(mtlCuFileName, "glass");
+    Program opaqueShadow = getProgram(mtlCuFileName, "opaqueShadow");
 
     Geometry sphereMid = context->createGeometry();
     sphereMid->setPrimitiveCount(1u);
@@ -181,6 +818,8 @@ void MinimalOptiX::setupScene() {
     sphereMid["sphereParams"]->setUserData(sizeof(SphereParams), sphereParams);
     Material sphereMidMtl = context->createMaterial();
     sphereMidMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, lambMtl);
+    sphereMidMtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "lambertianPhoton"));
+    sphereMidMtl->setAnyHitProgram(RAY_TYPE_SHADOW, opaqueShadow);
     LambertianParams lambParams = { { 0.1f, 0.2f, 0.5f } };
     sphereMidMtl["lambParams"]->setUserData(sizeof(LambertianParams), &lambParams);
     GeometryInstance sphereMidGI = context->createGeometryInstance(sphereMid, &sphereMidMtl, &sphereMidMtl + 1);
@@ -192,6 +831,8 @@ void MinimalOptiX::setupScene() {
     sphereRight["sphereParams"]->setUserData(sizeof(SphereParams), sphereParams + 1);
     Material sphereRightMtl = context->createMaterial();
     sphereRightMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, metalMtl);
+    sphereRightMtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "metalPhoton"));
+    sphereRightMtl->setAnyHitProgram(RAY_TYPE_SHADOW, opaqueShadow);
     MetalParams metalParams = { { 0.8f, 0.6f, 0.2f }, 0.f };
     sphereRightMtl["metalParams"]->setUserData(sizeof(MetalParams), &metalParams);
     GeometryInstance sphereRightGI = context->createGeometryInstance(sphereRight, &sphereRightMtl, &sphereRightMtl + 1);
@@ -203,6 +844,8 @@ void MinimalOptiX::setupScene() {
     sphereLeft["sphereParams"]->setUserData(sizeof(SphereParams), sphereParams + 2);
     Material sphereLeftMtl = context->createMaterial();
     sphereLeftMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, glassMtl);
+    sphereLeftMtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "glassPhoton"));
+    sphereLeftMtl->setAnyHitProgram(RAY_TYPE_SHADOW, opaqueShadow);
     GlassParams glassParams = { { 1.f, 1.f, 1.f }, 1.5f };
     sphereLeftMtl["glassParams"]->setUserData(sizeof(glassParams), &glassParams);
     GeometryInstance sphereLeftGI = context->createGeometryInstance(sphereLeft, &sphereLeftMtl, &sphereLeftMtl + 1);
@@ -219,6 +862,8 @@ void MinimalOptiX::setupScene() {
     quadFloor["quadParams"]->setUserData(sizeof(QuadParams), &quadParams);
     Material quadFloorMtl = context->createMaterial();
     quadFloorMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, lambMtl);
+    quadFloorMtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "lambertianPhoton"));
+    quadFloorMtl->setAnyHitProgram(RAY_TYPE_SHADOW, opaqueShadow);
     lambParams.albedo = make_float3(0.8f, 0.8f, 0.f);
     quadFloorMtl["lambParams"]->setUserData(sizeof(LambertianParams), &lambParams);
     GeometryInstance quadFloorGI = context->createGeometryInstance(quadFloor, &quadFloorMtl, &quadFloorMtl + 1);
@@ -235,9 +880,10 @@ void MinimalOptiX::setupScene() {
     Material quadLightMtl = context->createMaterial();
     quadLightMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, lightMtl);
     LightParams lightParams;
-    lightParams.emission = make_float3(1.f);
+    setQuadLightParams(anchor, v1, v2, make_float3(1.f), lightParams);
     quadLightMtl["lightParams"]->setUserData(sizeof(LightParams), &lightParams);
     GeometryInstance quadLightGI = context->createGeometryInstance(quadLight, &quadLightMtl, &quadLightMtl + 1);
+    setLights({ lightParams });
 
     std::vector<GeometryInstance> objs = { sphereMidGI, quadFloorGI, quadLightGI, sphereRightGI, sphereLeftGI };
     GeometryGroup geoGrp = context->createGeometryGroup();
@@ -252,142 +898,237 @@ void MinimalOptiX::setupScene() {
     optix::float3 lookAt = { 0.f, 0.f, -1.f };
     optix::float3 up = { 0.f, 1.f, 0.f };
     setCamParams(lookFrom, lookAt, up, 20, (float)fixedWidth / (float)fixedHeight, 0.5f, length(lookFrom - lookAt), camParams);
-    Program rayGenProgram = context->createProgramFromPTXString(ptxStrs[camCuFileName], "camera");
-    rayGenProgram["camParams"]->setUserData(sizeof(CamParams), &camParams);
-    context->setRayGenerationProgram(0, rayGenProgram);
+    setupCamera(camParams);
   } else if (sceneId == SCENE_COFFEE) {
-    Program missProgram = context->createProgramFromPTXString(ptxStrs[msCuFileName], "staticMiss");
+    Program missProgram = getProgram(msCuFileName, "staticMiss");
     context->setMissProgram(0, missProgram);
     missProgram["bgColor"]->setFloat(0.f, 0.f, 0.f);
-    setupScene("coffee");
-    optix::float3 lookFrom = make_float3(0.f, 0.22 * aabb.extent(1), 0.25 * aabb.extent(2));
-    optix::float3 lookAt = lookFrom + make_float3(0.f, -0.01875f, -1.f);
-    optix::float3 up = make_float3(0.f, 1.f, 0.f);
-    CamParams camParams;
-    setCamParams(lookFrom, lookAt, up, 45, (float)fixedWidth / (float)fixedHeight, 0.f, 1.f, camParams);
-    Program rayGenProgram = context->createProgramFromPTXString(ptxStrs[camCuFileName], "camera");
-    rayGenProgram["camParams"]->setUserData(sizeof(CamParams), &camParams);
-    context->setRayGenerationProgram(0, rayGenProgram);
+    setupScene(sceneFolderName(sceneId));
+    CamParams camParams = presetCamera(aabb);
+    setupCamera(camParams);
   } else if (sceneId == SCENE_BEDROOM) {
-    Program missProgram = context->createProgramFromPTXString(ptxStrs[msCuFileName], "staticMiss");
+    Program missProgram = getProgram(msCuFileName, "staticMiss");
     context->setMissProgram(0, missProgram);
     missProgram["bgColor"]->setFloat(0.f, 0.f, 0.f);
-    setupScene("bedroom");
-    optix::float3 lookFrom = aabb.center() + make_float3(0.3f, 0.1f, 0.45f) * aabb.extent();
-    optix::float3 lookAt = aabb.center() + make_float3(0.05f, -0.1f, 0.f) * aabb.extent();
-    optix::float3 up = make_float3(0.f, 1.f, 0.f);
-    CamParams camParams;
-    setCamParams(lookFrom, lookAt, up, 45, (float)fixedWidth / (float)fixedHeight, 0.f, 1.f, camParams);
-    Program rayGenProgram = context->createProgramFromPTXString(ptxStrs[camCuFileName], "camera");
-    rayGenProgram["camParams"]->setUserData(sizeof(CamParams), &camParams);
-    context->setRayGenerationProgram(0, rayGenProgram);
+    setupScene(sceneFolderName(sceneId));
+    CamParams camParams = presetCamera(aabb);
+    setupCamera(camParams);
   } else if (sceneId == SCENE_DININGROOM) {
-    Program missProgram = context->createProgramFromPTXString(ptxStrs[msCuFileName], "staticMiss");
+    Program missProgram = getProgram(msCuFileName, "staticMiss");
     context->setMissProgram(0, missProgram);
     missProgram["bgColor"]->setFloat(0.f, 0.f, 0.f);
-    setupScene("diningroom");
-    optix::float3 lookFrom = aabb.center() + make_float3(-0.7f, 0.f, 0.f) * aabb.extent();
-    optix::float3 lookAt = aabb.center() + make_float3(0.f, 0.f, 0.f) * aabb.extent();
-    optix::float3 up = make_float3(0.f, 1.f, 0.f);
-    CamParams camParams;
-    setCamParams(lookFrom, lookAt, up, 45, (float)fixedWidth / (float)fixedHeight, 0.f, 1.f, camParams);
-    Program rayGenProgram = context->createProgramFromPTXString(ptxStrs[camCuFileName], "camera");
-    rayGenProgram["camParams"]->setUserData(sizeof(CamParams), &camParams);
-    context->setRayGenerationProgram(0, rayGenProgram);
+    setupScene(sceneFolderName(sceneId));
+    CamParams camParams = presetCamera(aabb);
+    setupCamera(camParams);
   } else if (sceneId == SCENE_STORMTROOPER) {
-    Program missProgram = context->createProgramFromPTXString(ptxStrs[msCuFileName], "staticMiss");
+    Program missProgram = getProgram(msCuFileName, "staticMiss");
     context->setMissProgram(0, missProgram);
     missProgram["bgColor"]->setFloat(0.5f, 0.5f, 0.5f);
-    setupScene("stormtrooper");
-    optix::float3 lookFrom = aabb.center() + make_float3(0.25f, 0.1f, 0.395f) * aabb.extent();
-    optix::float3 lookAt = aabb.center() + make_float3(0.25f, 0.1f, 0.f) * aabb.extent();
-    optix::float3 up = make_float3(0.f, 1.f, 0.f);
-    CamParams camParams;
-    setCamParams(lookFrom, lookAt, up, 30, (float)fixedWidth / (float)fixedHeight, 0.f, 1.f, camParams);
-    Program rayGenProgram = context->createProgramFromPTXString(ptxStrs[camCuFileName], "camera");
-    rayGenProgram["camParams"]->setUserData(sizeof(CamParams), &camParams);
-    context->setRayGenerationProgram(0, rayGenProgram);
+    setupScene(sceneFolderName(sceneId));
+    CamParams camParams = presetCamera(aabb);
+    setupCamera(camParams);
   } else if (sceneId == SCENE_SPACESHIP) {
-    Program missProgram = context->createProgramFromPTXString(ptxStrs[msCuFileName], "staticMiss");
+    Program missProgram = getProgram(msCuFileName, "staticMiss");
     context->setMissProgram(0, missProgram);
     missProgram["bgColor"]->setFloat(0.5f, 0.5f, 0.5f);
-    setupScene("spaceship");
-    optix::float3 lookFrom = aabb.center() + make_float3(-0.03f, 0.03f, -0.03f) * aabb.extent();
-    optix::float3 lookAt = aabb.center() + make_float3(0.f, 0.f, 0.f) * aabb.extent();
-    optix::float3 up = make_float3(0.f, 1.f, 0.f);
-    CamParams camParams;
-    setCamParams(lookFrom, lookAt, up, 45, (float)fixedWidth / (float)fixedHeight, 0.f, 1.f, camParams);
-    Program rayGenProgram = context->createProgramFromPTXString(ptxStrs[camCuFileName], "camera");
-    rayGenProgram["camParams"]->setUserData(sizeof(CamParams), &camParams);
-    context->setRayGenerationProgram(0, rayGenProgram);
+    setupScene(sceneFolderName(sceneId));
+    CamParams camParams = presetCamera(aabb);
+    setupCamera(camParams);
   } else if (sceneId == SCENE_CORNELL) {
-    Program missProgram = context->createProgramFromPTXString(ptxStrs[msCuFileName], "staticMiss");
+    Program missProgram = getProgram(msCuFileName, "staticMiss");
     context->setMissProgram(0, missProgram);
     missProgram["bgColor"]->setFloat(0.5f, 0.5f, 0.5f);
-    setupScene("cornell");
-    optix::float3 lookFrom = aabb.center() + make_float3(0.f, 0.f, -2.f) * aabb.extent();
-    optix::float3 lookAt = aabb.center() + make_float3(0.f, 0.f, 0.f) * aabb.extent();
-    optix::float3 up = make_float3(0.f, 1.f, 0.f);
-    CamParams camParams;
-    setCamParams(lookFrom, lookAt, up, 39.3077, (float)fixedWidth / (float)fixedHeight, 0.f, 1.f, camParams);
-    Program rayGenProgram = context->createProgramFromPTXString(ptxStrs[camCuFileName], "camera");
-    rayGenProgram["camParams"]->setUserData(sizeof(CamParams), &camParams);
-    context->setRayGenerationProgram(0, rayGenProgram);
+    setupScene(sceneFolderName(sceneId));
+    CamParams camParams = presetCamera(aabb);
+    setupCamera(camParams);
   } else if (sceneId == SCENE_HYPERION || sceneId == SCENE_DRAGON) {
-    Program missProgram = context->createProgramFromPTXString(ptxStrs[msCuFileName], "staticMiss");
+    Program missProgram = getProgram(msCuFileName, "staticMiss");
     context->setMissProgram(0, missProgram);
     missProgram["bgColor"]->setFloat(0.5f, 0.5f, 0.5f);
-    setupScene("hyperion");
-    optix::float3 lookFrom;
-    if (sceneId == SCENE_HYPERION) {
-      lookFrom = aabb.center() + make_float3(-0.08f, 2.f, 0.f) * aabb.extent();
-    } else {
-      lookFrom = aabb.center() + make_float3(0.05f, 0.3f, -0.005f) * aabb.extent();
-    }
-    optix::float3 lookAt = aabb.center() + make_float3(0.f, 0.f, 0.f) * aabb.extent();
-    optix::float3 up = make_float3(0.f, 1.f, 0.f);
-    CamParams camParams;
-    setCamParams(lookFrom, lookAt, up, 30, (float)fixedWidth / (float)fixedHeight, 0.f, 1.f, camParams);
-    Program rayGenProgram = context->createProgramFromPTXString(ptxStrs[camCuFileName], "camera");
-    rayGenProgram["camParams"]->setUserData(sizeof(CamParams), &camParams);
-    context->setRayGenerationProgram(0, rayGenProgram);
+    setupScene(sceneFolderName(sceneId));
+    CamParams camParams = presetCamera(aabb);
+    setupCamera(camParams);
   } else if (sceneId == SCENE_SPHERES_VIDEO) {
     setUpVideo(256);
+  } else if (sceneId == SCENE_STRESS) {
+    Program missProgram = getProgram(msCuFileName, "staticMiss");
+    context->setMissProgram(0, missProgram);
+    missProgram["bgColor"]->setFloat(0.1f, 0.1f, 0.1f);
+    setupScene(sceneFolderName(sceneId));
+    CamParams camParams = presetCamera(aabb);
+    setupCamera(camParams);
+  }
+  setupEnvMap();
+}
+
+// The camera of a mesh preset, framed on the bounds of its triangles so it
+// can be computed on the host without a context.
+CamParams MinimalOptiX::presetCamera(const optix::Aabb& bounds) const {
+  optix::float3 lookFrom = bounds.center();
+  optix::float3 lookAt = bounds.center();
+  optix::float3 up = make_float3(0.f, 1.f, 0.f);
+  float vFoV = 45.f;
+  if (sceneId == SCENE_COFFEE) {
+    lookFrom = make_float3(0.f, 0.22 * bounds.extent(1), 0.25 * bounds.extent(2));
+    lookAt = lookFrom + make_float3(0.f, -0.01875f, -1.f);
+  } else if (sceneId == SCENE_BEDROOM) {
+    lookFrom = bounds.center() + make_float3(0.3f, 0.1f, 0.45f) * bounds.extent();
+    lookAt = bounds.center() + make_float3(0.05f, -0.1f, 0.f) * bounds.extent();
+  } else if (sceneId == SCENE_DININGROOM) {
+    lookFrom = bounds.center() + make_float3(-0.7f, 0.f, 0.f) * bounds.extent();
+  } else if (sceneId == SCENE_STORMTROOPER) {
+    lookFrom = bounds.center() + make_float3(0.25f, 0.1f, 0.395f) * bounds.extent();
+    lookAt = bounds.center() + make_float3(0.25f, 0.1f, 0.f) * bounds.extent();
+    vFoV = 30.f;
+  } else if (sceneId == SCENE_SPACESHIP) {
+    lookFrom = bounds.center() + make_float3(-0.03f, 0.03f, -0.03f) * bounds.extent();
+  } else if (sceneId == SCENE_CORNELL) {
+    lookFrom = bounds.center() + make_float3(0.f, 0.f, -2.f) * bounds.extent();
+    vFoV = 39.3077f;
+  } else if (sceneId == SCENE_HYPERION) {
+    lookFrom = bounds.center() + make_float3(-0.08f, 2.f, 0.f) * bounds.extent();
+    vFoV = 30.f;
+  } else if (sceneId == SCENE_DRAGON) {
+    lookFrom = bounds.center() + make_float3(0.05f, 0.3f, -0.005f) * bounds.extent();
+    vFoV = 30.f;
+  } else if (sceneId == SCENE_STRESS) {
+    // the ground is a little wider than the field of spheres
+    lookFrom = lookAt + make_float3(0.f, 0.3f * bounds.extent(0), 0.45f * bounds.extent(2));
   }
+  CamParams camParams;
+  setCamParams(lookFrom, lookAt, up, vFoV, (float)fixedWidth / (float)fixedHeight, 0.f, 1.f, camParams);
+  return camParams;
+}
+
+void MinimalOptiX::setupEnvMap() {
+  if (envMapFile.empty()) {
+    return;
+  }
+  // loaded once, every scene of a batch reuses the map and its tables
+  if (!envMap) {
+    envMap = std::make_shared<EnvMap>(envMapFile);
+  }
+  Buffer envBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT3, envMap->width, envMap->height);
+  memcpy(envBuffer->map(), envMap->rgb.data(), sizeof(float) * envMap->rgb.size());
+  envBuffer->unmap();
+  context["envMap"]->set(envBuffer);
+  Buffer conditionalBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT, envMap->width + 1, envMap->height);
+  memcpy(conditionalBuffer->map(), envMap->conditionalCdf.data(), sizeof(float) * envMap->conditionalCdf.size());
+  conditionalBuffer->unmap();
+  context["envConditionalCdf"]->set(conditionalBuffer);
+  Buffer marginalBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT, envMap->height + 1);
+  memcpy(marginalBuffer->map(), envMap->marginalCdf.data(), sizeof(float) * envMap->marginalCdf.size());
+  marginalBuffer->unmap();
+  context["envMarginalCdf"]->set(marginalBuffer);
+  context["envEnabled"]->setInt(1);
+  context["envScale"]->setFloat(envMapScale);
+  trackBuffer(MEMORY_LIGHTS, "envMap");
+  trackBuffer(MEMORY_LIGHTS, "envConditionalCdf");
+  trackBuffer(MEMORY_LIGHTS, "envMarginalCdf");
+  context->setMissProgram(0, getProgram(msCuFileName, "envMiss"));
 }
 
 void MinimalOptiX::setupScene(const char* sceneName) {
   nVertices = 0;
   nFaces = 0;
-  Program sphereIntersect = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "sphereIntersect");
-  Program sphereBBox = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "sphereBBox");
-  Program quadIntersect = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "quadIntersect");
-  Program quadBBox = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "quadBBox");
-  Program meshIntersect = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "meshIntersect");
-  Program meshBBox = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "meshBBox");
-  Program lightMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "light");
-  Program glassMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "glass");
-  Program disneyMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "disney");
-  Program disneyAnyHit = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "disneyAnyHit");
+  Program sphereIntersect = getProgram(geoCuFileName, "sphereIntersect");
+  Program sphereBBox = getProgram(geoCuFileName, "sphereBBox");
+  Program quadIntersect = getProgram(geoCuFileName, "quadIntersect");
+  Program quadBBox = getProgram(geoCuFileName, "quadBBox");
+  Program meshIntersect = getProgram(geoCuFileName, "meshIntersect");
+  Program meshBBox = getProgram(geoCuFileName, "meshBBox");
+  Program lightMtl = getProgram(mtlCuFileName, "light");
+  Program glassMtl = getProgram(mtlCuFileName, "glass");
+  Program disneyMtl = getProgram(mtlCuFileName, "disney");
+  Program disneyAnyHit = getProgram(mtlCuFileName, "disneyAnyHit");
+  Program mergedMeshIntersect = getProgram(geoCuFileName, "mergedMeshIntersect");
+  Program disneyMergedMtl = getProgram(mtlCuFileName, "disneyMerged");
+  Program disneyMergedAnyHit = getProgram(mtlCuFileName, "disneyMergedAnyHit");
 
   std::string sceneFolder = baseSceneFolder + sceneName + "/";
-  Scene scene((sceneFolder + sceneName + ".scene").c_str());
+  std::shared_ptr<SceneAssets> assets = preloader.take(sceneName);
+  if (!assets) {
+    assets = std::make_shared<SceneAssets>(sceneFolder, sceneName);
+  }
+  Scene& scene = assets->scene;
+  memory.sceneAssetBytes = assets->bytes();
+  const MemoryCategory sceneCategories[] = { MEMORY_GEOMETRY, MEMORY_INDICES, MEMORY_TEXTURES };
+  for (auto category : sceneCategories) {
+    memory.clear(category);
+  }
   std::map<std::string, TextureSampler> texNameSamplerMap;
 
   GeometryGroup meshGroup = context->createGeometryGroup();
   meshGroup->setAcceleration(context->createAcceleration("Trbvh"));
+
+  // merged mode: every shape goes into one set of buffers, materials are
+  // looked up per triangle from disneyParamsBuffer
+  std::vector<float> mergedVertices;
+  std::vector<float> mergedNormals;
+  std::vector<float> mergedTexcoords;
+  std::vector<int> mergedVertIdx;
+  std::vector<int> mergedTexIdx;
+  std::vector<int> mergedNormIdx;
+  std::vector<int> mergedMtlIdx;
+
   for (int i = 0; i < scene.meshNames.size(); ++i) {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string warn;
-    std::string err;
-    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, (sceneFolder + scene.meshNames[i]).c_str());
-    if (!err.empty() || !ret) {
-      std::cerr << err << std::endl;
-      throw std::logic_error("Cannot load mesh file.");
-    }
-    for (size_t s = 0; s < shapes.size(); s++) {
+    tinyobj::attrib_t& attrib = assets->meshes[i].attrib;
+    std::vector<tinyobj::shape_t>& shapes = assets->meshes[i].shapes;
+
+    // texture
+    if (!scene.textures[i].empty()) {
+      if (texNameSamplerMap.find(scene.textures[i]) == texNameSamplerMap.end()) {
+        TextureData& tex = assets->textures[scene.textures[i]];
+
+        TextureSampler sampler = context->createTextureSampler();
+        sampler->setWrapMode(0, RT_WRAP_REPEAT);
+        sampler->setWrapMode(1, RT_WRAP_REPEAT);
+        sampler->setWrapMode(2, RT_WRAP_REPEAT);
+        sampler->setIndexingMode(RT_TEXTURE_INDEX_NORMALIZED_COORDINATES);
+        sampler->setReadMode(RT_TEXTURE_READ_NORMALIZED_FLOAT);
+        sampler->setMaxAnisotropy(1.f);
+        sampler->setMipLevelCount(1u);
+        sampler->setArraySize(1u);
+
+        Buffer buffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, tex.width, tex.height);
+        memcpy(buffer->map(), tex.rgba.data(), sizeof(float) * tex.rgba.size());
+        buffer->unmap();
+
+        sampler->setBuffer(0u, 0u, buffer);
+        memory.set(MEMORY_TEXTURES, scene.textures[i], bufferBytes(buffer));
+        sampler->setFilteringModes(RT_FILTER_LINEAR, RT_FILTER_LINEAR, RT_FILTER_NONE);
+
+        texNameSamplerMap[scene.textures[i]] = sampler;
+      }
+      scene.materials[i].albedoID = texNameSamplerMap[scene.textures[i]]->getId();
+    }
+
+    if (mergeMeshes) {
+      int vertexOffset = int(mergedVertices.size() / 3);
+      int normalOffset = int(mergedNormals.size() / 3);
+      int texcoordOffset = int(mergedTexcoords.size() / 2);
+      mergedVertices.insert(mergedVertices.end(), attrib.vertices.begin(), attrib.vertices.end());
+      mergedNormals.insert(mergedNormals.end(), attrib.normals.begin(), attrib.normals.end());
+      mergedTexcoords.insert(mergedTexcoords.end(), attrib.texcoords.begin(), attrib.texcoords.end());
+      nVertices += attrib.vertices.size() / 3;
+      for (size_t s = 0; s < shapes.size(); s++) {
+        for (int f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
+          for (int fv = 0; fv < 3; ++fv) {
+            auto& idx = shapes[s].mesh.indices[f * 3 + fv];
+            mergedVertIdx.push_back(idx.vertex_index + vertexOffset);
+            mergedTexIdx.push_back(idx.texcoord_index < 0 ? -1 : idx.texcoord_index + texcoordOffset);
+            mergedNormIdx.push_back(idx.normal_index < 0 ? -1 : idx.normal_index + normalOffset);
+            tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
+            tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
+            tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
+            aabb.include(make_float3(vx, vy, vz));
+          }
+          mergedMtlIdx.push_back(i);
+        }
+        nFaces += shapes[s].mesh.num_face_vertices.size();
+      }
+    }
+    for (size_t s = 0; s < shapes.size() && !mergeMeshes; s++) {
       // geometry
       Geometry geo = context->createGeometry();
       geo->setPrimitiveCount(uint(shapes[s].mesh.num_face_vertices.size()));
@@ -439,48 +1180,16 @@ void MinimalOptiX::setupScene(const char* sceneName) {
       geo["vertIdxBuffer"]->set(vertIdxBuffer);
       geo["texIdxBuffer"]->set(texIdxBuffer);
       geo["normIdxBuffer"]->set(normIdxBuffer);
+      // every shape of a mesh gets its own copy of the mesh's attributes
+      const std::string& meshName = scene.meshNames[i];
+      memory.add(MEMORY_GEOMETRY, meshName, bufferBytes(vertexBuffer) + bufferBytes(normalBuffer) + bufferBytes(texcoordBuffer));
+      memory.add(MEMORY_INDICES, meshName, bufferBytes(vertIdxBuffer) + bufferBytes(texIdxBuffer) + bufferBytes(normIdxBuffer));
       nFaces += shapes[s].mesh.num_face_vertices.size();
 
-      // texture
-      if (!scene.textures[i].empty()) {
-        if (texNameSamplerMap.find(scene.textures[i]) == texNameSamplerMap.end()) {
-          QImage img((sceneFolder + scene.textures[i]).c_str());
-
-          TextureSampler sampler = context->createTextureSampler();
-          sampler->setWrapMode(0, RT_WRAP_REPEAT);
-          sampler->setWrapMode(1, RT_WRAP_REPEAT);
-          sampler->setWrapMode(2, RT_WRAP_REPEAT);
-          sampler->setIndexingMode(RT_TEXTURE_INDEX_NORMALIZED_COORDINATES);
-          sampler->setReadMode(RT_TEXTURE_READ_NORMALIZED_FLOAT);
-          sampler->setMaxAnisotropy(1.f);
-          sampler->setMipLevelCount(1u);
-          sampler->setArraySize(1u);
-
-          Buffer buffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, img.width(), img.height());
-          float* bufferData = (float*)buffer->map();
-          for (int i = 0; i < img.width(); ++i) {
-            for (int j = 0; j < img.height(); ++j) {
-              float* dst = bufferData + 4 * (j * img.width() + i);
-              auto color = img.pixelColor(i, img.height() - j - 1);
-              dst[0] = color.redF();
-              dst[1] = color.greenF();
-              dst[2] = color.blueF();
-              dst[3] = 1.f;
-            }
-          }
-          buffer->unmap();
-
-          sampler->setBuffer(0u, 0u, buffer);
-          sampler->setFilteringModes(RT_FILTER_LINEAR, RT_FILTER_LINEAR, RT_FILTER_NONE);
-
-          texNameSamplerMap[scene.textures[i]] = sampler;
-        }
-        scene.materials[i].albedoID = texNameSamplerMap[scene.textures[i]]->getId();
-      }
-
       // material
       Material mtl = context->createMaterial();
       mtl->setClosestHitProgram(RAY_TYPE_RADIANCE, disneyMtl);
+      mtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "disneyPhoton"));
       mtl->setAnyHitProgram(RAY_TYPE_SHADOW, disneyAnyHit);
       mtl["disneyParams"]->setUserData(sizeof(DisneyParams), &(scene.materials[i]));
 
@@ -489,8 +1198,73 @@ void MinimalOptiX::setupScene(const char* sceneName) {
     }
   }
 
+  if (mergeMeshes && !mergedMtlIdx.empty()) {
+    Geometry geo = context->createGeometry();
+    geo->setPrimitiveCount(uint(mergedMtlIdx.size()));
+    geo->setIntersectionProgram(mergedMeshIntersect);
+    geo->setBoundingBoxProgram(meshBBox);
+
+    Buffer vertexBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT3, mergedVertices.size() / 3);
+    memcpy(vertexBuffer->map(), mergedVertices.data(), sizeof(float) * mergedVertices.size());
+    vertexBuffer->unmap();
+    geo["vertexBuffer"]->set(vertexBuffer);
+
+    Buffer normalBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT3, mergedNormals.size() / 3);
+    if (!mergedNormals.empty()) {
+      memcpy(normalBuffer->map(), mergedNormals.data(), sizeof(float) * mergedNormals.size());
+      normalBuffer->unmap();
+    }
+    geo["normalBuffer"]->set(normalBuffer);
+
+    Buffer texcoordBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT2, mergedTexcoords.size() / 2);
+    if (!mergedTexcoords.empty()) {
+      memcpy(texcoordBuffer->map(), mergedTexcoords.data(), sizeof(float) * mergedTexcoords.size());
+      texcoordBuffer->unmap();
+    }
+    geo["texcoordBuffer"]->set(texcoordBuffer);
+
+    Buffer vertIdxBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_INT3, mergedMtlIdx.size());
+    memcpy(vertIdxBuffer->map(), mergedVertIdx.data(), sizeof(int) * mergedVertIdx.size());
+    vertIdxBuffer->unmap();
+    geo["vertIdxBuffer"]->set(vertIdxBuffer);
+
+    Buffer texIdxBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_INT3, mergedMtlIdx.size());
+    memcpy(texIdxBuffer->map(), mergedTexIdx.data(), sizeof(int) * mergedTexIdx.size());
+    texIdxBuffer->unmap();
+    geo["texIdxBuffer"]->set(texIdxBuffer);
+
+    Buffer normIdxBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_INT3, mergedMtlIdx.size());
+    memcpy(normIdxBuffer->map(), mergedNormIdx.data(), sizeof(int) * mergedNormIdx.size());
+    normIdxBuffer->unmap();
+    geo["normIdxBuffer"]->set(normIdxBuffer);
+
+    Buffer mtlIdxBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_INT, mergedMtlIdx.size());
+    memcpy(mtlIdxBuffer->map(), mergedMtlIdx.data(), sizeof(int) * mergedMtlIdx.size());
+    mtlIdxBuffer->unmap();
+    geo["mtlIdxBuffer"]->set(mtlIdxBuffer);
+
+    Buffer disneyParamsBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
+    disneyParamsBuffer->setElementSize(sizeof(DisneyParams));
+    disneyParamsBuffer->setSize(scene.materials.size());
+    memcpy(disneyParamsBuffer->map(), scene.materials.data(), sizeof(DisneyParams) * scene.materials.size());
+    disneyParamsBuffer->unmap();
+    memory.set(MEMORY_GEOMETRY, "merged", bufferBytes(vertexBuffer) + bufferBytes(normalBuffer) + bufferBytes(texcoordBuffer) + bufferBytes(disneyParamsBuffer));
+    memory.set(MEMORY_INDICES, "merged", bufferBytes(vertIdxBuffer) + bufferBytes(texIdxBuffer) + bufferBytes(normIdxBuffer) + bufferBytes(mtlIdxBuffer));
+
+    Material mtl = context->createMaterial();
+    mtl->setClosestHitProgram(RAY_TYPE_RADIANCE, disneyMergedMtl);
+    mtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "disneyMergedPhoton"));
+    mtl->setAnyHitProgram(RAY_TYPE_SHADOW, disneyMergedAnyHit);
+    mtl["disneyParamsBuffer"]->setBuffer(disneyParamsBuffer);
+
+    GeometryInstance meshGI = context->createGeometryInstance(geo, &mtl, &mtl + 1);
+    meshGroup->addChild(meshGI);
+  }
+
   // lights
-  GeometryGroup lightGroup = context->createGeometryGroup();
+  // merged mode keeps the lights in the mesh group too, so the whole scene
+  // sits under a single BVH without any instance transitions
+  GeometryGroup lightGroup = mergeMeshes ? meshGroup : context->createGeometryGroup();
   lightGroup->setAcceleration(context->createAcceleration("Trbvh"));
   for (auto& light : scene.lights) {
     Geometry geo = context->createGeometry();
@@ -520,16 +1294,14 @@ void MinimalOptiX::setupScene(const char* sceneName) {
     lightGroup->addChild(gi);
   }
 
-  Buffer lightBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
-  lightBuffer->setElementSize(sizeof(LightParams));
-  lightBuffer->setSize(scene.lights.size());
-  LightParams* lightBufData = (LightParams*)lightBuffer->map();
-  for (int i = 0; i < scene.lights.size(); ++i) {
-    memcpy(lightBufData + i, &(scene.lights[i]), sizeof(LightParams));
-  }
-  lightBuffer->unmap();
-  context["lights"]->setBuffer(lightBuffer);
+  setLights(scene.lights);
+  // parsed assets and the staging copies above are all still alive here
+  memory.hostPeakBytes = processPeakBytes();
 
+  if (mergeMeshes) {
+    context["topGroup"]->set(meshGroup);
+    return;
+  }
   Group topGroup = context->createGroup();
   topGroup->setAcceleration(context->createAcceleration("Trbvh"));
   topGroup->addChild(meshGroup);
@@ -537,26 +1309,231 @@ void MinimalOptiX::setupScene(const char* sceneName) {
   context["topGroup"]->set(topGroup);
 }
 
+uint MinimalOptiX::loadAccumulation(const std::string& prefix) {
+  AccuCheckpoint checkpoint;
+  if (!loadCheckpoint(prefix, checkpoint)) {
+    return 0;
+  }
+  if (checkpoint.sceneId != sceneId || checkpoint.width != int(fixedWidth) || checkpoint.height != int(fixedHeight) || checkpoint.firstSample != 0) {
+    qDebug() << "ignoring checkpoint" << QString::fromStdString(prefix) << "of a different render";
+    return 0;
+  }
+  Buffer accuBuffer = context["accuBuffer"]->getBuffer();
+  memcpy(accuBuffer->map(), checkpoint.accu.data(), sizeof(float) * checkpoint.accu.size());
+  accuBuffer->unmap();
+  qDebug() << "resuming" << QString::fromStdString(prefix) << "at" << checkpoint.samples << "samples";
+  return std::min(checkpoint.samples, nSuperSampling);
+}
+
+void MinimalOptiX::saveAccumulation(const std::string& prefix, uint firstSample, uint samples, bool final) {
+  auto checkpoint = std::make_shared<AccuCheckpoint>();
+  checkpoint->sceneId = sceneId;
+  checkpoint->width = fixedWidth;
+  checkpoint->height = fixedHeight;
+  checkpoint->firstSample = firstSample;
+  checkpoint->samples = samples;
+  checkpoint->accu.resize(3 * fixedWidth * fixedHeight);
+  Buffer accuBuffer = context["accuBuffer"]->getBuffer();
+  memcpy(checkpoint->accu.data(), accuBuffer->map(), sizeof(float) * checkpoint->accu.size());
+  accuBuffer->unmap();
+
+  // only the copy above stalls the render loop, the files are written while
+  // the next passes launch
+  if (checkpointWrite.valid()) {
+    checkpointWrite.get();
+  }
+  checkpointWrite = std::async(std::launch::async, [checkpoint, prefix, final]() {
+    saveCheckpoint(prefix, *checkpoint);
+    if (final) {
+      std::vector<float> mean(checkpoint->accu);
+      for (auto& value : mean) {
+        value /= checkpoint->samples;
+      }
+      writePfm(prefix + ".pfm", mean.data(), checkpoint->width, checkpoint->height);
+    }
+  });
+}
+
 void MinimalOptiX::renderScene(bool autoSave, std::string fileNamePrefix) {
   setupScene();
-  context->validate();
+  validateContext();
+  uint start = 0;
+  if (autoSave) {
+    // per scene, though writes still queued from the last scene count here
+    imageWriter.resetStats();
+  }
+  if (autoSave && resume) {
+    start = loadAccumulation(fileNamePrefix);
+  }
   uint checkpoint = 1;
-  for (uint i = 0; i < nSuperSampling; ++i) {
-    context["randSeed"]->setInt(randSeed());
-    context->launch(0, fixedWidth, fixedHeight);
+  while (checkpoint <= start) {
+    checkpoint *= 2;
+  }
+  std::unique_ptr<PathGuide> guide;
+  if (pathGuiding && aabb.valid()) {
+    guide.reset(new PathGuide(aabb, guideResolution));
+    uploadGuide(*guide, true);
+  }
+  uint guideUpdate = start + 1;
+  // progressive photon mapping: the gather radius shrinks every pass so the
+  // caustic estimate converges, r^2 <- r^2 * (i + alpha) / (i + 1)
+  float causticRadius2 = 0.f;
+  if (caustics) {
+    float radius = aabb.valid() ? causticRadiusScale * length(aabb.extent()) : 0.05f;
+    causticRadius2 = radius * radius;
+    for (uint i = 0; i < start; ++i) {
+      causticRadius2 *= (i + 1 + 2.f / 3.f) / (i + 2);
+    }
+    context["causticsEnabled"]->setInt(1);
+  }
+  uint samples = nSuperSampling;
+  if (passObserver && !passObserver(start)) {
+    samples = start;
+  }
+  for (uint i = start; i < samples; ++i) {
+    context["sampleIndex"]->setUint(i);
+    if (caustics) {
+      emitCausticPhotons(sqrtf(causticRadius2));
+      causticRadius2 *= (i + 1 + 2.f / 3.f) / (i + 2);
+    }
+    launchCamera();
+    // the guide is refit after 1, 2, 4, ... passes and frozen after training
+    if (guide && i + 1 == guideUpdate && i + 1 - start <= guideTrainingPasses) {
+      Buffer accumBuffer = context["guideAccum"]->getBuffer();
+      guide->build((float*)accumBuffer->map(), guideFraction, 0.1f);
+      accumBuffer->unmap();
+      guide->params.training = 2 * (i + 1 - start) <= guideTrainingPasses;
+      uploadGuide(*guide, false);
+      guideUpdate = start + 2 * (i + 1 - start);
+    }
     if (autoSave) {
       if ((i + 1) % checkpoint == 0) {
         updateContent(i + 1, false);
-        saveCurrentFrame(false, fileNamePrefix + "_" + std::to_string(i + 1));
+        saveCurrentFrame(false, fileNamePrefix + "_" + std::to_string(i + 1), ImageWriter::COMPRESSION_FAST);
         checkpoint *= 2;
       }
+      if ((i + 1) % checkpointInterval == 0 && i + 1 < nSuperSampling) {
+        saveAccumulation(fileNamePrefix, 0, i + 1, false);
+      }
+    }
+    if (passObserver && !passObserver(i + 1)) {
+      samples = i + 1;
     }
   }
-  updateContent(nSuperSampling, true);
+  if (autoSave) {
+    saveAccumulation(fileNamePrefix, 0, samples, true);
+  }
+  updateContent(float(std::max(samples, 1u)), true);
   if (autoSave) {
     saveCurrentFrame(false, fileNamePrefix);
   }
   qDebug() << "vertices:" << nVertices << "faces:" << nFaces;
+  if (guide) {
+    qDebug() << "path guide: trained cells" << guide->trainedCells << "of" << guide->nCells()
+             << "normalization error" << guide->normalizationError()
+             << "sampling error" << guide->samplingError();
+    GuideParams disabled = {};
+    context["guideParams"]->setUserData(sizeof(GuideParams), &disabled);
+  }
+  if (caustics) {
+    qDebug() << "caustics: stored photons" << photonMap.photons.size() << "of" << nPhotons
+             << "final radius" << photonMap.radius;
+    context["causticsEnabled"]->setInt(0);
+  }
+  if (autoSave) {
+    ImageWriter::Stats writerStats = imageWriter.stats();
+    qDebug() << "image writer: written" << writerStats.written << "max queue" << writerStats.maxQueueDepth
+             << "stalled ms" << writerStats.stalledMs;
+  }
+}
+
+void MinimalOptiX::uploadGuide(const PathGuide& guide, bool resetAccum) {
+  context["guideParams"]->setUserData(sizeof(GuideParams), &guide.params);
+  Buffer cdfBuffer = context["guideCdf"]->getBuffer();
+  cdfBuffer->setSize(guide.cdf.size());
+  memcpy(cdfBuffer->map(), guide.cdf.data(), sizeof(float) * guide.cdf.size());
+  cdfBuffer->unmap();
+  Buffer fractionBuffer = context["guideCellFraction"]->getBuffer();
+  fractionBuffer->setSize(guide.cellFraction.size());
+  memcpy(fractionBuffer->map(), guide.cellFraction.data(), sizeof(float) * guide.cellFraction.size());
+  fractionBuffer->unmap();
+  if (resetAccum) {
+    Buffer accumBuffer = context["guideAccum"]->getBuffer();
+    accumBuffer->setSize(guide.nCells() * GUIDE_BINS);
+    memset(accumBuffer->map(), 0, sizeof(float) * guide.nCells() * GUIDE_BINS);
+    accumBuffer->unmap();
+  }
+  trackBuffer(MEMORY_OTHER, "guideCdf");
+  trackBuffer(MEMORY_OTHER, "guideCellFraction");
+  trackBuffer(MEMORY_OTHER, "guideAccum");
+}
+
+// traces nPhotons from the lights for the pass in sampleIndex and uploads
+// the ones that reached a diffuse surface over a specular chain, hashed
+// into cells for the gather
+void MinimalOptiX::emitCausticPhotons(float radius) {
+  Buffer photonBuffer = context["photonBuffer"]->getBuffer();
+  photonBuffer->setSize(nPhotons);
+  auto begin = std::chrono::steady_clock::now();
+  launch(1, nPhotons, 0, "photon launch");
+  collectRayStats(std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+  collectExceptions("photon");
+  photonMap.build((const PhotonRecord*)photonBuffer->map(), nPhotons, radius);
+  photonBuffer->unmap();
+
+  Buffer cellStartBuffer = context["photonCellStart"]->getBuffer();
+  cellStartBuffer->setSize(photonMap.cellStart.size());
+  memcpy(cellStartBuffer->map(), photonMap.cellStart.data(), sizeof(uint) * photonMap.cellStart.size());
+  cellStartBuffer->unmap();
+  Buffer mapBuffer = context["photonMap"]->getBuffer();
+  mapBuffer->setSize(std::max<size_t>(photonMap.photons.size(), 1));
+  if (!photonMap.photons.empty()) {
+    memcpy(mapBuffer->map(), photonMap.photons.data(), sizeof(PhotonRecord) * photonMap.photons.size());
+    mapBuffer->unmap();
+  }
+  context["causticRadius"]->setFloat(photonMap.radius);
+  context["photonCellSize"]->setFloat(photonMap.cellSize);
+  context["photonTableMask"]->setUint(photonMap.tableMask);
+  trackBuffer(MEMORY_OTHER, "photonBuffer");
+  trackBuffer(MEMORY_OTHER, "photonCellStart");
+  trackBuffer(MEMORY_OTHER, "photonMap");
+}
+
+void MinimalOptiX::renderPartial(uint firstSample, uint lastSample, const std::string& prefix) {
+  setupScene();
+  validateContext();
+  for (uint i = firstSample; i < lastSample; ++i) {
+    context["sampleIndex"]->setUint(i);
+    launchCamera();
+  }
+  saveAccumulation(prefix, firstSample, lastSample - firstSample, false);
+  checkpointWrite.get();
+}
+
+void MinimalOptiX::fanOutRender(uint nWorkers, const std::string& prefix) {
+  std::vector<std::unique_ptr<QProcess>> workers;
+  std::vector<std::string> partials;
+  for (uint k = 0; k < nWorkers; ++k) {
+    uint firstSample = nSuperSampling * k / nWorkers;
+    uint lastSample = nSuperSampling * (k + 1) / nWorkers;
+    std::string partial = prefix + "_part" + std::to_string(k);
+    QStringList workerArgs = {
+      "--scene", sceneName(sceneId),
+      "--samples", QString::number(firstSample), QString::number(lastSample),
+      "--partial", QString::fromStdString(partial)
+    };
+    workers.emplace_back(new QProcess());
+    workers.back()->setProcessChannelMode(QProcess::ForwardedChannels);
+    workers.back()->start(QCoreApplication::applicationFilePath(), workerArgs);
+    partials.push_back(partial);
+  }
+  for (auto& worker : workers) {
+    worker->waitForFinished(-1);
+    if (worker->exitStatus() != QProcess::NormalExit || worker->exitCode() != 0) {
+      throw std::runtime_error("Partial render worker failed.");
+    }
+  }
+  mergeCheckpoints(partials, prefix);
 }
 
 void MinimalOptiX::move(SphereParams& param, float time) {
@@ -584,9 +1561,13 @@ void MinimalOptiX::move(SphereParams& param, float time) {
   }
 }
 
-void MinimalOptiX::animate(float time) {
-  videoParams.angle += time * 5;
+void MinimalOptiX::animateTo(uint frame) {
+  // move() resolves every bounce analytically, so one call from the initial
+  // state lands on the same trajectory as stepping through all frames
+  float time = frame * videoParams.frameTime;
+  videoParams.angle = time * 5;
   for (size_t i = 0; i < videoParams.spheresParams.size(); ++i) {
+    videoParams.spheresParams[i] = videoParams.initialSpheresParams[i];
     move(videoParams.spheresParams[i], time);
   }
 }
@@ -604,21 +1585,82 @@ void MinimalOptiX::record(int frames, const char* filename, bool saveFrames = fa
   //generateVideo(images, filename);
 }
 
+void MinimalOptiX::renderVideoFrames(uint firstFrame, uint nFrames, uint stride) {
+  for (uint k = firstFrame; k < nFrames; k += stride) {
+    videoFrame = k;
+    updateVideo();
+    canvas.save(QString("video%1.png").arg(k));
+    // the parent reassembles frames in order from these lines
+    printf("frame %u\n", k);
+    fflush(stdout);
+  }
+}
+
+void MinimalOptiX::recordParallel(int frames, const char* filename, uint nWorkers) {
+  std::vector<std::unique_ptr<QProcess>> workers;
+  uint nDevices = Context::getDeviceCount();
+  for (uint w = 0; w < nWorkers; ++w) {
+    // interleaved frames keep all workers close to the encoder's position
+    QStringList workerArgs = {
+      "--scene", sceneName(SCENE_SPHERES_VIDEO),
+      "--spp", QString::number(nSuperSampling),
+      "--frames", QString::number(w), QString::number(frames), QString::number(nWorkers),
+      "--device", QString::number(w % std::max(nDevices, 1u))
+    };
+    workers.emplace_back(new QProcess());
+    workers.back()->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    workers.back()->start(QCoreApplication::applicationFilePath(), workerArgs);
+  }
+
+  VideoEncoder encoder(filename, fixedWidth, fixedHeight);
+  std::set<int> done;
+  int next = 0;
+  while (next < frames) {
+    while (done.count(next)) {
+      QImage image(QString("video%1.png").arg(next));
+      image = image.convertToFormat(QImage::Format_RGB888);
+      encoder.addFrame(image);
+      done.erase(next++);
+    }
+    bool running = false;
+    for (auto& worker : workers) {
+      worker->waitForReadyRead(10);
+      while (worker->canReadLine()) {
+        int k;
+        if (sscanf(worker->readLine().constData(), "frame %d", &k) == 1) {
+          done.insert(k);
+        }
+      }
+      running = running || worker->state() != QProcess::NotRunning;
+    }
+    if (!running && next < frames && !done.count(next)) {
+      throw std::runtime_error("Video worker exited before frame " + std::to_string(next) + ".");
+    }
+  }
+  encoder.finish();
+  for (auto& worker : workers) {
+    worker->waitForFinished(-1);
+  }
+}
+
 void MinimalOptiX::setUpVideo(int nSpheres) {
+  videoParams.spheres.clear();
+  videoParams.spheresParams.clear();
   std::vector<GeometryInstance> objs;
-  Program missProgram = context->createProgramFromPTXString(ptxStrs[msCuFileName], "staticMiss");
+  Program missProgram = getProgram(msCuFileName, "staticMiss");
   context->setMissProgram(0, missProgram);
   missProgram["bgColor"]->setFloat(0.2f, 0.2f, 0.2f);
-  Program sphereIntersect = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "sphereIntersect");
-  Program sphereBBox = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "sphereBBox");
-  Program quadIntersect = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "quadIntersect");
-  Program quadBBox = context->createProgramFromPTXString(ptxStrs[geoCuFileName], "quadBBox");
-  Program lambMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "lambertian");
-  Program metalMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "metal");
-  Program lightMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "light");
-  Program glassMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "glass");
-  Program disneyMtl = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "disney");
-  Program disneyAnyHit = context->createProgramFromPTXString(ptxStrs[mtlCuFileName], "disneyAnyHit");
+  Program sphereIntersect = getProgram(geoCuFileName, "sphereIntersect");
+  Program sphereBBox = getProgram(geoCuFileName, "sphereBBox");
+  Program quadIntersect = getProgram(geoCuFileName, "quadIntersect");
+  Program quadBBox = getProgram(geoCuFileName, "quadBBox");
+  Program lambMtl = getProgram(mtlCuFileName, "lambertian");
+  Program metalMtl = getProgram(mtlCuFileName, "metal");
+  Program lightMtl = getProgram(mtlCuFileName, "light");
+  Program glassMtl = getProgram(mtlCuFileName, "glass");
+  Program disneyMtl = getProgram(mtlCuFileName, "disney");
+  Program disneyAnyHit = getProgram(mtlCuFileName, "disneyAnyHit");
+  Program opaqueShadow = getProgram(mtlCuFileName, "opaqueShadow");
   int parameter = 4;
 
   std::mt19937 random(42);
@@ -626,24 +1668,28 @@ void MinimalOptiX::setUpVideo(int nSpheres) {
   std::uniform_real_distribution<float> uniform(0.f, 1.f);
   std::uniform_int_distribution<int> uniform_int(0, 2);
   bool useDisney = false;
+  // radii are capped at 1, so only spheres within 1 of their edge matter,
+  // and the big ones have radius 3
+  DiskHash placed(4.f);
   for (int i = 0; i < 3; ++i) {
     videoParams.spheresParams.push_back({ 3.0f,{ -10.f + 10.f * i, 2.0f, 0.f },{ 0.f, 0.f, 0.f } });
+    placed.insert(videoParams.spheresParams.back().center.x, videoParams.spheresParams.back().center.z, 3.0f);
   }
   for (int i = 0; i < nSpheres; ++i) {
     float x, z, radius;
     do {
       x = uniform(random) * 30.f - 15.f;
       z = uniform(random) * 30.f - 15.f;
-      radius = 1.0f;
-      for (auto& param : videoParams.spheresParams) {
-        radius = std::min(radius, sqrt((x - param.center.x) * (x - param.center.x) + (z - param.center.z) * (z - param.center.z)) - param.radius);
-      }
+      radius = placed.clearance(x, z, 1.0f);
       radius *= 0.8;
     } while (radius < .01f);
     float h = sqrt(x * x + z * z);
     radius = std::min(h + .5f, radius);
     videoParams.spheresParams.push_back({ radius,{ x, h, z },{ 0.f, 0.f, 0.f } });
+    placed.insert(x, z, radius);
   }
+  videoParams.initialSpheresParams = videoParams.spheresParams;
+  temporalHistory.valid = false;
   for (int i = 0; i < 3; ++i) {
     if (useDisney) {
       DisneyParams disneyParams{ RT_TEXTURE_ID_NULL,
@@ -710,34 +1756,31 @@ void MinimalOptiX::setUpVideo(int nSpheres) {
   quadFloor["quadParams"]->setUserData(sizeof(QuadParams), &quadParams);
   Material quadFloorMtl = context->createMaterial();
   quadFloorMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, lambMtl);
+  quadFloorMtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "lambertianPhoton"));
+  quadFloorMtl->setAnyHitProgram(RAY_TYPE_SHADOW, opaqueShadow);
   LambertianParams lambParams{ { 0.7f, 0.9f, 0.9f }};
   quadFloorMtl["lambParams"]->setUserData(sizeof(LambertianParams), &lambParams);
   objs.push_back(context->createGeometryInstance(quadFloor, &quadFloorMtl, &quadFloorMtl + 1));
 
   std::vector<GeometryInstance> lights;
+  std::vector<LightParams> lightsParams;
   for (int i = 0; i < 4; ++i) {
     for (int j = 0; j < 4; ++j) {
-      lights.push_back(buildLight({ -24.f + 10.f * i, 15.f, -24.f + 10.f*j }, { 0.f, 0.f, -8.f }, { 8.f, 0.f, 0.f }, quadIntersect, quadBBox, lightMtl));
+      lights.push_back(buildLight({ -24.f + 10.f * i, 15.f, -24.f + 10.f*j }, { 0.f, 0.f, -8.f }, { 8.f, 0.f, 0.f }, quadIntersect, quadBBox, lightMtl, lightsParams));
     }
   }
   constexpr int nLight = 16;
   constexpr float angle = 3.1415926 * 2 / nLight;
   for (int i = 0; i < nLight; ++i) {
     lights.push_back(buildLight({ 40.f * sin(i * angle), 1.f, 40.f * cos(i * angle) }, { 0.f, 4.f, 0.f },
-      { 10.f * sin(i * angle + angle) - 10.f * sin(i * angle), 0.f, 10.f * cos(i * angle + angle) - 10.f * cos(i * angle) }, quadIntersect, quadBBox, lightMtl));
+      { 10.f * sin(i * angle + angle) - 10.f * sin(i * angle), 0.f, 10.f * cos(i * angle + angle) - 10.f * cos(i * angle) }, quadIntersect, quadBBox, lightMtl, lightsParams));
   }
+  setLights(lightsParams);
 
-
-  Buffer lightBuffer = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
-  lightBuffer->setElementSize(sizeof(LightParams));
-  lightBuffer->setSize(lights.size());
-  LightParams* lightBufData = (LightParams*)lightBuffer->map();
-  for (int i = 0; i < lights.size(); ++i) {
-    memcpy(lightBufData + i, &(lights[i]), sizeof(LightParams));
+  // ids let temporal reuse tell the spheres apart and follow their motion
+  for (size_t i = 0; i < videoParams.spheres.size(); ++i) {
+    videoParams.spheres[i]["objectId"]->setInt(int(i));
   }
-  lightBuffer->unmap();
-  context["lights"]->setBuffer(lightBuffer);
-
   for (auto& obj : videoParams.spheres) objs.push_back(obj);
   for (auto&& obj : lights) objs.push_back(obj);
   GeometryGroup geoGrp = context->createGeometryGroup();
@@ -753,31 +1796,92 @@ void MinimalOptiX::setUpVideo(int nSpheres) {
   optix::float3 up = { 0.f, 1.f, 0.f };
   setCamParams(lookFrom, lookAt, up, 45, (float)fixedWidth / (float)fixedHeight, .2f, 20.f, camParams);
   //setCamParams(lookFrom, lookAt, up, 45, (float)fixedWidth / (float)fixedHeight, 1.0f, length(lookFrom - lookAt), camParams);
-  Program rayGenProgram = context->createProgramFromPTXString(ptxStrs[camCuFileName], "camera");
-  rayGenProgram["camParams"]->setUserData(sizeof(CamParams), &camParams);
-  context->setRayGenerationProgram(0, rayGenProgram);
+  setupCamera(camParams);
 }
 
 void MinimalOptiX::updateVideo() {
-  animate(0.002);
+  animateTo(++videoFrame);
+  context["frameIndex"]->setUint(videoFrame);
   for (size_t i = 0; i < videoParams.spheres.size(); ++i)
     videoParams.spheres[i]["sphereParams"]->setUserData(sizeof(SphereParams), &(videoParams.spheresParams[i]));
   CamParams camParams;
   float3 lookFrom = make_float3(20 * sin(videoParams.angle), min(12.0, videoParams.angle / 10 + 8.0), 20.f * cos(videoParams.angle));
   setCamParams(lookFrom, videoParams.lookAt, videoParams.up, 45, (float)fixedWidth / (float)fixedHeight, .2f, 20.f, camParams);
-  Program rayGenProgram = context->createProgramFromPTXString(ptxStrs[camCuFileName], "camera");
-  rayGenProgram["camParams"]->setUserData(sizeof(CamParams), &camParams);
-  context->setRayGenerationProgram(0, rayGenProgram);
+  context["camParams"]->setUserData(sizeof(CamParams), &camParams);
   //context->validate();
+  if (temporalReuse) {
+    renderTemporalFrame(camParams);
+    return;
+  }
   uint checkpoint = 1;
   for (uint i = 0; i < nSuperSampling; ++i) {
-    context["randSeed"]->setInt(randSeed());
-    context->launch(0, fixedWidth, fixedHeight);
+    context["sampleIndex"]->setUint(i);
+    launchCamera();
   }
   updateContent(nSuperSampling, true);
 }
 
-GeometryInstance MinimalOptiX::buildLight(float3 anchor, float3 v1, float3 v2, Program& quadIntersect, Program& quadBBox, Program& lightMtl) {
+void MinimalOptiX::renderTemporalFrame(const CamParams& camParams) {
+  // history only lines up with the directly preceding frame
+  if (temporalHistory.frame + 1 != videoFrame) {
+    temporalHistory.valid = false;
+  }
+  size_t nPixels = size_t(fixedWidth) * fixedHeight;
+  uint minSamples = temporalHistory.valid ? std::max(1u, nSuperSampling / temporalSampleRatio) : nSuperSampling;
+  std::vector<uint> budget(nPixels, minSamples);
+  Buffer budgetBuffer = context["sampleBudgetBuffer"]->getBuffer();
+  Buffer gBuffer = context["gBuffer"]->getBuffer();
+  auto uploadBudget = [&]() {
+    memcpy(budgetBuffer->map(), budget.data(), sizeof(uint) * nPixels);
+    budgetBuffer->unmap();
+  };
+
+  // a few passes everywhere give the G-buffer, the rest go where history failed
+  uploadBudget();
+  for (uint i = 0; i < minSamples; ++i) {
+    context["sampleIndex"]->setUint(i);
+    launchCamera();
+  }
+  std::vector<float4> reprojected;
+  if (temporalHistory.valid) {
+    reprojectHistory(temporalHistory, (float4*)gBuffer->map(), videoParams.spheresParams, fixedWidth, fixedHeight, reprojected);
+    gBuffer->unmap();
+    for (size_t i = 0; i < nPixels; ++i) {
+      if (reprojected[i].w == 0.f) {
+        budget[i] = nSuperSampling;
+      }
+    }
+    uploadBudget();
+    for (uint i = minSamples; i < nSuperSampling; ++i) {
+      context["sampleIndex"]->setUint(i);
+      launchCamera();
+    }
+  }
+
+  // resolve into accuBuffer as means so updateContent can display them as usual
+  Buffer accuBuffer = context["accuBuffer"]->getBuffer();
+  float* accu = (float*)accuBuffer->map();
+  std::vector<float> sums(accu, accu + 3 * nPixels);
+  resolveTemporal(temporalHistory, reprojected, sums.data(), budget.data(), (float4*)gBuffer->map(),
+    camParams, videoParams.spheresParams, fixedWidth, fixedHeight, float(temporalMaxHistory * nSuperSampling), accu);
+  gBuffer->unmap();
+  accuBuffer->unmap();
+  temporalHistory.frame = videoFrame;
+  const char* aovNames[] = { "albedoAovBuffer", "normalAovBuffer" };
+  for (auto name : aovNames) {
+    Buffer aovBuffer = context[name]->getBuffer();
+    float* aov = (float*)aovBuffer->map();
+    for (size_t i = 0; i < 3 * nPixels; ++i) {
+      aov[i] /= float(budget[i / 3]);
+    }
+    aovBuffer->unmap();
+  }
+  budget.assign(nPixels, ~0u);
+  uploadBudget();
+  updateContent(1.f, true);
+}
+
+GeometryInstance MinimalOptiX::buildLight(float3 anchor, float3 v1, float3 v2, Program& quadIntersect, Program& quadBBox, Program& lightMtl, std::vector<LightParams>& lightsParams) {
   Geometry quadLight = context->createGeometry();
   QuadParams quadParams;
   quadLight->setPrimitiveCount(1u);
@@ -788,8 +1892,9 @@ GeometryInstance MinimalOptiX::buildLight(float3 anchor, float3 v1, float3 v2, P
   Material quadLightMtl = context->createMaterial();
   quadLightMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, lightMtl);
   LightParams lightParams;
-  lightParams.emission = make_float3(1.f);
+  setQuadLightParams(anchor, v1, v2, make_float3(1.f), lightParams);
   quadLightMtl["lightParams"]->setUserData(sizeof(LightParams), &lightParams);
+  lightsParams.push_back(lightParams);
   return context->createGeometryInstance(quadLight, &quadLightMtl, &quadLightMtl + 1);
 }
 
@@ -801,6 +1906,8 @@ GeometryInstance MinimalOptiX::buildBall(SphereParams* sphereParams, LambertianP
   sphere["sphereParams"]->setUserData(sizeof(SphereParams), sphereParams);
   Material sphereMtl = context->createMaterial();
   sphereMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, lambMtl);
+  sphereMtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "lambertianPhoton"));
+  sphereMtl->setAnyHitProgram(RAY_TYPE_SHADOW, getProgram(mtlCuFileName, "opaqueShadow"));
   sphereMtl["lambParams"]->setUserData(sizeof(LambertianParams), lambParams);
   return context->createGeometryInstance(sphere, &sphereMtl, &sphereMtl + 1);
 }
@@ -813,6 +1920,8 @@ GeometryInstance MinimalOptiX::buildBall(SphereParams* sphereParams, MetalParams
   sphere["sphereParams"]->setUserData(sizeof(SphereParams), sphereParams);
   Material sphereMtl = context->createMaterial();
   sphereMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, metalMtl);
+  sphereMtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "metalPhoton"));
+  sphereMtl->setAnyHitProgram(RAY_TYPE_SHADOW, getProgram(mtlCuFileName, "opaqueShadow"));
   sphereMtl["metalParams"]->setUserData(sizeof(MetalParams), metalParams);
   return context->createGeometryInstance(sphere, &sphereMtl, &sphereMtl + 1);
 }
@@ -825,6 +1934,8 @@ GeometryInstance MinimalOptiX::buildBall(SphereParams* sphereParams, GlassParams
   sphere["sphereParams"]->setUserData(sizeof(SphereParams), sphereParams);
   Material sphereMtl = context->createMaterial();
   sphereMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, glassMtl);
+  sphereMtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "glassPhoton"));
+  sphereMtl->setAnyHitProgram(RAY_TYPE_SHADOW, getProgram(mtlCuFileName, "opaqueShadow"));
   sphereMtl["glassParams"]->setUserData(sizeof(GlassParams), glassParams);
   return context->createGeometryInstance(sphere, &sphereMtl, &sphereMtl + 1);
 }
@@ -837,6 +1948,7 @@ GeometryInstance MinimalOptiX::buildBall(SphereParams* sphereParams, DisneyParam
   sphere["sphereParams"]->setUserData(sizeof(SphereParams), sphereParams);
   Material sphereMtl = context->createMaterial();
   sphereMtl->setClosestHitProgram(RAY_TYPE_RADIANCE, disneyMtl);
+  sphereMtl->setClosestHitProgram(RAY_TYPE_PHOTON, getProgram(mtlCuFileName, "disneyPhoton"));
   sphereMtl->setAnyHitProgram(RAY_TYPE_SHADOW, disneyAnyHit);
   sphereMtl["disneyParams"]->setUserData(sizeof(DisneyParams), disneyParams);
   return context->createGeometryInstance(sphere, &sphereMtl, &sphereMtl + 1);
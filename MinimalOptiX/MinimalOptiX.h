@@ -1,6 +1,8 @@
 #pragma once
 
 #include <QtWidgets/QMainWindow>
+#include <QCoreApplication>
+#include <QProcess>
 #include <QKeyEvent>
 #include <QDateTime>
 #include <QString>
@@ -11,17 +13,37 @@
 #include <unordered_map>
 #include <exception>
 #include <map>
+#include <future>
+#include <functional>
 #include "ui_MinimalOptiX.h"
 #include "utils_host.h"
 #include "structures.h"
 #include "scene.h"
+#include "preloader.h"
+#include "image_writer.h"
+#include "denoiser.h"
+#include "temporal.h"
+#include "env_map.h"
+#include "path_guide.h"
+#include "guiding.h"
+#include "photon_map.h"
+#include "benchmark.h"
+#include "heatmap.h"
+#include "trace.h"
+#include "memory_report.h"
+#include "disk_hash.h"
+#include "scene_generator.h"
+#include "math_bench.h"
+#include "cpu_trace.h"
 
 struct VideoParams {
   // static
   std::vector<optix::GeometryInstance> spheres;
+  std::vector<SphereParams> initialSpheresParams;
   // animation
   const float gravity = 4000.f;
   const float attenuationCoef = 0.9f;
+  const float frameTime = 0.002f;
   // dynamic
   float angle{ 0.0 };
   optix::float3 lookAt { 0.f, 0.f, 0.f };
@@ -43,9 +65,10 @@ public:
     SCENE_CORNELL, 
     SCENE_HYPERION, 
     SCENE_DRAGON,
-    SCENE_SPHERES_VIDEO
+    SCENE_SPHERES_VIDEO,
+    SCENE_STRESS // written by --generate-stress
   };
-  enum RayType { RAY_TYPE_RADIANCE, RAY_TYPE_SHADOW };
+  enum RayType { RAY_TYPE_RADIANCE, RAY_TYPE_SHADOW, RAY_TYPE_PHOTON };
 
 	// construction
 	MinimalOptiX(QWidget *parent = Q_NULLPTR);
@@ -53,28 +76,55 @@ public:
 	// utilities
   void compilePtx();
   void setupContext();
+  optix::Program getProgram(const std::string& cuFileName, const std::string& programName);
+  void setupCamera(CamParams& camParams);
+  CamParams presetCamera(const optix::Aabb& bounds) const;
+  void setLights(const std::vector<LightParams>& lightsParams);
+  void launch(uint entryPoint, RTsize width, RTsize height, const char* spanName);
+  void launchCamera();
+  void validateContext();
+  void collectRayStats(double launchSeconds);
+  void collectExceptions(const char* launchName);
+  void trackBuffer(MemoryCategory category, const char* variableName);
+  void setupEnvMap();
+  void uploadGuide(const PathGuide& guide, bool resetAccum);
+  void emitCausticPhotons(float radius);
+  static const char* sceneFolderName(SceneId id);
   void setupScene();
   void setupScene(const char* sceneName);
   void renderScene(bool autoSave = false, std::string fileNamePrefix = "");
+  uint loadAccumulation(const std::string& prefix);
+  void saveAccumulation(const std::string& prefix, uint firstSample, uint samples, bool final);
+  void renderPartial(uint firstSample, uint lastSample, const std::string& prefix);
+  void fanOutRender(uint nWorkers, const std::string& prefix);
 	void updateContent(float nAccumulation, bool clearBuffer);
-  void saveCurrentFrame(bool popUpDialog, std::string fileNamePrefix = "");
+  void saveCurrentFrame(bool popUpDialog, std::string fileNamePrefix = "", ImageWriter::Compression compression = ImageWriter::COMPRESSION_DEFAULT);
   void imageDemo();
   void videoDemo();
+  void lightSamplingReport(uint nSamples);
+  void runBenchmark(const std::string& fileName);
+  void renderReference();
+  void runQualityBenchmark(const std::string& fileName, double maxSeconds);
+  void runCpuTrace(const std::string& fileName);
 
 	// components
 	QGraphicsScene qgscene;
 	QImage canvas;
+  ScenePreloader preloader;
+  ImageWriter imageWriter;
   optix::Context context;
   optix::Aabb aabb;
   std::map<std::string, std::string> ptxStrs;
+  std::map<std::string, optix::Program> programs; // "file:name" -> program, one per context
   std::string baseSceneFolder = "scenes/";
   std::string camCuFileName = "camera.cu";
   std::string exCuFileName = "exception.cu";
   std::string mtlCuFileName = "material.cu";
   std::string msCuFileName = "miss.cu";
   std::string geoCuFileName = "geometry.cu";
+  std::string phCuFileName = "photon.cu";
   std::vector<std::string> cuFiles = {
-    camCuFileName, exCuFileName, mtlCuFileName, msCuFileName, geoCuFileName
+    camCuFileName, exCuFileName, mtlCuFileName, msCuFileName, geoCuFileName, phCuFileName
   };
   
   // attributes
@@ -87,22 +137,67 @@ public:
   size_t nFaces = 0;
   float rayMinIntensity = 0.001f;
   float rayEpsilonT = 0.001f;
+  bool mergeMeshes = false; // one geometry + BVH for all static meshes
+  bool resume = false; // continue autosave renders from <prefix>.accu.*
+  bool denoise = false; // filter the displayed image with the first-hit AOVs
+  DenoiserSettings denoiserSettings;
+  bool temporalReuse = false; // reproject the previous video frame instead of starting over
+  uint temporalSampleRatio = 8u; // passes for pixels with valid history: nSuperSampling / ratio
+  uint temporalMaxHistory = 4u; // history weight cap, in units of nSuperSampling
+  TemporalHistory temporalHistory;
+  std::string envMapFile; // .hdr or .pfm lighting every scene, empty for the scenes' backgrounds
+  float envMapScale = 1.f;
+  std::shared_ptr<EnvMap> envMap;
+  bool pathGuiding = false; // learn per-cell directional histograms during renderScene()
+  int guideResolution = 16; // grid cells per axis
+  uint guideTrainingPasses = 64u;
+  float guideFraction = 0.5f; // share of indirect samples drawn from trained cells
+  bool caustics = false; // gather light over specular chains from a photon map traced every pass
+  uint nPhotons = 1u << 18; // photons emitted per pass
+  float causticRadiusScale = 0.0025f; // initial gather radius relative to the scene diagonal
+  PhotonMap photonMap;
+  bool restir = false; // resample first-hit light samples across pixels and passes
+  int restirCandidates = 8; // fresh light candidates per pixel and pass
+  float restirMaxMFactor = 20.f; // history weight cap, in units of restirCandidates
+  bool rayStatsEnabled = false; // compile the programs with -DRAY_STATS and count rays per launch
+  RayStats rayStats;
+  double cameraLaunchSeconds = 0.0;
+  bool checkExceptions = false; // enable every OptiX exception, not only stack overflow
+  ExceptionStats exceptionStats;
+  MemoryReport memory;
+  // called with the sample count before the first pass of renderScene() and
+  // after every pass, returning false ends the render there
+  std::function<bool(uint)> passObserver;
+  std::string referenceFolder = "references/";
+  uint sceneLaunches = 0u; // launches of any entry point since setupScene(), the first one builds the acceleration structures
+  bool heatmap = false; // compile with -DCOST_HEATMAP and show per-pixel cost instead of radiance
+  CostChannel heatmapChannel = COST_BOUNCES;
+  std::vector<float> costImage; // per-path cost of the last updateContent(), saved as <name>.cost.pfm
+  uint checkpointInterval = 64u;
+  uint videoFrame = 0u;
+  uint videoWorkers = 1u;
+  int deviceOrdinal = -1; // -1 lets OptiX use every device
+  bool headless = false; // command line job finished, no window needed
+  std::future<void> checkpointWrite;
 
 
   VideoParams videoParams;
   // user interface
   void keyPressEvent(QKeyEvent* e);
   void record(int frames, const char* filename, bool saveFrames);
+  void renderVideoFrames(uint firstFrame, uint nFrames, uint stride);
+  void recordParallel(int frames, const char* filename, uint nWorkers);
 
 private:
 	Ui::MinimalOptiXClass ui;
 
-  void animate(float time);
+  void animateTo(uint frame);
   void move(SphereParams& param, float time);
   void setUpVideo(int nSpheres);
   void updateVideo();
+  void renderTemporalFrame(const CamParams& camParams);
 
-  optix::GeometryInstance buildLight(optix::float3 anchor, optix::float3 v1, optix::float3 v2, optix::Program& quadIntersect, optix::Program& quadBBox, optix::Program& lightMtl);
+  optix::GeometryInstance buildLight(optix::float3 anchor, optix::float3 v1, optix::float3 v2, optix::Program& quadIntersect, optix::Program& quadBBox, optix::Program& lightMtl, std::vector<LightParams>& lightsParams);
   optix::GeometryInstance buildBall(SphereParams* sphereParams, LambertianParams* lambParams, optix::Program& sphereIntersect, optix::Program& sphereBBox, optix::Program& lambMtl);
   optix::GeometryInstance buildBall(SphereParams* sphereParams, MetalParams* metalParams, optix::Program& sphereIntersect, optix::Program& sphereBBox, optix::Program& metalMtl);
   optix::GeometryInstance buildBall(SphereParams* sphereParams, GlassParams* glassParams, optix::Program& sphereIntersect, optix::Program& sphereBBox, optix::Program& glassMtl);
@@ -7,6 +7,35 @@ struct Payload {
   int depth;
   int randSeed;
   optix::float3 attenuation; // only used for shadow
+  float bsdfPdf; // solid angle pdf of the BSDF sample that spawned the ray, 0 if specular
+  int causticState; // CausticState of the path so far
+};
+
+// Where a camera path is relative to the photon map. Light reaching the
+// first diffuse vertex over a specular chain (L S+ D) is gathered from
+// photons, so the camera path must not count it again through emission or
+// next-event estimation.
+enum CausticState {
+  CAUSTIC_BEFORE_DIFFUSE, // only specular vertices so far
+  CAUSTIC_AFTER_DIFFUSE, // just left the first diffuse vertex
+  CAUSTIC_SPECULAR_CHAIN, // specular vertices since the first diffuse one
+  CAUSTIC_IGNORED // a later diffuse vertex, photons are not used any more
+};
+
+struct PhotonPayload {
+  optix::float3 power;
+  int depth;
+  int randSeed;
+  int slot; // photonBuffer entry of this photon
+  int specularBounces;
+};
+
+// power 0 marks a slot whose photon never reached a diffuse surface over
+// a specular chain
+struct PhotonRecord {
+  optix::float3 position;
+  optix::float3 direction;
+  optix::float3 power;
 };
 
 struct CamParams {
@@ -65,6 +94,28 @@ struct DisneyParams {
   BrdfType brdfType;
 };
 
+// uniform grid over the scene bounds holding one directional histogram per
+// cell for path guiding, see guiding.h
+struct GuideParams {
+  optix::float3 origin;
+  optix::float3 invCellSize;
+  int resolution;
+  int enabled;
+  int training;
+};
+
+// Weighted reservoir of light samples for spatiotemporal resampling, see
+// restir.h. M == 0 marks an empty reservoir.
+struct Reservoir {
+  optix::float3 lightPoint; // selected sample, a point on light lightIdx
+  int lightIdx;
+  float wSum; // sum of resampling weights seen
+  float M; // number of candidates seen
+  float W; // unbiased contribution weight of lightPoint
+  optix::float3 hitPoint; // surface the reservoir was built for
+  optix::float3 hitNormal;
+};
+
 enum LightShape { SPHERE, QUAD };
 
 struct LightParams {
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include "benchmark.h"
+
+void RayStats::accumulate(const unsigned int* stripes) {
+  for (int s = 0; s < RAY_STATS_STRIPES; ++s) {
+    for (int c = 0; c < RAY_STAT_COUNT; ++c) {
+      counters[c] += stripes[s * RAY_STAT_COUNT + c];
+    }
+  }
+}
+
+QJsonObject RayStats::toJson() const {
+  struct Named {
+    const char* name;
+    RayStatCounter counter;
+  };
+  const Named rays[] = {
+    { "radiance", RAY_STAT_RADIANCE_RAYS },
+    { "shadow", RAY_STAT_SHADOW_RAYS },
+    { "photon", RAY_STAT_PHOTON_RAYS }
+  };
+  const Named ends[] = {
+    { "maxDepth", RAY_STAT_END_MAX_DEPTH },
+    { "minIntensity", RAY_STAT_END_MIN_INTENSITY },
+    { "miss", RAY_STAT_END_MISS },
+    { "light", RAY_STAT_END_LIGHT },
+    { "absorbed", RAY_STAT_END_ABSORBED }
+  };
+
+  // counts go out as doubles, JSON numbers are not safe beyond 2^53 anyway
+  QJsonObject rayCounts, raysPerSecond, pathEnds;
+  uint64_t totalRays = 0;
+  for (auto& ray : rays) {
+    rayCounts[ray.name] = double(counters[ray.counter]);
+    raysPerSecond[ray.name] = launchSeconds > 0.0 ? counters[ray.counter] / launchSeconds : 0.0;
+    totalRays += counters[ray.counter];
+  }
+  raysPerSecond["total"] = launchSeconds > 0.0 ? totalRays / launchSeconds : 0.0;
+  for (auto& end : ends) {
+    pathEnds[end.name] = double(counters[end.counter]);
+  }
+  QJsonArray depthHistogram;
+  for (int i = 0; i < RAY_STATS_DEPTH_BINS; ++i) {
+    depthHistogram.append(double(counters[RAY_STAT_DEPTH_HISTOGRAM + i]));
+  }
+
+  QJsonObject json;
+  json["launchSeconds"] = launchSeconds;
+  json["rays"] = rayCounts;
+  json["raysPerSecond"] = raysPerSecond;
+  json["paths"] = double(counters[RAY_STAT_PATHS]);
+  json["pathEnds"] = pathEnds;
+  // bin i counts paths that ended at depth i, the last bin everything deeper
+  json["depthHistogram"] = depthHistogram;
+  return json;
+}
+
+std::string ExceptionStats::collect(const char* launchName, unsigned int count, const ExceptionRecord* records) {
+  ++launches;
+  if (count == 0) {
+    return std::string();
+  }
+  ++failedLaunches;
+  total += count;
+  unsigned int nRecords = std::min<unsigned int>(count, EXCEPTION_LOG_CAPACITY);
+  std::map<int, unsigned int> launchCodes;
+  for (unsigned int i = 0; i < nRecords; ++i) {
+    ++launchCodes[records[i].code];
+    ++byCode[records[i].code];
+  }
+
+  std::ostringstream summary;
+  summary << launchName << " launch " << launches << ": " << count << " exceptions (";
+  for (auto it = launchCodes.begin(); it != launchCodes.end(); ++it) {
+    summary << (it == launchCodes.begin() ? "" : ", ") << it->second << " " << exceptionName(it->first);
+  }
+  if (count > nRecords) {
+    summary << ", " << count - nRecords << " not logged";
+  }
+  summary << "), first at " << records[0].launchIndex.x << "," << records[0].launchIndex.y;
+  return summary.str();
+}
+
+QJsonObject ExceptionStats::toJson() const {
+  QJsonObject codes;
+  for (auto& code : byCode) {
+    codes[QString::fromStdString(exceptionName(code.first))] = double(code.second);
+  }
+  QJsonObject json;
+  json["launches"] = double(launches);
+  json["failedLaunches"] = double(failedLaunches);
+  json["total"] = double(total);
+  json["byCode"] = codes;
+  return json;
+}
+
+ImageError imageError(const float* accu, float scale, const float* reference, size_t nValues) {
+  double squared = 0.0;
+  double relative = 0.0;
+  #pragma omp parallel for reduction(+:squared, relative)
+  for (int i = 0; i < int(nValues); ++i) {
+    double ref = reference[i];
+    double diff = accu[i] * scale - ref;
+    squared += diff * diff;
+    relative += diff * diff / (ref * ref + 0.01);
+  }
+  ImageError error;
+  error.rmse = nValues > 0 ? std::sqrt(squared / nValues) : 0.0;
+  error.relMse = nValues > 0 ? relative / nValues : 0.0;
+  return error;
+}
+
+std::string exceptionName(int code) {
+  switch (code) {
+  case RT_EXCEPTION_PROGRAM_ID_INVALID:
+    return "invalid program id";
+  case RT_EXCEPTION_TEXTURE_ID_INVALID:
+    return "invalid texture id";
+  case RT_EXCEPTION_BUFFER_ID_INVALID:
+    return "invalid buffer id";
+  case RT_EXCEPTION_INDEX_OUT_OF_BOUNDS:
+    return "index out of bounds";
+  case RT_EXCEPTION_STACK_OVERFLOW:
+    return "stack overflow";
+  case RT_EXCEPTION_BUFFER_INDEX_OUT_OF_BOUNDS:
+    return "buffer index out of bounds";
+  case RT_EXCEPTION_INVALID_RAY:
+    return "invalid ray";
+  case RT_EXCEPTION_INTERNAL_ERROR:
+    return "internal error";
+  }
+  return code >= RT_EXCEPTION_USER ? "user " + std::to_string(code - RT_EXCEPTION_USER) : "code " + std::to_string(code);
+}
+
+void writeJson(const std::string& fileName, const QJsonObject& object) {
+  QSaveFile file(QString::fromStdString(fileName));
+  if (!file.open(QIODevice::WriteOnly)) {
+    throw std::runtime_error("Cannot open " + fileName + " for writing.");
+  }
+  file.write(QJsonDocument(object).toJson(QJsonDocument::Indented));
+  if (!file.commit()) {
+    throw std::runtime_error("Cannot write " + fileName + ".");
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <QJsonObject>
+#include "ray_stats.h"
+#include "exception_log.h"
+
+// Ray counters of --ray-stats summed over every launch of a render.
+struct RayStats {
+  std::vector<uint64_t> counters = std::vector<uint64_t>(RAY_STAT_COUNT, 0);
+  double launchSeconds = 0.0; // time spent in the launches that were counted
+
+  // adds one launch's striped device counters, RAY_STATS_STRIPES * RAY_STAT_COUNT values
+  void accumulate(const unsigned int* stripes);
+  // totals, rays per second by type, path ends and the depth histogram
+  QJsonObject toJson() const;
+};
+
+// Exceptions of every launch since the last reset, see exception_log.h.
+struct ExceptionStats {
+  uint64_t launches = 0;
+  uint64_t failedLaunches = 0; // launches with at least one exception
+  uint64_t total = 0;
+  std::map<int, uint64_t> byCode; // from the logged records only
+
+  // Adds one launch's counter and log. Returns a one line summary of it,
+  // or an empty string when the launch raised nothing.
+  std::string collect(const char* launchName, unsigned int count, const ExceptionRecord* records);
+  QJsonObject toJson() const;
+};
+
+// Error of a progressive render against a converged reference, over all
+// channels. relMse divides each squared error by reference^2 + 0.01 so dark
+// and bright regions weigh alike.
+struct ImageError {
+  double rmse;
+  double relMse;
+};
+
+// accu holds sums that scale turns into means, both images nValues floats
+ImageError imageError(const float* accu, float scale, const float* reference, size_t nValues);
+
+// RT_EXCEPTION_STACK_OVERFLOW as "stack overflow" and so on
+std::string exceptionName(int code);
+
+// Writes the object as indented JSON, atomically replacing fileName.
+void writeJson(const std::string& fileName, const QJsonObject& object);
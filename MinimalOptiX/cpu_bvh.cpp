@@ -0,0 +1,671 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include "cpu_bvh.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CPU_BVH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC emits any intrinsic without /arch, GCC and Clang need the target on
+// each function that uses them
+#if defined(CPU_BVH_X86) && !defined(_MSC_VER)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+// AVX-512 brings FMA, which GCC would otherwise fuse into the products
+#define TARGET_AVX512 __attribute__((target("avx2,avx512f"), optimize("fp-contract=off")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+using namespace optix;
+
+namespace {
+
+const int kBins = 16;
+// a block costs about as much as a single triangle, so the SAH counts blocks
+const float kTraversalCost = 1.f;
+const float kBlockCost = 1.f;
+const int kMaxLeafTriangles = CPU_BVH_BLOCK_WIDTH * CPU_BVH_MAX_LEAF_BLOCKS;
+// deeper than this the builder splits at the median, which bounds the
+// traversal stack
+const int kMaxSahDepth = 64;
+const int kStackSize = 128;
+
+struct Bounds {
+  float3 lo = make_float3(FLT_MAX);
+  float3 hi = make_float3(-FLT_MAX);
+
+  void include(const float3& p) {
+    lo = fminf(lo, p);
+    hi = fmaxf(hi, p);
+  }
+  void include(const Bounds& b) {
+    lo = fminf(lo, b.lo);
+    hi = fmaxf(hi, b.hi);
+  }
+  float area() const {
+    float3 d = hi - lo;
+    return d.x < 0.f ? 0.f : 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+};
+
+float axis(const float3& v, int a) {
+  return a == 0 ? v.x : a == 1 ? v.y : v.z;
+}
+
+int blockCount(int nTriangles) {
+  return (nTriangles + CPU_BVH_BLOCK_WIDTH - 1) / CPU_BVH_BLOCK_WIDTH;
+}
+
+struct BuildTriangle {
+  Bounds bounds;
+  float3 centroid;
+  int primIdx;
+};
+
+class Builder {
+public:
+  Builder(CpuBvh& bvh, const std::vector<float3>& vertices, const std::vector<int>& indices)
+    : bvh(bvh), vertices(vertices), indices(indices) {}
+
+  void build() {
+    int nPrims = int(indices.size() / 3);
+    for (int i = 0; i < nPrims; ++i) {
+      float3 p0 = vertices[indices[3 * i]];
+      float3 p1 = vertices[indices[3 * i + 1]];
+      float3 p2 = vertices[indices[3 * i + 2]];
+      float area = length(cross(p1 - p0, p2 - p0));
+      if (!(area > 0.f) || std::isinf(area)) {
+        continue;
+      }
+      BuildTriangle tri;
+      tri.bounds.include(p0);
+      tri.bounds.include(p1);
+      tri.bounds.include(p2);
+      tri.centroid = (tri.bounds.lo + tri.bounds.hi) * 0.5f;
+      tri.primIdx = i;
+      triangles.push_back(tri);
+    }
+    bvh.nTriangles = int(triangles.size());
+    bvh.nodes.resize(1);
+    buildNode(0, 0, int(triangles.size()), 0);
+  }
+
+private:
+  void buildNode(int nodeIdx, int begin, int end, int depth) {
+    Bounds bounds, centroids;
+    for (int i = begin; i < end; ++i) {
+      bounds.include(triangles[i].bounds);
+      centroids.include(triangles[i].centroid);
+    }
+    bvh.nodes[nodeIdx].lo = bounds.lo;
+    bvh.nodes[nodeIdx].hi = bounds.hi;
+    int count = end - begin;
+    if (count <= CPU_BVH_BLOCK_WIDTH) {
+      makeLeaf(nodeIdx, begin, end);
+      return;
+    }
+
+    // binned SAH over the centroids
+    int bestAxis = -1;
+    int bestSplit = 0;
+    float bestCost = FLT_MAX;
+    for (int a = 0; a < 3 && depth < kMaxSahDepth; ++a) {
+      float lo = axis(centroids.lo, a);
+      float extent = axis(centroids.hi, a) - lo;
+      if (!(extent > 0.f)) {
+        continue;
+      }
+      Bounds binBounds[kBins];
+      int binCounts[kBins] = {};
+      float scale = kBins / extent;
+      for (int i = begin; i < end; ++i) {
+        int b = std::min(int((axis(triangles[i].centroid, a) - lo) * scale), kBins - 1);
+        binBounds[b].include(triangles[i].bounds);
+        ++binCounts[b];
+      }
+      // right to left sweep first, then evaluate every plane left to right
+      float rightArea[kBins];
+      int rightCount[kBins];
+      Bounds right;
+      int n = 0;
+      for (int b = kBins - 1; b > 0; --b) {
+        right.include(binBounds[b]);
+        n += binCounts[b];
+        rightArea[b] = right.area();
+        rightCount[b] = n;
+      }
+      Bounds left;
+      n = 0;
+      for (int b = 1; b < kBins; ++b) {
+        left.include(binBounds[b - 1]);
+        n += binCounts[b - 1];
+        if (n == 0 || rightCount[b] == 0) {
+          continue;
+        }
+        float cost = left.area() * blockCount(n) + rightArea[b] * blockCount(rightCount[b]);
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = a;
+          bestSplit = b;
+        }
+      }
+    }
+
+    int mid;
+    if (bestAxis >= 0) {
+      float splitCost = kTraversalCost + kBlockCost * bestCost / bounds.area();
+      if (splitCost >= kBlockCost * blockCount(count) && count <= kMaxLeafTriangles) {
+        makeLeaf(nodeIdx, begin, end);
+        return;
+      }
+      float lo = axis(centroids.lo, bestAxis);
+      float scale = kBins / (axis(centroids.hi, bestAxis) - lo);
+      mid = int(std::partition(triangles.begin() + begin, triangles.begin() + end, [&](const BuildTriangle& tri) {
+        return std::min(int((axis(tri.centroid, bestAxis) - lo) * scale), kBins - 1) < bestSplit;
+      }) - triangles.begin());
+    } else if (count <= kMaxLeafTriangles) {
+      makeLeaf(nodeIdx, begin, end);
+      return;
+    } else {
+      // identical centroids or too deep, halve along the widest axis
+      float3 extent = bounds.hi - bounds.lo;
+      int a = extent.x > extent.y && extent.x > extent.z ? 0 : extent.y > extent.z ? 1 : 2;
+      mid = (begin + end) / 2;
+      std::nth_element(triangles.begin() + begin, triangles.begin() + mid, triangles.begin() + end, [a](const BuildTriangle& l, const BuildTriangle& r) {
+        return axis(l.centroid, a) < axis(r.centroid, a);
+      });
+    }
+
+    int left = int(bvh.nodes.size());
+    bvh.nodes.resize(left + 2);
+    bvh.nodes[nodeIdx].index = left;
+    bvh.nodes[nodeIdx].blocks = 0;
+    buildNode(left, begin, mid, depth + 1);
+    buildNode(left + 1, mid, end, depth + 1);
+  }
+
+  void makeLeaf(int nodeIdx, int begin, int end) {
+    int first = int(bvh.blocks.size());
+    int nBlocks = std::max(blockCount(end - begin), 1);
+    bvh.nodes[nodeIdx].index = first;
+    bvh.nodes[nodeIdx].blocks = nBlocks;
+    bvh.blocks.resize(first + nBlocks);
+    for (int b = 0; b < nBlocks; ++b) {
+      TriangleBlock& block = bvh.blocks[first + b];
+      memset(&block, 0, sizeof(block));
+      for (int k = 0; k < CPU_BVH_BLOCK_WIDTH; ++k) {
+        int i = begin + b * CPU_BVH_BLOCK_WIDTH + k;
+        if (i >= end) {
+          block.primIdx[k] = -1;
+          continue;
+        }
+        int primIdx = triangles[i].primIdx;
+        float3 p0 = vertices[indices[3 * primIdx]];
+        float3 p1 = vertices[indices[3 * primIdx + 1]];
+        float3 p2 = vertices[indices[3 * primIdx + 2]];
+        // the same expressions as intersect_triangle
+        float3 e0 = p1 - p0;
+        float3 e1 = p0 - p2;
+        float3 n = cross(e1, e0);
+        const float3 values[4] = { p0, e0, e1, n };
+        float (*targets[4])[CPU_BVH_BLOCK_WIDTH] = { block.p0, block.e0, block.e1, block.n };
+        for (int v = 0; v < 4; ++v) {
+          targets[v][0][k] = values[v].x;
+          targets[v][1][k] = values[v].y;
+          targets[v][2][k] = values[v].z;
+        }
+        block.primIdx[k] = primIdx;
+      }
+    }
+  }
+
+  CpuBvh& bvh;
+  const std::vector<float3>& vertices;
+  const std::vector<int>& indices;
+  std::vector<BuildTriangle> triangles;
+};
+
+struct RayData {
+  float3 origin;
+  float3 direction;
+  float3 invDir;
+  float tmin;
+};
+
+// closest hit so far, t doubles as the ray's tmax
+struct HitState {
+  float t;
+  float beta;
+  float gamma;
+  const TriangleBlock* block;
+  int lane;
+};
+
+typedef void (*BlockTest)(const TriangleBlock* blocks, int nBlocks, const RayData& ray, HitState& hit);
+
+int firstBit(unsigned int bits) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return int(index);
+#else
+  return __builtin_ctz(bits);
+#endif
+}
+
+// intersect_triangle lane by lane, lanes with the same t keep the first
+void testBlocksScalar(const TriangleBlock* blocks, int nBlocks, const RayData& ray, HitState& hit) {
+  for (int b = 0; b < nBlocks; ++b) {
+    const TriangleBlock& block = blocks[b];
+    for (int k = 0; k < CPU_BVH_BLOCK_WIDTH; ++k) {
+      float3 p0 = make_float3(block.p0[0][k], block.p0[1][k], block.p0[2][k]);
+      float3 e0 = make_float3(block.e0[0][k], block.e0[1][k], block.e0[2][k]);
+      float3 e1 = make_float3(block.e1[0][k], block.e1[1][k], block.e1[2][k]);
+      float3 n = make_float3(block.n[0][k], block.n[1][k], block.n[2][k]);
+      float3 e2 = (1.0f / dot(n, ray.direction)) * (p0 - ray.origin);
+      float3 i = cross(ray.direction, e2);
+      float beta = dot(i, e1);
+      float gamma = dot(i, e0);
+      float t = dot(n, e2);
+      if (t < hit.t && t > ray.tmin && beta >= 0.f && gamma >= 0.f && beta + gamma <= 1.f) {
+        hit = { t, beta, gamma, &block, k };
+      }
+    }
+  }
+}
+
+#ifdef CPU_BVH_X86
+
+TARGET_AVX2 inline __m256 dot8(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz) {
+  return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+}
+
+TARGET_AVX2 void testBlocksAvx2(const TriangleBlock* blocks, int nBlocks, const RayData& ray, HitState& hit) {
+  const __m256 ox = _mm256_set1_ps(ray.origin.x);
+  const __m256 oy = _mm256_set1_ps(ray.origin.y);
+  const __m256 oz = _mm256_set1_ps(ray.origin.z);
+  const __m256 dx = _mm256_set1_ps(ray.direction.x);
+  const __m256 dy = _mm256_set1_ps(ray.direction.y);
+  const __m256 dz = _mm256_set1_ps(ray.direction.z);
+  const __m256 tmin = _mm256_set1_ps(ray.tmin);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.f);
+  const __m256 inf = _mm256_set1_ps(INFINITY);
+  for (int b = 0; b < nBlocks; ++b) {
+    const TriangleBlock& block = blocks[b];
+    __m256 nx = _mm256_loadu_ps(block.n[0]);
+    __m256 ny = _mm256_loadu_ps(block.n[1]);
+    __m256 nz = _mm256_loadu_ps(block.n[2]);
+    __m256 scale = _mm256_div_ps(one, dot8(nx, ny, nz, dx, dy, dz));
+    __m256 e2x = _mm256_mul_ps(scale, _mm256_sub_ps(_mm256_loadu_ps(block.p0[0]), ox));
+    __m256 e2y = _mm256_mul_ps(scale, _mm256_sub_ps(_mm256_loadu_ps(block.p0[1]), oy));
+    __m256 e2z = _mm256_mul_ps(scale, _mm256_sub_ps(_mm256_loadu_ps(block.p0[2]), oz));
+    __m256 ix = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 iy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 iz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    __m256 beta = dot8(ix, iy, iz, _mm256_loadu_ps(block.e1[0]), _mm256_loadu_ps(block.e1[1]), _mm256_loadu_ps(block.e1[2]));
+    __m256 gamma = dot8(ix, iy, iz, _mm256_loadu_ps(block.e0[0]), _mm256_loadu_ps(block.e0[1]), _mm256_loadu_ps(block.e0[2]));
+    __m256 t = dot8(nx, ny, nz, e2x, e2y, e2z);
+    __m256 mask = _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(hit.t), _CMP_LT_OQ), _mm256_cmp_ps(t, tmin, _CMP_GT_OQ));
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(beta, zero, _CMP_GE_OQ), _mm256_cmp_ps(gamma, zero, _CMP_GE_OQ)));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(beta, gamma), one, _CMP_LE_OQ));
+    unsigned int bits = unsigned(_mm256_movemask_ps(mask));
+    if (!bits) {
+      continue;
+    }
+    __m256 tHit = _mm256_blendv_ps(inf, t, mask);
+    __m256 m = _mm256_min_ps(tHit, _mm256_permute_ps(tHit, _MM_SHUFFLE(2, 3, 0, 1)));
+    m = _mm256_min_ps(m, _mm256_permute_ps(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm256_min_ps(m, _mm256_permute2f128_ps(m, m, 1));
+    int lane = firstBit(unsigned(_mm256_movemask_ps(_mm256_cmp_ps(tHit, m, _CMP_EQ_OQ))) & bits);
+    float ts[CPU_BVH_BLOCK_WIDTH], betas[CPU_BVH_BLOCK_WIDTH], gammas[CPU_BVH_BLOCK_WIDTH];
+    _mm256_storeu_ps(ts, t);
+    _mm256_storeu_ps(betas, beta);
+    _mm256_storeu_ps(gammas, gamma);
+    hit = { ts[lane], betas[lane], gammas[lane], &block, lane };
+  }
+}
+
+// the matching halves of two blocks as one register
+TARGET_AVX512 inline __m512 load16(const float* lo, const float* hi) {
+  __m512d wide = _mm512_castpd256_pd512(_mm256_castps_pd(_mm256_loadu_ps(lo)));
+  return _mm512_castpd_ps(_mm512_insertf64x4(wide, _mm256_castps_pd(_mm256_loadu_ps(hi)), 1));
+}
+
+TARGET_AVX512 inline __m512 dot16(__m512 ax, __m512 ay, __m512 az, __m512 bx, __m512 by, __m512 bz) {
+  return _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ax, bx), _mm512_mul_ps(ay, by)), _mm512_mul_ps(az, bz));
+}
+
+TARGET_AVX512 void testBlocksAvx512(const TriangleBlock* blocks, int nBlocks, const RayData& ray, HitState& hit) {
+  if (nBlocks != 2) {
+    testBlocksAvx2(blocks, nBlocks, ray, hit);
+    return;
+  }
+  const TriangleBlock& b0 = blocks[0];
+  const TriangleBlock& b1 = blocks[1];
+  const __m512 dx = _mm512_set1_ps(ray.direction.x);
+  const __m512 dy = _mm512_set1_ps(ray.direction.y);
+  const __m512 dz = _mm512_set1_ps(ray.direction.z);
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512 one = _mm512_set1_ps(1.f);
+  __m512 nx = load16(b0.n[0], b1.n[0]);
+  __m512 ny = load16(b0.n[1], b1.n[1]);
+  __m512 nz = load16(b0.n[2], b1.n[2]);
+  __m512 scale = _mm512_div_ps(one, dot16(nx, ny, nz, dx, dy, dz));
+  __m512 e2x = _mm512_mul_ps(scale, _mm512_sub_ps(load16(b0.p0[0], b1.p0[0]), _mm512_set1_ps(ray.origin.x)));
+  __m512 e2y = _mm512_mul_ps(scale, _mm512_sub_ps(load16(b0.p0[1], b1.p0[1]), _mm512_set1_ps(ray.origin.y)));
+  __m512 e2z = _mm512_mul_ps(scale, _mm512_sub_ps(load16(b0.p0[2], b1.p0[2]), _mm512_set1_ps(ray.origin.z)));
+  __m512 ix = _mm512_sub_ps(_mm512_mul_ps(dy, e2z), _mm512_mul_ps(dz, e2y));
+  __m512 iy = _mm512_sub_ps(_mm512_mul_ps(dz, e2x), _mm512_mul_ps(dx, e2z));
+  __m512 iz = _mm512_sub_ps(_mm512_mul_ps(dx, e2y), _mm512_mul_ps(dy, e2x));
+  __m512 beta = dot16(ix, iy, iz, load16(b0.e1[0], b1.e1[0]), load16(b0.e1[1], b1.e1[1]), load16(b0.e1[2], b1.e1[2]));
+  __m512 gamma = dot16(ix, iy, iz, load16(b0.e0[0], b1.e0[0]), load16(b0.e0[1], b1.e0[1]), load16(b0.e0[2], b1.e0[2]));
+  __m512 t = dot16(nx, ny, nz, e2x, e2y, e2z);
+  __mmask16 mask = _mm512_cmp_ps_mask(t, _mm512_set1_ps(hit.t), _CMP_LT_OQ);
+  mask = _mm512_mask_cmp_ps_mask(mask, t, _mm512_set1_ps(ray.tmin), _CMP_GT_OQ);
+  mask = _mm512_mask_cmp_ps_mask(mask, beta, zero, _CMP_GE_OQ);
+  mask = _mm512_mask_cmp_ps_mask(mask, gamma, zero, _CMP_GE_OQ);
+  mask = _mm512_mask_cmp_ps_mask(mask, _mm512_add_ps(beta, gamma), one, _CMP_LE_OQ);
+  if (!mask) {
+    return;
+  }
+  __m512 tHit = _mm512_mask_blend_ps(mask, _mm512_set1_ps(INFINITY), t);
+  float best = _mm512_reduce_min_ps(tHit);
+  int lane = firstBit(unsigned(_mm512_mask_cmp_ps_mask(mask, tHit, _mm512_set1_ps(best), _CMP_EQ_OQ)));
+  float ts[2 * CPU_BVH_BLOCK_WIDTH], betas[2 * CPU_BVH_BLOCK_WIDTH], gammas[2 * CPU_BVH_BLOCK_WIDTH];
+  _mm512_storeu_ps(ts, t);
+  _mm512_storeu_ps(betas, beta);
+  _mm512_storeu_ps(gammas, gamma);
+  hit = { ts[lane], betas[lane], gammas[lane], &blocks[lane / CPU_BVH_BLOCK_WIDTH], lane % CPU_BVH_BLOCK_WIDTH };
+}
+
+#endif
+
+// plain compares, fminf and fmaxf are library calls on some compilers
+inline float minf(float a, float b) {
+  return a < b ? a : b;
+}
+
+inline float maxf(float a, float b) {
+  return a > b ? a : b;
+}
+
+// 1 / d with zero components nudged away from zero, so the slab test never
+// multiplies 0 by infinity
+inline float safeInverse(float d) {
+  return 1.f / (fabsf(d) > 1e-30f ? d : copysignf(1e-30f, d));
+}
+
+// slab test, tfar is widened by a few ulps so triangles lying in a face of
+// the box are not culled by rounding
+inline bool intersectBox(const CpuBvhNode& node, const RayData& ray, float tmax, float& tnear) {
+  float tx0 = (node.lo.x - ray.origin.x) * ray.invDir.x;
+  float tx1 = (node.hi.x - ray.origin.x) * ray.invDir.x;
+  float ty0 = (node.lo.y - ray.origin.y) * ray.invDir.y;
+  float ty1 = (node.hi.y - ray.origin.y) * ray.invDir.y;
+  float tz0 = (node.lo.z - ray.origin.z) * ray.invDir.z;
+  float tz1 = (node.hi.z - ray.origin.z) * ray.invDir.z;
+  tnear = maxf(maxf(minf(tx0, tx1), minf(ty0, ty1)), maxf(minf(tz0, tz1), ray.tmin));
+  float tfar = minf(minf(maxf(tx0, tx1), maxf(ty0, ty1)), maxf(tz0, tz1)) * 1.0000004f;
+  return tnear <= minf(tfar, tmax);
+}
+
+void finishHit(const CpuRay& r, const HitState& hit, CpuHit& out) {
+  if (!hit.block) {
+    out.t = r.tmax;
+    out.primIdx = -1;
+    return;
+  }
+  out.t = hit.t;
+  out.beta = hit.beta;
+  out.gamma = hit.gamma;
+  out.primIdx = hit.block->primIdx[hit.lane];
+  out.normal = make_float3(hit.block->n[0][hit.lane], hit.block->n[1][hit.lane], hit.block->n[2][hit.lane]);
+}
+
+template<BlockTest Test>
+bool traverse(const CpuBvh& bvh, const CpuRay& r, CpuHit& out) {
+  RayData ray = { r.origin, r.direction, make_float3(safeInverse(r.direction.x), safeInverse(r.direction.y), safeInverse(r.direction.z)), r.tmin };
+  HitState hit = { r.tmax, 0.f, 0.f, nullptr, 0 };
+  int stack[kStackSize];
+  float stackT[kStackSize];
+  int top = 0;
+  float tnear;
+  int nodeIdx = 0;
+  bool visit = !bvh.nodes.empty() && intersectBox(bvh.nodes[0], ray, hit.t, tnear);
+  while (visit) {
+    const CpuBvhNode& node = bvh.nodes[nodeIdx];
+    if (node.blocks) {
+      Test(&bvh.blocks[node.index], node.blocks, ray, hit);
+    } else {
+      // nearer child first, the other one waits on the stack
+      float tLeft, tRight;
+      bool left = intersectBox(bvh.nodes[node.index], ray, hit.t, tLeft);
+      bool right = intersectBox(bvh.nodes[node.index + 1], ray, hit.t, tRight);
+      if (left && right) {
+        bool leftFirst = tLeft <= tRight;
+        stack[top] = leftFirst ? node.index + 1 : node.index;
+        stackT[top++] = leftFirst ? tRight : tLeft;
+        nodeIdx = leftFirst ? node.index : node.index + 1;
+        continue;
+      }
+      if (left || right) {
+        nodeIdx = left ? node.index : node.index + 1;
+        continue;
+      }
+    }
+    // skip entries the closest hit has moved in front of
+    visit = false;
+    while (top > 0 && !visit) {
+      --top;
+      nodeIdx = stack[top];
+      visit = stackT[top] <= hit.t;
+    }
+  }
+
+  finishHit(r, hit, out);
+  return hit.block != nullptr;
+}
+
+// false when the box is outside one of the planes, or farther from the apex
+// than maxDistance
+inline bool overlapsFrustum(const CpuBvhNode& node, const CpuFrustum& frustum, float maxDistance) {
+  for (int i = 0; i < 4; ++i) {
+    // the corner farthest along the plane normal
+    const float3& n = frustum.normals[i];
+    float3 p = make_float3(n.x > 0.f ? node.hi.x : node.lo.x, n.y > 0.f ? node.hi.y : node.lo.y, n.z > 0.f ? node.hi.z : node.lo.z);
+    if (dot(n, p - frustum.origin) < 0.f) {
+      return false;
+    }
+  }
+  float3 nearest = fmaxf(node.lo, fminf(frustum.origin, node.hi));
+  return length(nearest - frustum.origin) <= maxDistance;
+}
+
+template<BlockTest Test>
+void traversePacket(const CpuBvh& bvh, const CpuRay* rays, CpuHit* out, int nRays, const CpuFrustum& frustum) {
+  RayData ray[CPU_PACKET_MAX_RAYS];
+  HitState hit[CPU_PACKET_MAX_RAYS];
+  // closest hits as distances from the apex, for culling far nodes
+  float maxDistance = 0.f;
+  for (int i = 0; i < nRays; ++i) {
+    const CpuRay& r = rays[i];
+    ray[i] = { r.origin, r.direction, make_float3(safeInverse(r.direction.x), safeInverse(r.direction.y), safeInverse(r.direction.z)), r.tmin };
+    hit[i] = { r.tmax, 0.f, 0.f, nullptr, 0 };
+    maxDistance = maxf(maxDistance, r.tmax * length(r.direction));
+  }
+
+  // each entry keeps the first ray that can still enter the node
+  int stack[kStackSize + 1];
+  int stackFirst[kStackSize + 1];
+  int top = 0;
+  if (!bvh.nodes.empty()) {
+    stack[0] = 0;
+    stackFirst[0] = 0;
+    top = 1;
+  }
+  while (top > 0) {
+    --top;
+    const CpuBvhNode& node = bvh.nodes[stack[top]];
+    int first = stackFirst[top];
+    if (!overlapsFrustum(node, frustum, maxDistance)) {
+      continue;
+    }
+    float tnear;
+    while (first < nRays && !intersectBox(node, ray[first], hit[first].t, tnear)) {
+      ++first;
+    }
+    if (first == nRays) {
+      continue;
+    }
+
+    if (node.blocks) {
+      const TriangleBlock* blocks = &bvh.blocks[node.index];
+      Test(blocks, node.blocks, ray[first], hit[first]);
+      for (int i = first + 1; i < nRays; ++i) {
+        if (intersectBox(node, ray[i], hit[i].t, tnear)) {
+          Test(blocks, node.blocks, ray[i], hit[i]);
+        }
+      }
+      maxDistance = 0.f;
+      for (int i = 0; i < nRays; ++i) {
+        maxDistance = maxf(maxDistance, hit[i].t * length(rays[i].direction));
+      }
+      continue;
+    }
+    // both children go on the stack, the one nearer to the first ray on top
+    float tLeft, tRight;
+    bool left = intersectBox(bvh.nodes[node.index], ray[first], hit[first].t, tLeft);
+    bool right = intersectBox(bvh.nodes[node.index + 1], ray[first], hit[first].t, tRight);
+    bool leftFirst = left && (!right || tLeft <= tRight);
+    stack[top] = leftFirst ? node.index + 1 : node.index;
+    stackFirst[top++] = first;
+    stack[top] = leftFirst ? node.index : node.index + 1;
+    stackFirst[top++] = first;
+  }
+
+  for (int i = 0; i < nRays; ++i) {
+    finishHit(rays[i], hit[i], out[i]);
+  }
+}
+
+typedef bool (*Traversal)(const CpuBvh& bvh, const CpuRay& ray, CpuHit& hit);
+typedef void (*PacketTraversal)(const CpuBvh& bvh, const CpuRay* rays, CpuHit* hits, int nRays, const CpuFrustum& frustum);
+
+Traversal traversalFor(CpuKernel kernel) {
+#ifdef CPU_BVH_X86
+  if (kernel == CPU_KERNEL_AVX512) {
+    return traverse<testBlocksAvx512>;
+  }
+  if (kernel == CPU_KERNEL_AVX2) {
+    return traverse<testBlocksAvx2>;
+  }
+#endif
+  return traverse<testBlocksScalar>;
+}
+
+PacketTraversal packetTraversalFor(CpuKernel kernel) {
+#ifdef CPU_BVH_X86
+  if (kernel == CPU_KERNEL_AVX512) {
+    return traversePacket<testBlocksAvx512>;
+  }
+  if (kernel == CPU_KERNEL_AVX2) {
+    return traversePacket<testBlocksAvx2>;
+  }
+#endif
+  return traversePacket<testBlocksScalar>;
+}
+
+}
+
+CpuKernel detectCpuKernel() {
+#if defined(CPU_BVH_X86) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return CPU_KERNEL_SCALAR;
+  }
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (!osxsave) {
+    return CPU_KERNEL_SCALAR;
+  }
+  // the OS must save the YMM and, for AVX-512, the ZMM and mask state
+  unsigned long long xcr0 = _xgetbv(0);
+  __cpuidex(info, 7, 0);
+  if ((info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6) {
+    return CPU_KERNEL_AVX512;
+  }
+  if ((info[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6) {
+    return CPU_KERNEL_AVX2;
+  }
+  return CPU_KERNEL_SCALAR;
+#elif defined(CPU_BVH_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return CPU_KERNEL_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return CPU_KERNEL_AVX2;
+  }
+  return CPU_KERNEL_SCALAR;
+#else
+  return CPU_KERNEL_SCALAR;
+#endif
+}
+
+const char* cpuKernelName(CpuKernel kernel) {
+  switch (kernel) {
+  case CPU_KERNEL_SCALAR: return "scalar";
+  case CPU_KERNEL_AVX2: return "avx2";
+  case CPU_KERNEL_AVX512: return "avx512";
+  default: return "";
+  }
+}
+
+CpuFrustum makeFrustum(const float3& origin, const float3 corners[4]) {
+  CpuFrustum frustum;
+  frustum.origin = origin;
+  float3 center = corners[0] + corners[1] + corners[2] + corners[3];
+  for (int i = 0; i < 4; ++i) {
+    float3 n = cross(corners[i], corners[(i + 1) % 4]);
+    frustum.normals[i] = dot(n, center) < 0.f ? -n : n;
+  }
+  return frustum;
+}
+
+CpuBvh::CpuBvh(const std::vector<float3>& vertices, const std::vector<int>& indices) {
+  Builder(*this, vertices, indices).build();
+}
+
+bool CpuBvh::intersect(const CpuRay& ray, CpuHit& hit, CpuKernel kernel) const {
+  return traversalFor(kernel)(*this, ray, hit);
+}
+
+void CpuBvh::intersect(const CpuRay* rays, CpuHit* hits, int nRays, CpuKernel kernel) const {
+  Traversal trace = traversalFor(kernel);
+  #pragma omp parallel for schedule(dynamic, 256)
+  for (int i = 0; i < nRays; ++i) {
+    trace(*this, rays[i], hits[i]);
+  }
+}
+
+void CpuBvh::intersectPacket(const CpuRay* rays, CpuHit* hits, int nRays, const CpuFrustum& frustum, CpuKernel kernel) const {
+  // larger sets are traced in packets of CPU_PACKET_MAX_RAYS, all of them
+  // still inside the frustum
+  PacketTraversal traversal = packetTraversalFor(kernel);
+  for (int first = 0; first < nRays; first += CPU_PACKET_MAX_RAYS) {
+    traversal(*this, rays + first, hits + first, std::min(nRays - first, CPU_PACKET_MAX_RAYS), frustum);
+  }
+}
+
+size_t CpuBvh::bytes() const {
+  return sizeof(CpuBvhNode) * nodes.size() + sizeof(TriangleBlock) * blocks.size();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include <optix_world.h>
+
+// Triangle BVH for tracing on the CPU. Leaves hold up to two blocks of
+// CPU_BVH_BLOCK_WIDTH triangles in SoA layout, with the edges and normal
+// that intersect_triangle derives precomputed, so a leaf is tested without
+// touching the index buffers. Hits are computed with the same operations as
+// intersect_triangle in meshIntersect, so t, barycentrics and primitive
+// index agree with it up to the device's fused multiply-adds.
+
+#define CPU_BVH_BLOCK_WIDTH 8
+#define CPU_BVH_MAX_LEAF_BLOCKS 2
+#define CPU_PACKET_MAX_RAYS 64
+
+// Instruction sets the block test can run with, detectCpuKernel() picks the
+// widest one the CPU and OS support.
+enum CpuKernel {
+  CPU_KERNEL_SCALAR,
+  CPU_KERNEL_AVX2, // one block per instruction
+  CPU_KERNEL_AVX512, // both blocks of a leaf at once
+  CPU_KERNEL_COUNT
+};
+
+CpuKernel detectCpuKernel();
+const char* cpuKernelName(CpuKernel kernel);
+
+struct CpuRay {
+  optix::float3 origin;
+  optix::float3 direction;
+  float tmin;
+  float tmax;
+};
+
+struct CpuHit {
+  float t;
+  float beta; // weight of the second vertex, as in meshIntersect
+  float gamma; // weight of the third vertex
+  int primIdx; // index into the triangles the BVH was built from, -1 on a miss
+  optix::float3 normal; // unnormalized geometric normal
+};
+
+// Pyramid with its apex at origin, a point p is inside when
+// dot(normals[i], p - origin) >= 0 for all four planes.
+struct CpuFrustum {
+  optix::float3 origin;
+  optix::float3 normals[4];
+};
+
+// the frustum through four corner directions given in order around it
+CpuFrustum makeFrustum(const optix::float3& origin, const optix::float3 corners[4]);
+
+struct CpuBvhNode {
+  optix::float3 lo;
+  optix::float3 hi;
+  int index; // first block of a leaf, or the first of the two adjacent children
+  int blocks; // 0 for inner nodes
+};
+
+// Triangles p1 - p0 and p0 - p2 and their cross product, lanes past the
+// leaf's triangles have primIdx -1 and zero edges, which never hit.
+struct TriangleBlock {
+  float p0[3][CPU_BVH_BLOCK_WIDTH];
+  float e0[3][CPU_BVH_BLOCK_WIDTH];
+  float e1[3][CPU_BVH_BLOCK_WIDTH];
+  float n[3][CPU_BVH_BLOCK_WIDTH];
+  int primIdx[CPU_BVH_BLOCK_WIDTH];
+};
+
+class CpuBvh {
+public:
+  // indices holds three vertex indices per triangle, like vertIdxBuffer.
+  // Degenerate triangles are left out, as meshBBox does.
+  CpuBvh(const std::vector<optix::float3>& vertices, const std::vector<int>& indices);
+
+  // closest hit in (tmin, tmax), false on a miss
+  bool intersect(const CpuRay& ray, CpuHit& hit, CpuKernel kernel) const;
+  // the same for many rays, in parallel
+  void intersect(const CpuRay* rays, CpuHit* hits, int nRays, CpuKernel kernel) const;
+  // Rays that leave frustum.origin inside the frustum, traversed together
+  // CPU_PACKET_MAX_RAYS at a time: nodes outside the frustum or beyond every
+  // ray's closest hit are culled once for the whole packet, and rays before
+  // the first one entering a node are skipped below it. Finds the same hits
+  // as tracing the rays one by one, except that triangles at exactly the
+  // same t may be resolved differently since they are visited in another
+  // order.
+  void intersectPacket(const CpuRay* rays, CpuHit* hits, int nRays, const CpuFrustum& frustum, CpuKernel kernel) const;
+  size_t bytes() const;
+
+  std::vector<CpuBvhNode> nodes; // nodes[0] is the root
+  std::vector<TriangleBlock> blocks;
+  int nTriangles;
+};
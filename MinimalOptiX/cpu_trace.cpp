@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <QJsonArray>
+#include <QJsonObject>
+#include "cpu_trace.h"
+#include "benchmark.h"
+#include "utils_device.h"
+
+namespace {
+
+const int kRepeats = 3;
+const int kPacketTile = 8;
+static_assert(kPacketTile * kPacketTile <= CPU_PACKET_MAX_RAYS, "a tile must fit in one packet");
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The frustum of every ray camera() can send through pixels [x0, x1) x
+// [y0, y1), the jitter moves a ray up to half a pixel off the center. A
+// hundredth of a pixel more keeps rounding in normalize() from putting a
+// ray outside.
+CpuFrustum tileFrustum(const CamParams& camParams, int x0, int y0, int x1, int y1, int width, int height) {
+  const float margin = 0.51f;
+  float u0 = (x0 - margin) / width;
+  float u1 = (x1 - 1 + margin) / width;
+  float v0 = (y0 - margin) / height;
+  float v1 = (y1 - 1 + margin) / height;
+  const float2 screen[4] = { make_float2(u0, v0), make_float2(u1, v0), make_float2(u1, v1), make_float2(u0, v1) };
+  float3 corners[4];
+  for (int i = 0; i < 4; ++i) {
+    corners[i] = camParams.scrLowerLeftCorner + screen[i].x * camParams.horizontal + screen[i].y * camParams.vertical - camParams.origin;
+  }
+  return makeFrustum(camParams.origin, corners);
+}
+
+}
+
+void sceneTriangles(const SceneAssets& assets, std::vector<float3>& vertices, std::vector<int>& indices) {
+  vertices.clear();
+  indices.clear();
+  for (auto& mesh : assets.meshes) {
+    int vertexOffset = int(vertices.size());
+    for (size_t v = 0; v + 2 < mesh.attrib.vertices.size(); v += 3) {
+      vertices.push_back(make_float3(mesh.attrib.vertices[v], mesh.attrib.vertices[v + 1], mesh.attrib.vertices[v + 2]));
+    }
+    for (auto& shape : mesh.shapes) {
+      for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); ++f) {
+        for (int fv = 0; fv < 3; ++fv) {
+          indices.push_back(shape.mesh.indices[f * 3 + fv].vertex_index + vertexOffset);
+        }
+      }
+    }
+  }
+}
+
+void cameraRays(const CamParams& camParams, int width, int height, float tmin, std::vector<CpuRay>& rays) {
+  rays.resize(size_t(width) * height);
+  #pragma omp parallel for
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      int seed = tea<16>(y * width + x, tea<4>(0u, 0u));
+      float3 randInLens = camParams.lensRadius * randInUnitDisk(seed);
+      float3 offset = camParams.u * randInLens.x + camParams.v * randInLens.y;
+      float jitterX = rand(seed);
+      float jitterY = rand(seed);
+      float u = (x + jitterX - 0.5f) / width;
+      float v = (y + jitterY - 0.5f) / height;
+      CpuRay& ray = rays[size_t(y) * width + x];
+      ray.origin = camParams.origin + offset;
+      ray.direction = normalize(camParams.scrLowerLeftCorner + u * camParams.horizontal + v * camParams.vertical - camParams.origin - offset);
+      ray.tmin = tmin;
+      ray.tmax = RT_DEFAULT_MAX;
+    }
+  }
+}
+
+void runCpuTraceBenchmark(const std::string& sceneName, const std::vector<float3>& vertices, const std::vector<int>& indices, const CamParams& camParams, int width, int height, float tmin, const std::string& fileName) {
+  auto start = std::chrono::steady_clock::now();
+  CpuBvh bvh(vertices, indices);
+  double buildSeconds = secondsSince(start);
+  printf("%s: %d triangles, BVH of %zu nodes and %zu blocks (%.1f MB) built in %.2f s\n",
+    sceneName.c_str(), bvh.nTriangles, bvh.nodes.size(), bvh.blocks.size(), bvh.bytes() / 1048576.0, buildSeconds);
+
+  std::vector<CpuRay> rays;
+  cameraRays(camParams, width, height, tmin, rays);
+  int nRays = int(rays.size());
+  std::vector<CpuHit> reference(nRays), hits(nRays);
+  int nHits = 0;
+
+  QJsonArray kernels;
+  CpuKernel best = detectCpuKernel();
+  for (int k = CPU_KERNEL_SCALAR; k <= best; ++k) {
+    CpuKernel kernel = CpuKernel(k);
+    std::vector<CpuHit>& out = kernel == CPU_KERNEL_SCALAR ? reference : hits;
+    double seconds = 1e30;
+    for (int r = 0; r < kRepeats; ++r) {
+      start = std::chrono::steady_clock::now();
+      bvh.intersect(rays.data(), out.data(), nRays, kernel);
+      seconds = std::min(seconds, secondsSince(start));
+    }
+
+    // the scalar kernel is intersect_triangle lane by lane, the others must
+    // find the same triangles
+    int mismatches = 0;
+    double maxTError = 0.0;
+    double maxBarycentricError = 0.0;
+    for (int i = 0; i < nRays && kernel != CPU_KERNEL_SCALAR; ++i) {
+      if (out[i].primIdx != reference[i].primIdx) {
+        ++mismatches;
+      } else if (out[i].primIdx >= 0) {
+        maxTError = std::max(maxTError, fabs(double(out[i].t) - reference[i].t) / reference[i].t);
+        maxBarycentricError = std::max(maxBarycentricError, double(std::max(fabsf(out[i].beta - reference[i].beta), fabsf(out[i].gamma - reference[i].gamma))));
+      }
+    }
+    if (kernel == CPU_KERNEL_SCALAR) {
+      nHits = int(std::count_if(reference.begin(), reference.end(), [](const CpuHit& hit) { return hit.primIdx >= 0; }));
+    }
+    printf("  %-8s %8.2f Mrays/s  %6d differing hits  max relative t error %.3g  max barycentric error %.3g\n",
+      cpuKernelName(kernel), nRays / seconds * 1e-6, mismatches, maxTError, maxBarycentricError);
+
+    QJsonObject json;
+    json["kernel"] = cpuKernelName(kernel);
+    json["seconds"] = seconds;
+    json["raysPerSecond"] = nRays / seconds;
+    json["differingHits"] = mismatches;
+    json["maxRelativeTError"] = maxTError;
+    json["maxBarycentricError"] = maxBarycentricError;
+    kernels.append(json);
+  }
+
+  // kPacketTile^2 pixels per packet with the widest kernel, which needs
+  // every ray to leave the same point
+  QJsonObject packets;
+  if (camParams.lensRadius == 0.f) {
+    const std::vector<CpuHit>& single = best == CPU_KERNEL_SCALAR ? reference : hits;
+    std::vector<CpuHit> packetHits(nRays);
+    int tilesX = (width + kPacketTile - 1) / kPacketTile;
+    int nTiles = tilesX * ((height + kPacketTile - 1) / kPacketTile);
+    double seconds = 1e30;
+    for (int r = 0; r < kRepeats; ++r) {
+      start = std::chrono::steady_clock::now();
+      #pragma omp parallel for schedule(dynamic, 4)
+      for (int tile = 0; tile < nTiles; ++tile) {
+        int x0 = tile % tilesX * kPacketTile;
+        int y0 = tile / tilesX * kPacketTile;
+        int x1 = std::min(x0 + kPacketTile, width);
+        int y1 = std::min(y0 + kPacketTile, height);
+        CpuRay tileRays[CPU_PACKET_MAX_RAYS];
+        CpuHit tileHits[CPU_PACKET_MAX_RAYS];
+        int n = 0;
+        for (int y = y0; y < y1; ++y) {
+          for (int x = x0; x < x1; ++x) {
+            tileRays[n++] = rays[size_t(y) * width + x];
+          }
+        }
+        bvh.intersectPacket(tileRays, tileHits, n, tileFrustum(camParams, x0, y0, x1, y1, width, height), best);
+        n = 0;
+        for (int y = y0; y < y1; ++y) {
+          for (int x = x0; x < x1; ++x) {
+            packetHits[size_t(y) * width + x] = tileHits[n++];
+          }
+        }
+      }
+      seconds = std::min(seconds, secondsSince(start));
+    }
+    // triangles are tested in another order, so only exact ties may differ
+    int mismatches = 0;
+    for (int i = 0; i < nRays; ++i) {
+      if (packetHits[i].primIdx != single[i].primIdx || (single[i].primIdx >= 0 && packetHits[i].t != single[i].t)) {
+        ++mismatches;
+      }
+    }
+    QJsonObject singleJson = kernels.last().toObject();
+    double speedup = singleJson["seconds"].toDouble() / seconds;
+    printf("  %-8s %8.2f Mrays/s  %6d differing hits  %dx%d packets, %.2fx single rays\n",
+      cpuKernelName(best), nRays / seconds * 1e-6, mismatches, kPacketTile, kPacketTile, speedup);
+    packets["kernel"] = cpuKernelName(best);
+    packets["tile"] = kPacketTile;
+    packets["seconds"] = seconds;
+    packets["raysPerSecond"] = nRays / seconds;
+    packets["speedup"] = speedup;
+    packets["differingHits"] = mismatches;
+  } else {
+    printf("  packets skipped, the camera has a lens radius of %g\n", camParams.lensRadius);
+  }
+
+  if (fileName.empty()) {
+    return;
+  }
+  QJsonObject json;
+  json["scene"] = QString::fromStdString(sceneName);
+  json["triangles"] = bvh.nTriangles;
+  json["buildSeconds"] = buildSeconds;
+  json["nodes"] = double(bvh.nodes.size());
+  json["blocks"] = double(bvh.blocks.size());
+  json["bvhBytes"] = double(bvh.bytes());
+  json["rays"] = nRays;
+  json["hits"] = nHits;
+  json["selectedKernel"] = cpuKernelName(best);
+  json["kernels"] = kernels;
+  json["packets"] = packets;
+  writeJson(fileName, json);
+}
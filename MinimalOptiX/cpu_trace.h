@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "structures.h"
+#include "scene.h"
+#include "cpu_bvh.h"
+
+// Every triangle of the scene's meshes in the order merged meshes upload
+// them, so primitive indices match mergedMeshIntersect's.
+void sceneTriangles(const SceneAssets& assets, std::vector<optix::float3>& vertices, std::vector<int>& indices);
+
+// The rays camera() traces for sample 0 of frame 0, row by row.
+void cameraRays(const CamParams& camParams, int width, int height, float tmin, std::vector<CpuRay>& rays);
+
+// Builds a CpuBvh over the triangles from sceneTriangles() and traces the camera rays with every
+// kernel the CPU supports, then with the widest one in 8x8 pixel packets
+// when the camera has no lens. Prints rays per second and how far the hits
+// are from the scalar ones, and writes the same to fileName as JSON unless
+// that is empty.
+void runCpuTraceBenchmark(const std::string& sceneName, const std::vector<optix::float3>& vertices, const std::vector<int>& indices, const CamParams& camParams, int width, int height, float tmin, const std::string& fileName);
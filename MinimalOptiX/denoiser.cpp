@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cmath>
+#include "denoiser.h"
+
+namespace {
+
+// planar storage keeps the inner x loops contiguous for the vectorizer
+struct Planes {
+  Planes(int size) : c{ std::vector<float>(size), std::vector<float>(size), std::vector<float>(size) } {}
+  std::vector<float> c[3];
+};
+
+const float kEpsilon = 1e-3f;
+const float kKernel[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+void atrousPass(
+  const Planes& in, const Planes& albedo, const Planes& normal,
+  int width, int height, int step, float sigmaColor, const DenoiserSettings& settings, Planes& out
+) {
+  float invColor = 1.f / (sigmaColor * sigmaColor);
+  float invNormal = 1.f / (settings.sigmaNormal * settings.sigmaNormal);
+  float invAlbedo = 1.f / (settings.sigmaAlbedo * settings.sigmaAlbedo);
+
+  #pragma omp parallel for schedule(dynamic, 8)
+  for (int y = 0; y < height; ++y) {
+    std::vector<float> sum[3] = { std::vector<float>(width, 0.f), std::vector<float>(width, 0.f), std::vector<float>(width, 0.f) };
+    std::vector<float> weightSum(width, 0.f);
+    const int row = y * width;
+    for (int dy = -2; dy <= 2; ++dy) {
+      const int srcRow = std::min(std::max(y + dy * step, 0), height - 1) * width;
+      for (int dx = -2; dx <= 2; ++dx) {
+        const float h = kKernel[dy + 2] * kKernel[dx + 2];
+        for (int x = 0; x < width; ++x) {
+          const int p = row + x;
+          const int q = srcRow + std::min(std::max(x + dx * step, 0), width - 1);
+          float dc = 0.f;
+          float dn = 0.f;
+          float da = 0.f;
+          for (int k = 0; k < 3; ++k) {
+            float c = in.c[k][p] - in.c[k][q];
+            float n = normal.c[k][p] - normal.c[k][q];
+            float a = albedo.c[k][p] - albedo.c[k][q];
+            dc += c * c;
+            dn += n * n;
+            da += a * a;
+          }
+          const float w = h * std::exp(-dc * invColor - dn * invNormal - da * invAlbedo);
+          sum[0][x] += w * in.c[0][q];
+          sum[1][x] += w * in.c[1][q];
+          sum[2][x] += w * in.c[2][q];
+          weightSum[x] += w;
+        }
+      }
+    }
+    for (int x = 0; x < width; ++x) {
+      const float inv = 1.f / weightSum[x];
+      out.c[0][row + x] = sum[0][x] * inv;
+      out.c[1][row + x] = sum[1][x] * inv;
+      out.c[2][row + x] = sum[2][x] * inv;
+    }
+  }
+}
+
+}
+
+void denoise(
+  const float* color, const float* albedo, const float* normal,
+  int width, int height, const DenoiserSettings& settings, float* output
+) {
+  const int size = width * height;
+  Planes illum(size), albedoPlanes(size), normalPlanes(size), tmp(size);
+
+  #pragma omp parallel for
+  for (int p = 0; p < size; ++p) {
+    for (int k = 0; k < 3; ++k) {
+      albedoPlanes.c[k][p] = albedo[3 * p + k];
+      normalPlanes.c[k][p] = normal[3 * p + k];
+      illum.c[k][p] = color[3 * p + k] / (albedo[3 * p + k] + kEpsilon);
+    }
+  }
+
+  // the color edge-stopping term tightens as the kernel widens
+  float sigmaColor = settings.sigmaColor;
+  for (int i = 0; i < settings.iterations; ++i) {
+    atrousPass(illum, albedoPlanes, normalPlanes, width, height, 1 << i, sigmaColor, settings, tmp);
+    std::swap(illum, tmp);
+    sigmaColor *= 0.5f;
+  }
+
+  #pragma omp parallel for
+  for (int p = 0; p < size; ++p) {
+    for (int k = 0; k < 3; ++k) {
+      output[3 * p + k] = illum.c[k][p] * (albedo[3 * p + k] + kEpsilon);
+    }
+  }
+}
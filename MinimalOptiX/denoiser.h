@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+
+struct DenoiserSettings {
+  int iterations = 5;
+  float sigmaColor = 0.6f;
+  float sigmaNormal = 0.1f;
+  float sigmaAlbedo = 0.1f;
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the
+// first-hit albedo and normal. All buffers are interleaved float3 means in
+// accuBuffer layout. Illumination is filtered with the albedo divided out,
+// so texture detail survives the blur.
+void denoise(
+  const float* color, const float* albedo, const float* normal,
+  int width, int height, const DenoiserSettings& settings, float* output
+);
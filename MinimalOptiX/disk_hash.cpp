@@ -0,0 +1,38 @@
+#include <algorithm>
+#include <cmath>
+#include "disk_hash.h"
+
+DiskHash::DiskHash(float cellSize) : cellSize(cellSize) {}
+
+int64_t DiskHash::cellKey(int cx, int cz) const {
+  return (int64_t(cx) << 32) ^ int64_t(uint32_t(cz));
+}
+
+int DiskHash::cellCoord(float v) const {
+  return int(std::floor(v / cellSize));
+}
+
+void DiskHash::insert(float x, float z, float radius) {
+  cells[cellKey(cellCoord(x), cellCoord(z))].push_back(int(disks.size()));
+  disks.push_back({ x, z, radius });
+}
+
+float DiskHash::clearance(float x, float z, float maxDistance) const {
+  float best = maxDistance;
+  int cx = cellCoord(x);
+  int cz = cellCoord(z);
+  for (int dz = -1; dz <= 1; ++dz) {
+    for (int dx = -1; dx <= 1; ++dx) {
+      auto cell = cells.find(cellKey(cx + dx, cz + dz));
+      if (cell == cells.end()) {
+        continue;
+      }
+      for (int i : cell->second) {
+        const Disk& disk = disks[i];
+        float d = std::sqrt((x - disk.x) * (x - disk.x) + (z - disk.z) * (z - disk.z)) - disk.radius;
+        best = std::min(best, d);
+      }
+    }
+  }
+  return best;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Disks in the xz plane hashed into a uniform grid, so placing n objects
+// without overlap costs O(n) instead of testing every earlier one. A query
+// only visits the 3x3 cells around the point, which covers every disk that
+// matters as long as cellSize >= maxDistance + the largest radius.
+class DiskHash {
+public:
+  DiskHash(float cellSize);
+  void insert(float x, float z, float radius);
+  // distance from (x, z) to the nearest disk edge, negative inside a disk,
+  // and maxDistance when no edge is closer
+  float clearance(float x, float z, float maxDistance) const;
+  size_t size() const { return disks.size(); }
+
+private:
+  struct Disk {
+    float x, z, radius;
+  };
+
+  int64_t cellKey(int cx, int cz) const;
+  int cellCoord(float v) const;
+
+  float cellSize;
+  std::vector<Disk> disks;
+  std::unordered_map<int64_t, std::vector<int>> cells;
+};
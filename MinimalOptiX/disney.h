@@ -6,7 +6,7 @@
 
 using namespace optix;
 
-__device__ __inline__ void disneySample(int& randSeed, DisneyParams& disneyParams, float3& N, float3& L, float3& V, float3& H) {
+RT_HOSTDEVICE inline void disneySample(int& randSeed, DisneyParams& disneyParams, float3& N, float3& L, float3& V, float3& H) {
   float diffuseRatio = 0.5f * (1.0f - disneyParams.metallic);
   Onb onb(N);
   if (rand(randSeed) < diffuseRatio) { // diffuse
@@ -15,7 +15,7 @@ __device__ __inline__ void disneySample(int& randSeed, DisneyParams& disneyParam
     L = normalize(L);
     H = normalize(L + V);
   } else { // specular
-    float a = max(0.001f, disneyParams.roughness);
+    float a = fmaxf(0.001f, disneyParams.roughness);
     float phi = rand(randSeed) * 2.0f * M_PIf;
     float random = rand(randSeed);
     float cosTheta = sqrtf((1.f - random) / (1.0f + (a * a - 1.f) * random));
@@ -29,23 +29,23 @@ __device__ __inline__ void disneySample(int& randSeed, DisneyParams& disneyParam
   }
 }
 
-__device__ __inline__ float disneyPdf(DisneyParams& disneyParams, float3& N, float3& L, float3& V, float3& H) {
+RT_HOSTDEVICE inline float disneyPdf(DisneyParams& disneyParams, float3& N, float3& L, float3& V, float3& H) {
   float diffuseRatio = 0.5f * (1.0f - disneyParams.metallic);
-  float specularAlpha = max(0.001f, disneyParams.roughness);
+  float specularAlpha = fmaxf(0.001f, disneyParams.roughness);
   float clearcoatAlpha = lerp(0.1f, 0.001f, disneyParams.clearcoatGloss);
   float specularRatio = 1.f - diffuseRatio;
-  float cosTheta = abs(dot(N, H));
+  float cosTheta = fabsf(dot(N, H));
   float pdfGTR1 = GTR1(cosTheta, clearcoatAlpha) * cosTheta;
   float pdfGTR2 = GTR2(cosTheta, specularAlpha) * cosTheta;
   float ratio = 1.0f / (1.0f + disneyParams.clearcoat);
   float pdfH = lerp(pdfGTR1, pdfGTR2, ratio);
-  float pdfL =  pdfH / (4.0 * abs(dot(L, H)));
-  float pdfDiff = abs(dot(N, L)) / M_PIf;
+  float pdfL =  pdfH / (4.0f * fabsf(dot(L, H)));
+  float pdfDiff = fabsf(dot(N, L)) / M_PIf;
   float pdf = diffuseRatio * pdfDiff + specularRatio * pdfL;
   return pdf;
 }
 
-__device__ __inline__ float3 disneyEval(DisneyParams& disneyParams, float3& baseColor, float3& N, float3& L, float3& V, float3& H) {
+RT_HOSTDEVICE inline float3 disneyEval(DisneyParams& disneyParams, float3& baseColor, float3& N, float3& L, float3& V, float3& H) {
   Onb onb(N);
   float NdotL = dot(N, L);
   float NdotV = dot(N, V);
@@ -70,9 +70,9 @@ __device__ __inline__ float3 disneyEval(DisneyParams& disneyParams, float3& base
   float Fss = lerp(1.0f, Fss90, FL) * lerp(1.0f, Fss90, FV);
   float ss = 1.25f * (Fss * (1.f / (NdotL + NdotV) - 0.5f) + 0.5f);
 
-  float aspect = sqrt(1 - disneyParams.anisotropic * 0.9f);
-  float ax = max(.001f, square(disneyParams.roughness) / aspect);
-  float ay = max(.001f, square(disneyParams.roughness) * aspect);
+  float aspect = sqrtf(1 - disneyParams.anisotropic * 0.9f);
+  float ax = fmaxf(.001f, square(disneyParams.roughness) / aspect);
+  float ay = fmaxf(.001f, square(disneyParams.roughness) * aspect);
   float3 X = normalize(onb.m_tangent);
   float3 Y = normalize(cross(N, X));
   float Ds = GTR2Aniso(NdotH, dot(H, X), dot(H, Y), ax, ay);
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <QFileInfo>
+#include <QSaveFile>
+#include "env_map.h"
+#include "utils_host.h"
+
+namespace {
+
+const char kCdfMagic[8] = { 'E', 'N', 'V', 'C', 'D', 'F', '1', '\n' };
+
+// Radiance RGBE, flat or run-length encoded scanlines, top row first
+void readHdr(const std::string& fileName, std::vector<float>& rgb, int& width, int& height) {
+  std::ifstream file(fileName, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Cannot open " + fileName + ".");
+  }
+  std::string line;
+  std::getline(file, line);
+  if (line.compare(0, 2, "#?") != 0) {
+    throw std::runtime_error(fileName + " is not a Radiance HDR file.");
+  }
+  while (std::getline(file, line) && !line.empty()) {
+    if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe") {
+      throw std::runtime_error(fileName + " is not RGBE.");
+    }
+  }
+  std::getline(file, line);
+  char yAxis[3], xAxis[3];
+  if (sscanf(line.c_str(), "%2s %d %2s %d", yAxis, &height, xAxis, &width) != 4 ||
+      strcmp(yAxis, "-Y") != 0 || strcmp(xAxis, "+X") != 0) {
+    throw std::runtime_error(fileName + " has an unsupported orientation " + line + ".");
+  }
+
+  rgb.resize(3 * size_t(width) * height);
+  std::vector<unsigned char> scanline(4 * size_t(width));
+  for (int y = 0; y < height; ++y) {
+    unsigned char head[4];
+    file.read((char*)head, 4);
+    if (width >= 8 && width < 32768 && head[0] == 2 && head[1] == 2 && ((head[2] << 8) | head[3]) == width) {
+      // each of the four channels is run-length encoded separately
+      for (int c = 0; c < 4; ++c) {
+        int x = 0;
+        while (x < width && file) {
+          int count = file.get();
+          if (count > 128) {
+            count -= 128;
+            int value = file.get();
+            for (int i = 0; i < count && x < width; ++i) {
+              scanline[4 * x++ + c] = (unsigned char)value;
+            }
+          } else {
+            for (int i = 0; i < count && x < width; ++i) {
+              scanline[4 * x++ + c] = (unsigned char)file.get();
+            }
+          }
+        }
+      }
+    } else {
+      memcpy(scanline.data(), head, 4);
+      file.read((char*)scanline.data() + 4, 4 * (width - 1));
+    }
+    if (!file) {
+      throw std::runtime_error(fileName + " is truncated.");
+    }
+    for (int x = 0; x < width; ++x) {
+      const unsigned char* texel = &scanline[4 * x];
+      float scale = texel[3] ? ldexpf(1.f, int(texel[3]) - 136) : 0.f;
+      for (int c = 0; c < 3; ++c) {
+        rgb[3 * (size_t(y) * width + x) + c] = texel[c] * scale;
+      }
+    }
+  }
+}
+
+}
+
+EnvMap::EnvMap(const std::string& fileName) {
+  if (QFileInfo(QString::fromStdString(fileName)).suffix().toLower() == "pfm") {
+    if (!readPfm(fileName, rgb, width, height)) {
+      throw std::runtime_error("Cannot read " + fileName + ".");
+    }
+    // PFM stores the bottom row first
+    size_t rowSize = 3 * size_t(width);
+    for (int y = 0; y < height / 2; ++y) {
+      std::swap_ranges(rgb.begin() + y * rowSize, rgb.begin() + (y + 1) * rowSize, rgb.begin() + (height - 1 - y) * rowSize);
+    }
+  } else {
+    readHdr(fileName, rgb, width, height);
+  }
+
+  std::string cacheName = fileName + ".cdf";
+  QFileInfo mapInfo(QString::fromStdString(fileName));
+  QFileInfo cacheInfo(QString::fromStdString(cacheName));
+  if (cacheInfo.exists() && cacheInfo.lastModified() >= mapInfo.lastModified() && loadCdf(cacheName)) {
+    return;
+  }
+  buildCdf();
+  try {
+    saveCdf(cacheName);
+  } catch (std::exception&) {
+    // read-only map folders just rebuild the tables next time
+  }
+}
+
+size_t EnvMap::bytes() const {
+  return sizeof(float) * (rgb.size() + conditionalCdf.size() + marginalCdf.size());
+}
+
+void EnvMap::buildCdf() {
+  conditionalCdf.assign(size_t(width + 1) * height, 0.f);
+  marginalCdf.assign(height + 1, 0.f);
+  std::vector<double> rowSums(height);
+
+  // rows are independent, accumulate in double so wide maps stay monotonic
+  #pragma omp parallel for schedule(dynamic, 4)
+  for (int y = 0; y < height; ++y) {
+    float sinTheta = sinf(3.14159265f * (y + 0.5f) / height);
+    float* cdf = &conditionalCdf[size_t(width + 1) * y];
+    const float* row = &rgb[3 * size_t(width) * y];
+    double sum = 0.0;
+    for (int x = 0; x < width; ++x) {
+      sum += (0.2126 * row[3 * x] + 0.7152 * row[3 * x + 1] + 0.0722 * row[3 * x + 2]) * sinTheta;
+      cdf[x + 1] = float(sum);
+    }
+    for (int x = 1; x <= width; ++x) {
+      cdf[x] = sum > 0.0 ? float(cdf[x] / sum) : float(x) / width;
+    }
+    rowSums[y] = sum;
+  }
+
+  double total = 0.0;
+  for (int y = 0; y < height; ++y) {
+    total += rowSums[y];
+    marginalCdf[y + 1] = float(total);
+  }
+  for (int y = 1; y <= height; ++y) {
+    marginalCdf[y] = total > 0.0 ? float(marginalCdf[y] / total) : float(y) / height;
+  }
+}
+
+bool EnvMap::loadCdf(const std::string& cacheName) {
+  std::ifstream file(cacheName, std::ios::binary);
+  char magic[sizeof(kCdfMagic)];
+  int size[2];
+  file.read(magic, sizeof(magic));
+  file.read((char*)size, sizeof(size));
+  if (!file || memcmp(magic, kCdfMagic, sizeof(magic)) != 0 || size[0] != width || size[1] != height) {
+    return false;
+  }
+  conditionalCdf.resize(size_t(width + 1) * height);
+  marginalCdf.resize(height + 1);
+  file.read((char*)conditionalCdf.data(), sizeof(float) * conditionalCdf.size());
+  file.read((char*)marginalCdf.data(), sizeof(float) * marginalCdf.size());
+  return bool(file);
+}
+
+void EnvMap::saveCdf(const std::string& cacheName) const {
+  QSaveFile file(QString::fromStdString(cacheName));
+  if (!file.open(QIODevice::WriteOnly)) {
+    throw std::runtime_error("Cannot open " + cacheName + " for writing.");
+  }
+  int size[2] = { width, height };
+  file.write(kCdfMagic, sizeof(kCdfMagic));
+  file.write((const char*)size, sizeof(size));
+  file.write((const char*)conditionalCdf.data(), sizeof(float) * conditionalCdf.size());
+  file.write((const char*)marginalCdf.data(), sizeof(float) * marginalCdf.size());
+  if (!file.commit()) {
+    throw std::runtime_error("Cannot write " + cacheName + ".");
+  }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Equirectangular HDR environment with the tables for importance sampling it.
+// Row 0 looks up (+y), u runs along phi = atan2(z, x). Texels are weighted
+// by luminance times sin(theta), so the sampled density follows the
+// radiance actually arriving from each solid angle.
+class EnvMap {
+public:
+  // Reads a Radiance .hdr or a .pfm. The sampling tables are reused from
+  // <fileName>.cdf when that cache is newer than the map, otherwise they are
+  // built in parallel and the cache is written back.
+  EnvMap(const std::string& fileName);
+  size_t bytes() const;
+
+  int width;
+  int height;
+  std::vector<float> rgb;
+  std::vector<float> conditionalCdf; // width + 1 entries per row, 0 to 1
+  std::vector<float> marginalCdf; // height + 1 entries over rows, 0 to 1
+
+private:
+  void buildCdf();
+  bool loadCdf(const std::string& cacheName);
+  void saveCdf(const std::string& cacheName) const;
+};
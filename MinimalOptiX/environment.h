@@ -0,0 +1,88 @@
+#pragma once
+
+#include <optix_world.h>
+
+using namespace optix;
+
+// Device side of EnvMap (env_map.h): lookup, importance sampling and the
+// matching solid angle pdf. envEnabled is 0 and the buffers are 1x1
+// placeholders unless an environment map was loaded.
+
+rtDeclareVariable(int, envEnabled, , );
+rtDeclareVariable(float, envScale, , );
+rtBuffer<float3, 2> envMap;
+rtBuffer<float, 2> envConditionalCdf;
+rtBuffer<float> envMarginalCdf;
+
+__device__ __inline__ uint2 envTexel(const float3& d) {
+  size_t2 size = envMap.size();
+  float theta = acosf(fminf(1.f, fmaxf(-1.f, d.y)));
+  float phi = atan2f(d.z, d.x);
+  if (phi < 0.f) {
+    phi += 2.f * M_PIf;
+  }
+  uint x = min(uint(phi / (2.f * M_PIf) * size.x), uint(size.x - 1));
+  uint y = min(uint(theta / M_PIf * size.y), uint(size.y - 1));
+  return make_uint2(x, y);
+}
+
+__device__ __inline__ float3 envLookup(const float3& d) {
+  return envScale * envMap[envTexel(d)];
+}
+
+__device__ __inline__ float envTexelPdf(const uint2& texel, float sinTheta) {
+  if (sinTheta <= 0.f) {
+    return 0.f;
+  }
+  size_t2 size = envMap.size();
+  float rowProb = envMarginalCdf[texel.y + 1] - envMarginalCdf[texel.y];
+  float colProb = envConditionalCdf[make_uint2(texel.x + 1, texel.y)] - envConditionalCdf[texel];
+  return rowProb * colProb * size.x * size.y / (2.f * M_PIf * M_PIf * sinTheta);
+}
+
+__device__ __inline__ float envPdf(const float3& d) {
+  return envTexelPdf(envTexel(d), sqrtf(fmaxf(0.f, 1.f - d.y * d.y)));
+}
+
+// last index i in [0, n) with cdf(i) <= u
+template <typename Cdf>
+__device__ __inline__ uint envFindInterval(const Cdf& cdf, uint n, float u) {
+  uint lo = 0;
+  uint hi = n - 1;
+  while (lo < hi) {
+    uint mid = (lo + hi + 1) / 2;
+    if (cdf(mid) <= u) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+struct EnvMarginal {
+  __device__ float operator()(uint i) const { return envMarginalCdf[i]; }
+};
+
+struct EnvConditional {
+  uint row;
+  __device__ float operator()(uint i) const { return envConditionalCdf[make_uint2(i, row)]; }
+};
+
+__device__ __inline__ float3 sampleEnv(float u1, float u2, float& pdf) {
+  size_t2 size = envMap.size();
+  EnvMarginal marginal;
+  uint y = envFindInterval(marginal, uint(size.y), u1);
+  EnvConditional conditional = { y };
+  uint x = envFindInterval(conditional, uint(size.x), u2);
+  // continuous position inside the chosen texel
+  float v0 = marginal(y);
+  float du0 = conditional(x);
+  float dv = (u1 - v0) / fmaxf(marginal(y + 1) - v0, 1e-12f);
+  float du = (u2 - du0) / fmaxf(conditional(x + 1) - du0, 1e-12f);
+  float theta = M_PIf * (y + fminf(dv, 1.f)) / size.y;
+  float phi = 2.f * M_PIf * (x + fminf(du, 1.f)) / size.x;
+  float sinTheta = sinf(theta);
+  pdf = envTexelPdf(make_uint2(x, y), sinTheta);
+  return make_float3(sinTheta * cosf(phi), cosf(theta), sinTheta * sinf(phi));
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <optix_world.h>
+
+// Exceptions raised by the launches. The exception programs append the code
+// and launch index to a bounded log and bump a counter that keeps counting
+// past the capacity, so the host sees the true total of every launch. The
+// host reads both after each launch (ExceptionStats) and clears the counter.
+
+#define EXCEPTION_LOG_CAPACITY 1024
+
+struct ExceptionRecord {
+  int code; // RTexception, RT_EXCEPTION_USER and up for rtThrow
+  optix::uint2 launchIndex; // y is 0 in 1D launches
+};
+
+#ifdef __CUDACC__
+
+rtBuffer<unsigned int> exceptionCount;
+rtBuffer<ExceptionRecord> exceptionLog;
+
+__device__ __inline__ void logException(optix::uint2 launchIndex) {
+  unsigned int slot = atomicAdd(&exceptionCount[0], 1u);
+  if (slot < EXCEPTION_LOG_CAPACITY) {
+    ExceptionRecord record;
+    record.code = rtGetExceptionCode();
+    record.launchIndex = launchIndex;
+    exceptionLog[slot] = record;
+  }
+}
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <optix_world.h>
+#include "structures.h"
+
+// Path guiding shared by the Disney program and PathGuide on the host.
+// Directions are binned on an equal-area cylinder (cos theta by phi around
+// +y), so every bin covers the same solid angle and a bin's pdf is its
+// probability divided by that area. Cdf accessors return the cumulative
+// probability before bin i, for i in [0, GUIDE_BINS].
+
+#define GUIDE_DIR_RES 16
+#define GUIDE_BINS (GUIDE_DIR_RES * GUIDE_DIR_RES)
+#define GUIDE_BIN_SOLID_ANGLE (4.f * M_PIf / GUIDE_BINS)
+
+// -1 outside the grid
+RT_HOSTDEVICE inline int guideCell(const GuideParams& guide, const optix::float3& p) {
+  optix::float3 c = (p - guide.origin) * guide.invCellSize;
+  int x = int(floorf(c.x));
+  int y = int(floorf(c.y));
+  int z = int(floorf(c.z));
+  if (x < 0 || y < 0 || z < 0 || x >= guide.resolution || y >= guide.resolution || z >= guide.resolution) {
+    return -1;
+  }
+  return (z * guide.resolution + y) * guide.resolution + x;
+}
+
+RT_HOSTDEVICE inline int guideBin(const optix::float3& d) {
+  float phi = atan2f(d.z, d.x);
+  if (phi < 0.f) {
+    phi += 2.f * M_PIf;
+  }
+  int iz = int((fminf(1.f, fmaxf(-1.f, d.y)) + 1.f) * 0.5f * GUIDE_DIR_RES);
+  int iphi = int(phi / (2.f * M_PIf) * GUIDE_DIR_RES);
+  iz = iz < GUIDE_DIR_RES ? iz : GUIDE_DIR_RES - 1;
+  iphi = iphi < GUIDE_DIR_RES ? iphi : GUIDE_DIR_RES - 1;
+  return iz * GUIDE_DIR_RES + iphi;
+}
+
+template <typename Cdf>
+RT_HOSTDEVICE inline float guidePdf(const Cdf& cdf, const optix::float3& d) {
+  int bin = guideBin(d);
+  return (cdf(bin + 1) - cdf(bin)) / GUIDE_BIN_SOLID_ANGLE;
+}
+
+template <typename Cdf>
+RT_HOSTDEVICE inline optix::float3 sampleGuide(const Cdf& cdf, float u0, float u1, float u2) {
+  // last bin whose cumulative probability is <= u0
+  int lo = 0;
+  int hi = GUIDE_BINS - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (cdf(mid) <= u0) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  float z = -1.f + 2.f * ((lo / GUIDE_DIR_RES) + u1) / GUIDE_DIR_RES;
+  float phi = 2.f * M_PIf * ((lo % GUIDE_DIR_RES) + u2) / GUIDE_DIR_RES;
+  float r = sqrtf(fmaxf(0.f, 1.f - z * z));
+  return optix::make_float3(r * cosf(phi), z, r * sinf(phi));
+}
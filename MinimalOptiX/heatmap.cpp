@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <QColor>
+#include "heatmap.h"
+
+void averageCost(const float* costSums, int width, int height, std::vector<float>& cost) {
+  size_t nPixels = size_t(width) * height;
+  cost.resize(3 * nPixels);
+  #pragma omp parallel for
+  for (int i = 0; i < int(nPixels); ++i) {
+    const float* sums = costSums + 4 * size_t(i);
+    float paths = sums[3];
+    cost[3 * i] = paths > 0.f ? std::max(sums[0] - paths, 0.f) / paths : 0.f;
+    cost[3 * i + 1] = paths > 0.f ? sums[1] / paths : 0.f;
+    cost[3 * i + 2] = paths > 0.f ? sums[2] / paths : 0.f;
+  }
+}
+
+float drawHeatmap(const std::vector<float>& cost, CostChannel channel, int width, int height, QImage& image) {
+  size_t nPixels = size_t(width) * height;
+  std::vector<float> values(nPixels);
+  for (size_t i = 0; i < nPixels; ++i) {
+    values[i] = cost[3 * i + channel];
+  }
+  std::vector<float> sorted(values);
+  auto percentile = sorted.begin() + std::min(nPixels - 1, nPixels * 99 / 100);
+  std::nth_element(sorted.begin(), percentile, sorted.end());
+  float scale = *percentile > 0.f ? *percentile : 1.f;
+
+  // black, blue, green, yellow, red at 0, 1/4, 1/2, 3/4, 1
+  const float ramp[5][3] = { { 0.f, 0.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 1.f, 0.f }, { 1.f, 1.f, 0.f }, { 1.f, 0.f, 0.f } };
+  QColor color;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      float t = std::min(values[size_t(y) * width + x] / scale, 1.f) * 4.f;
+      int k = std::min(int(t), 3);
+      float f = t - k;
+      color.setRedF(ramp[k][0] + f * (ramp[k + 1][0] - ramp[k][0]));
+      color.setGreenF(ramp[k][1] + f * (ramp[k + 1][1] - ramp[k][1]));
+      color.setBlueF(ramp[k][2] + f * (ramp[k + 1][2] - ramp[k][2]));
+      image.setPixelColor(x, height - y - 1, color);
+    }
+  }
+  return scale;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+#include <QImage>
+
+// Per-pixel render cost of --heatmap. The device sums, per pixel, radiance
+// rays, shadow rays, kilocycles spent in the camera's trace and camera
+// paths (ray_stats.h); these helpers turn the sums into per-path averages
+// and a false color image.
+
+enum CostChannel { COST_BOUNCES, COST_SHADOW_RAYS, COST_KILOCYCLES };
+
+// bounces after the primary ray, shadow rays and kilocycles per path, 3
+// floats per pixel in the device's row order (bottom row first)
+void averageCost(const float* costSums, int width, int height, std::vector<float>& cost);
+
+// One channel from black (no cost) through blue, green and yellow to red
+// at the 99th percentile, so a few outliers do not wash out the rest.
+// Rows are flipped like the radiance display. Returns the value shown as red.
+float drawHeatmap(const std::vector<float>& cost, CostChannel channel, int width, int height, QImage& image);
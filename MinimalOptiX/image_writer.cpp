@@ -0,0 +1,81 @@
+#include <chrono>
+#include <algorithm>
+#include "image_writer.h"
+#include "trace.h"
+
+ImageWriter::ImageWriter(size_t capacity, int nWorkers) : capacity(capacity) {
+  for (int i = 0; i < nWorkers; ++i) {
+    workers.emplace_back(&ImageWriter::work, this);
+  }
+}
+
+ImageWriter::~ImageWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void ImageWriter::save(const QImage& image, const QString& fileName, Compression compression) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (jobs.size() >= capacity) {
+    auto start = std::chrono::steady_clock::now();
+    cv.wait(lock, [&] { return jobs.size() < capacity; });
+    counters.stalledMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+  jobs.push_back({ image, fileName, compression });
+  counters.maxQueueDepth = std::max(counters.maxQueueDepth, jobs.size());
+  lock.unlock();
+  cv.notify_all();
+}
+
+void ImageWriter::flush() {
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [&] { return jobs.empty() && busy == 0; });
+}
+
+ImageWriter::Stats ImageWriter::stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return counters;
+}
+
+void ImageWriter::resetStats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  counters = Stats();
+}
+
+void ImageWriter::work() {
+  traceThreadName("image writer");
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    cv.wait(lock, [&] { return stopping || !jobs.empty(); });
+    if (jobs.empty()) {
+      return;
+    }
+    Job job = jobs.front();
+    jobs.pop_front();
+    ++busy;
+    lock.unlock();
+    cv.notify_all();
+    // for PNG, Qt maps quality q to zlib level (100 - q) * 9 / 91, rounded
+    // down: 80 is level 1, anything above 89 is level 0 (stored)
+    int quality = -1;
+    if (job.compression == COMPRESSION_FAST) {
+      quality = 80;
+    } else if (job.compression == COMPRESSION_NONE) {
+      quality = 100;
+    }
+    {
+      TraceSpan span("write image", tracing() ? job.fileName.toStdString() : std::string());
+      job.image.save(job.fileName, nullptr, quality);
+    }
+    lock.lock();
+    --busy;
+    ++counters.written;
+    cv.notify_all();
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <QImage>
+#include <QString>
+
+// Saves images on background threads so the render loop does not wait for
+// PNG compression. The queue is bounded: save() blocks when it is full, and
+// the time spent blocked is reported as the backpressure metric.
+class ImageWriter {
+public:
+  enum Compression {
+    COMPRESSION_DEFAULT, // final frames
+    COMPRESSION_FAST,    // intermediate checkpoints
+    COMPRESSION_NONE
+  };
+
+  struct Stats {
+    size_t written = 0;
+    size_t maxQueueDepth = 0;
+    double stalledMs = 0.0; // time save() waited for a free queue slot
+  };
+
+  ImageWriter(size_t capacity = 16, int nWorkers = 2);
+  ~ImageWriter();
+
+  // The image is shared implicitly, callers should pass a detached copy.
+  void save(const QImage& image, const QString& fileName, Compression compression = COMPRESSION_DEFAULT);
+  // Blocks until every queued image is written.
+  void flush();
+  Stats stats();
+  void resetStats();
+
+private:
+  struct Job {
+    QImage image;
+    QString fileName;
+    Compression compression;
+  };
+
+  void work();
+
+  size_t capacity;
+  std::deque<Job> jobs;
+  int busy = 0;
+  bool stopping = false;
+  Stats counters;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<std::thread> workers;
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <optix_world.h>
+#include "structures.h"
+
+// Light sampling shared by the material programs and the host side checks.
+// All routines take their random numbers as arguments.
+
+// direction towards the emitting surface, distance to it and the solid
+// angle pdf; pdf 0 means the light cannot be seen from p
+struct LightSample {
+  optix::float3 direction;
+  float distance;
+  float pdf;
+};
+
+// below this solid angle quads fall back to area sampling, where the
+// spherical rectangle math loses precision
+#define LIGHT_MIN_SOLID_ANGLE 1e-4f
+
+// =================== sphere lights ====================
+
+// 1 - cos of the half angle of the cone subtended by the sphere, 0 from inside
+RT_HOSTDEVICE inline float sphereLightOneMinusCos(const LightParams& light, const optix::float3& p) {
+  optix::float3 w = light.position - p;
+  float dc2 = optix::dot(w, w);
+  float r2 = light.radius * light.radius;
+  if (dc2 <= r2) {
+    return 0.f;
+  }
+  float sin2ThetaMax = r2 / dc2;
+  // written this way to stay accurate for small, distant spheres
+  return sin2ThetaMax / (1.f + sqrtf(1.f - sin2ThetaMax));
+}
+
+RT_HOSTDEVICE inline float sphereLightPdf(const LightParams& light, const optix::float3& p) {
+  float oneMinusCos = sphereLightOneMinusCos(light, p);
+  return oneMinusCos > 0.f ? 1.f / (2.f * M_PIf * oneMinusCos) : 0.f;
+}
+
+// uniform over the cone of directions in which the sphere is visible
+RT_HOSTDEVICE inline LightSample sampleSphereLight(const LightParams& light, const optix::float3& p, float u1, float u2) {
+  LightSample sample;
+  sample.pdf = 0.f;
+  float oneMinusCos = sphereLightOneMinusCos(light, p);
+  if (oneMinusCos <= 0.f) {
+    return sample;
+  }
+  optix::float3 w = light.position - p;
+  float dc = optix::length(w);
+  w /= dc;
+  optix::float3 a = fabsf(w.x) > 0.9f ? optix::make_float3(0.f, 1.f, 0.f) : optix::make_float3(1.f, 0.f, 0.f);
+  optix::float3 u = optix::normalize(optix::cross(a, w));
+  optix::float3 v = optix::cross(w, u);
+
+  float cosTheta = 1.f - u1 * oneMinusCos;
+  float sinTheta = sqrtf(fmaxf(0.f, 1.f - cosTheta * cosTheta));
+  float phi = 2.f * M_PIf * u2;
+  sample.direction = optix::normalize(u * (cosf(phi) * sinTheta) + v * (sinf(phi) * sinTheta) + w * cosTheta);
+  // near side of the sphere along the sampled direction
+  float disc = light.radius * light.radius - dc * dc * sinTheta * sinTheta;
+  sample.distance = dc * cosTheta - sqrtf(fmaxf(0.f, disc));
+  sample.pdf = 1.f / (2.f * M_PIf * oneMinusCos);
+  return sample;
+}
+
+// ==================== quad lights =====================
+// Spherical rectangle sampling (Urena et al. 2013), the quad's edges u and v
+// are assumed to be orthogonal as they are for every light in the scenes.
+
+struct SphericalRect {
+  optix::float3 x, y, z; // local frame, z points from the quad plane towards p
+  float x0, y0, x1, y1, z0;
+  float b0, b1, k;
+  float solidAngle;
+};
+
+RT_HOSTDEVICE inline float angleBetween(const optix::float3& a, const optix::float3& b) {
+  return acosf(fminf(1.f, fmaxf(-1.f, optix::dot(a, b))));
+}
+
+RT_HOSTDEVICE inline SphericalRect sphericalRect(const LightParams& light, const optix::float3& p) {
+  SphericalRect rect;
+  float exl = optix::length(light.u);
+  float eyl = optix::length(light.v);
+  rect.x = light.u / exl;
+  rect.y = light.v / eyl;
+  rect.z = optix::cross(rect.x, rect.y);
+  optix::float3 d = light.position - p;
+  float dz = optix::dot(d, rect.z);
+  if (dz > 0.f) {
+    rect.z = -rect.z;
+    dz = -dz;
+  }
+  rect.x0 = optix::dot(d, rect.x);
+  rect.y0 = optix::dot(d, rect.y);
+  rect.z0 = dz;
+  rect.x1 = rect.x0 + exl;
+  rect.y1 = rect.y0 + eyl;
+
+  optix::float3 v00 = optix::make_float3(rect.x0, rect.y0, rect.z0);
+  optix::float3 v01 = optix::make_float3(rect.x0, rect.y1, rect.z0);
+  optix::float3 v10 = optix::make_float3(rect.x1, rect.y0, rect.z0);
+  optix::float3 v11 = optix::make_float3(rect.x1, rect.y1, rect.z0);
+  optix::float3 n0 = optix::normalize(optix::cross(v00, v10));
+  optix::float3 n1 = optix::normalize(optix::cross(v10, v11));
+  optix::float3 n2 = optix::normalize(optix::cross(v11, v01));
+  optix::float3 n3 = optix::normalize(optix::cross(v01, v00));
+  float g0 = angleBetween(-n0, n1);
+  float g1 = angleBetween(-n1, n2);
+  float g2 = angleBetween(-n2, n3);
+  float g3 = angleBetween(-n3, n0);
+  rect.b0 = n0.z;
+  rect.b1 = n2.z;
+  rect.k = 2.f * M_PIf - g2 - g3;
+  rect.solidAngle = g0 + g1 - rect.k;
+  return rect;
+}
+
+// only the side the normal points to emits, like the light program expects
+RT_HOSTDEVICE inline bool quadLightFaces(const LightParams& light, const optix::float3& p) {
+  return optix::dot(p - light.position, light.normal) > 0.f;
+}
+
+// pdf of direction L reaching the quad at distance dist
+RT_HOSTDEVICE inline float quadLightPdf(const LightParams& light, const optix::float3& p, const optix::float3& L, float dist) {
+  if (!quadLightFaces(light, p)) {
+    return 0.f;
+  }
+  SphericalRect rect = sphericalRect(light, p);
+  if (rect.solidAngle >= LIGHT_MIN_SOLID_ANGLE) {
+    return 1.f / rect.solidAngle;
+  }
+  float cosLight = -optix::dot(L, light.normal);
+  return cosLight > 0.f ? dist * dist / (light.area * cosLight) : 0.f;
+}
+
+RT_HOSTDEVICE inline LightSample sampleQuadLight(const LightParams& light, const optix::float3& p, float u1, float u2) {
+  LightSample sample;
+  sample.pdf = 0.f;
+  if (!quadLightFaces(light, p)) {
+    return sample;
+  }
+  SphericalRect rect = sphericalRect(light, p);
+  optix::float3 q;
+  if (rect.solidAngle < LIGHT_MIN_SOLID_ANGLE) {
+    q = light.position + light.u * u1 + light.v * u2;
+  } else {
+    float au = u1 * rect.solidAngle + rect.k;
+    float fu = (cosf(au) * rect.b0 - rect.b1) / sinf(au);
+    float cu = copysignf(1.f, fu) / sqrtf(fu * fu + rect.b0 * rect.b0);
+    cu = fminf(1.f - 1e-6f, fmaxf(-1.f + 1e-6f, cu));
+    float xu = -(cu * rect.z0) / sqrtf(fmaxf(0.f, 1.f - cu * cu));
+    xu = fminf(rect.x1, fmaxf(rect.x0, xu));
+    float dd = sqrtf(xu * xu + rect.z0 * rect.z0);
+    float h0 = rect.y0 / sqrtf(dd * dd + rect.y0 * rect.y0);
+    float h1 = rect.y1 / sqrtf(dd * dd + rect.y1 * rect.y1);
+    float hv = h0 + u2 * (h1 - h0);
+    float hv2 = hv * hv;
+    float yv = hv2 < 1.f - 1e-6f ? hv * dd / sqrtf(1.f - hv2) : rect.y1;
+    q = p + rect.x * xu + rect.y * yv + rect.z * rect.z0;
+  }
+  optix::float3 L = q - p;
+  sample.distance = optix::length(L);
+  sample.direction = L / sample.distance;
+  sample.pdf = quadLightPdf(light, p, sample.direction, sample.distance);
+  return sample;
+}
+
+RT_HOSTDEVICE inline LightSample sampleLight(const LightParams& light, const optix::float3& p, float u1, float u2) {
+  return light.shape == SPHERE ? sampleSphereLight(light, p, u1, u2) : sampleQuadLight(light, p, u1, u2);
+}
+
+RT_HOSTDEVICE inline float lightPdf(const LightParams& light, const optix::float3& p, const optix::float3& L, float dist) {
+  return light.shape == SPHERE ? sphereLightPdf(light, p) : quadLightPdf(light, p, L, dist);
+}
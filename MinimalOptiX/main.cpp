@@ -4,7 +4,53 @@
 int main(int argc, char *argv[])
 {
   QApplication a(argc, argv);
-  MinimalOptiX w;
-  w.show();
-  return a.exec();
+  QStringList args = a.arguments();
+  int mergeIdx = args.indexOf("--merge");
+  if (mergeIdx >= 0) {
+    // --merge <output> <partial>... does not need a context
+    std::vector<std::string> inputs;
+    for (int i = mergeIdx + 2; i < args.size(); ++i) {
+      inputs.push_back(args[i].toStdString());
+    }
+    mergeCheckpoints(inputs, args.value(mergeIdx + 1).toStdString());
+    return 0;
+  }
+  int generateIdx = args.indexOf("--generate-stress");
+  if (generateIdx >= 0) {
+    // --generate-stress <triangles> [spheres] [lights] [materials] [textures]
+    // writes the "stress" scene and exits, render it with --scene stress
+    StressSceneParams params;
+    params.triangles = args.value(generateIdx + 1, "1000000").toULongLong();
+    params.spheres = args.value(generateIdx + 2, "1000").toInt();
+    params.lights = args.value(generateIdx + 3, "4").toInt();
+    params.materials = args.value(generateIdx + 4, "8").toInt();
+    params.textures = args.value(generateIdx + 5, "2").toInt();
+    size_t triangles = generateStressScene("scenes/stress", "stress", params);
+    printf("wrote scenes/stress with %zu triangles\n", triangles);
+    return 0;
+  }
+  int mathIdx = args.indexOf("--math-bench");
+  if (mathIdx >= 0) {
+    // --math-bench [out.json] runs on the host only
+    QString out = args.value(mathIdx + 1);
+    runMathBenchmark(out.startsWith("--") ? std::string() : out.toStdString());
+    return 0;
+  }
+  // --trace <file.json> records the host pipeline from here to exit
+  int traceIdx = args.indexOf("--trace");
+  if (traceIdx >= 0) {
+    traceStart();
+  }
+  int ret = 0;
+  {
+    MinimalOptiX w;
+    if (!w.headless) {
+      w.show();
+      ret = a.exec();
+    }
+  }
+  if (traceIdx >= 0) {
+    writeTrace(args.value(traceIdx + 1).toStdString());
+  }
+  return ret;
 }
@@ -0,0 +1,552 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <random>
+#include <vector>
+#include <QJsonArray>
+#include <QJsonObject>
+#include "math_bench.h"
+#include "benchmark.h"
+#include "disney.h"
+
+namespace {
+
+const int kRepeats = 5;
+const double kPi = 3.14159265358979323846;
+// below this magnitude results are compared absolutely
+const double kErrorFloor = 1e-6;
+
+// keeps the timed results alive
+volatile float sink;
+
+struct Result {
+  std::string name;
+  double scalarNs;
+  double batchNs;
+  std::string metric; // what the errors measure
+  double maxError;
+  double meanError;
+};
+
+struct ErrorStats {
+  double max = 0.0;
+  double sum = 0.0;
+  size_t n = 0;
+
+  void add(double error) {
+    max = std::max(max, error);
+    sum += error;
+    ++n;
+  }
+  void add(double value, double reference) {
+    add(fabs(value - reference) / std::max(fabs(reference), kErrorFloor));
+  }
+};
+
+// best of kRepeats, the first run also warms the caches
+double nsPerCall(const std::function<void()>& body, int nCalls) {
+  double best = std::numeric_limits<double>::max();
+  for (int r = 0; r < kRepeats; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+  }
+  return best / nCalls;
+}
+
+std::vector<float> uniform(std::mt19937& rng, int n, float lo, float hi) {
+  std::uniform_real_distribution<float> distribution(lo, hi);
+  std::vector<float> values(n);
+  for (auto& v : values) {
+    v = distribution(rng);
+  }
+  return values;
+}
+
+// random unit vector with z >= minZ
+float3 randomDirection(std::mt19937& rng, float minZ) {
+  std::normal_distribution<float> normal;
+  float3 v;
+  do {
+    v = normalize(make_float3(normal(rng), normal(rng), normal(rng)));
+  } while (v.z < minZ);
+  return v;
+}
+
+// the same as (x, y, z) arrays
+void hemisphere(std::mt19937& rng, int n, float minZ, std::vector<float>& x, std::vector<float>& y, std::vector<float>& z) {
+  x.resize(n);
+  y.resize(n);
+  z.resize(n);
+  for (int i = 0; i < n; ++i) {
+    float3 v = randomDirection(rng, minZ);
+    x[i] = v.x;
+    y[i] = v.y;
+    z[i] = v.z;
+  }
+}
+
+Result finish(const char* name, double scalarNs, double batchNs, const char* metric, const ErrorStats& error) {
+  return { name, scalarNs, batchNs, metric, error.max, error.n ? error.sum / error.n : 0.0 };
+}
+
+// f(in, i) is the float function at input i, ref(in, i) its double version
+template<typename F, typename Ref>
+Result benchFunction(const char* name, const std::vector<std::vector<float>>& inputs, F f, Ref ref) {
+  int n = int(inputs[0].size());
+  std::vector<const float*> pointers;
+  for (auto& input : inputs) {
+    pointers.push_back(input.data());
+  }
+  const float* const* in = pointers.data();
+
+  // a float sum is not reassociated, so this loop stays scalar
+  double scalarNs = nsPerCall([&] {
+    float sum = 0.f;
+    for (int i = 0; i < n; ++i) {
+      sum += f(in, i);
+    }
+    sink = sum;
+  }, n);
+  std::vector<float> out(n);
+  double batchNs = nsPerCall([&] {
+    float* o = out.data();
+    for (int i = 0; i < n; ++i) {
+      o[i] = f(in, i);
+    }
+    sink = o[n / 2];
+  }, n);
+
+  ErrorStats error;
+  for (int i = 0; i < n; ++i) {
+    error.add(out[i], ref(in, i));
+  }
+  return finish(name, scalarNs, batchNs, "relative to double", error);
+}
+
+// ================= double references ==================
+
+double fresnelRef(double cosThetaI, double cosThetaT, double refIdx) {
+  double rs = (cosThetaI - cosThetaT * refIdx) / (cosThetaI + refIdx * cosThetaT);
+  double rp = (cosThetaI * refIdx - cosThetaT) / (cosThetaI * refIdx + cosThetaT);
+  return 0.5 * (rs * rs + rp * rp);
+}
+
+double gtr1Ref(double NDotH, double a) {
+  if (a >= 1.0) {
+    return 1.0 / kPi;
+  }
+  double a2 = a * a;
+  double t = 1.0 + (a2 - 1.0) * NDotH * NDotH;
+  return (a2 - 1.0) / (kPi * log(a2) * t);
+}
+
+double gtr2Ref(double NDotH, double a) {
+  double a2 = a * a;
+  double t = 1.0 + (a2 - 1.0) * NDotH * NDotH;
+  return a2 / (kPi * t * t);
+}
+
+double gtr2AnisoRef(double NdotH, double HdotX, double HdotY, double ax, double ay) {
+  double s = (HdotX / ax) * (HdotX / ax) + (HdotY / ay) * (HdotY / ay) + NdotH * NdotH;
+  return 1.0 / (kPi * ax * ay * s * s);
+}
+
+double schlickRef(double u) {
+  double m = std::min(std::max(1.0 - u, 0.0), 1.0);
+  return m * m * m * m * m;
+}
+
+double smithRef(double NdotV, double alphaG) {
+  double a = alphaG * alphaG;
+  double b = NdotV * NdotV;
+  return 1.0 / (NdotV + sqrt(a + b - a * b));
+}
+
+double smithAnisoRef(double NdotV, double VdotX, double VdotY, double ax, double ay) {
+  return 1.0 / (NdotV + sqrt((VdotX * ax) * (VdotX * ax) + (VdotY * ay) * (VdotY * ay) + NdotV * NdotV));
+}
+
+struct Double3 {
+  double x, y, z;
+};
+
+Double3 operator+(const Double3& a, const Double3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+Double3 operator*(const Double3& a, double s) { return { a.x * s, a.y * s, a.z * s }; }
+Double3 toDouble(const float3& v) { return { v.x, v.y, v.z }; }
+double dotRef(const Double3& a, const Double3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+double lerpRef(double a, double b, double t) { return a + t * (b - a); }
+Double3 lerpRef(const Double3& a, const Double3& b, double t) { return a * (1.0 - t) + b * t; }
+
+// disneyEval in double, the tangent frame X, Y comes from the float Onb
+Double3 disneyEvalRef(const DisneyParams& p, const float3& baseColor, const float3& N, const float3& L, const float3& V, const float3& H, const float3& X, const float3& Y) {
+  Double3 n = toDouble(N), l = toDouble(L), v = toDouble(V), h = toDouble(H);
+  Double3 x = toDouble(X), y = toDouble(Y);
+  double NdotL = dotRef(n, l);
+  double NdotV = dotRef(n, v);
+  double NdotH = dotRef(n, h);
+  double LdotH = dotRef(l, h);
+  Double3 one = { 1.0, 1.0, 1.0 };
+  Double3 Cdlin = { pow(double(baseColor.x), 2.2), pow(double(baseColor.y), 2.2), pow(double(baseColor.z), 2.2) };
+  double Cdlum = dotRef(Cdlin, { 0.3, 0.6, 0.1 });
+  Double3 Ctint = Cdlum > 0.0 ? Cdlin * (1.0 / Cdlum) : one;
+  Double3 Cspec0 = lerpRef(lerpRef(one, Ctint, p.specularTint) * (p.specular * 0.08), Cdlin, p.metallic);
+  Double3 Csheen = lerpRef(one, Ctint, p.sheenTint);
+
+  double FL = schlickRef(NdotL);
+  double FV = schlickRef(NdotV);
+  double Fd90 = 0.5 + 2.0 * LdotH * LdotH * p.roughness;
+  double Fd = lerpRef(1.0, Fd90, FL) * lerpRef(1.0, Fd90, FV);
+  double Fss90 = LdotH * LdotH * p.roughness;
+  double Fss = lerpRef(1.0, Fss90, FL) * lerpRef(1.0, Fss90, FV);
+  double ss = 1.25 * (Fss * (1.0 / (NdotL + NdotV) - 0.5) + 0.5);
+
+  double aspect = sqrt(1.0 - p.anisotropic * 0.9);
+  double ax = std::max(0.001, double(p.roughness) * p.roughness / aspect);
+  double ay = std::max(0.001, double(p.roughness) * p.roughness * aspect);
+  double Ds = gtr2AnisoRef(NdotH, dotRef(h, x), dotRef(h, y), ax, ay);
+  double FH = schlickRef(LdotH);
+  Double3 Fs = lerpRef(Cspec0, one, FH);
+  double Gs = smithAnisoRef(NdotL, dotRef(l, x), dotRef(l, y), ax, ay) *
+              smithAnisoRef(NdotV, dotRef(v, x), dotRef(v, y), ax, ay);
+  Double3 Fsheen = Csheen * (FH * p.sheen);
+  double Dr = gtr1Ref(NdotH, lerpRef(0.1, 0.001, p.clearcoatGloss));
+  double Fr = lerpRef(0.04, 1.0, FH);
+  double Gr = smithRef(NdotL, 0.25) * smithRef(NdotV, 0.25);
+  double clearcoat = 0.25 * p.clearcoat * Gr * Fr * Dr;
+  return (Cdlin * (lerpRef(Fd, ss, p.subsurface) / kPi) + Fsheen) * (1.0 - p.metallic) +
+         Fs * (Gs * Ds) + Double3{ clearcoat, clearcoat, clearcoat };
+}
+
+// ==================== benchmarks ======================
+
+Result benchTea(int n, std::mt19937& rng) {
+  std::vector<unsigned int> a(n), b(n), out(n);
+  for (int i = 0; i < n; ++i) {
+    a[i] = rng();
+    b[i] = rng();
+  }
+  // seeds are chained from vertex to vertex on the device as well
+  double scalarNs = nsPerCall([&] {
+    unsigned int seed = 0;
+    for (int i = 0; i < n; ++i) {
+      seed = tea<16>(seed ^ a[i], b[i]);
+    }
+    sink = float(seed);
+  }, n);
+  double batchNs = nsPerCall([&] {
+    for (int i = 0; i < n; ++i) {
+      out[i] = tea<16>(a[i], b[i]);
+    }
+    sink = float(out[n / 2]);
+  }, n);
+  // integer only, there is nothing to compare
+  return finish("tea<16>", scalarNs, batchNs, "-", ErrorStats());
+}
+
+Result benchRand(int n, std::mt19937& rng) {
+  std::vector<int> seeds(n);
+  for (auto& seed : seeds) {
+    seed = int(rng());
+  }
+  std::vector<float> out(n);
+  double scalarNs = nsPerCall([&] {
+    int seed = seeds[0];
+    float sum = 0.f;
+    for (int i = 0; i < n; ++i) {
+      sum += rand(seed);
+    }
+    sink = sum;
+  }, n);
+  double batchNs = nsPerCall([&] {
+    for (int i = 0; i < n; ++i) {
+      out[i] = rand(seeds[i]);
+    }
+    sink = out[n / 2];
+  }, n);
+  // the mean of a uniform [0, 1) stream
+  ErrorStats error;
+  double sum = 0.0;
+  int seed = 1;
+  for (int i = 0; i < n; ++i) {
+    float u = rand(seed);
+    if (u < 0.f || u >= 1.f) {
+      error.add(1.0);
+    }
+    sum += u;
+  }
+  error.add(fabs(sum / n - 0.5));
+  return finish("rand", scalarNs, batchNs, "|mean - 1/2|", error);
+}
+
+Result benchRefineHitpoint(int n, std::mt19937& rng) {
+  // rays from around the origin to random planes, with the hit distance
+  // perturbed the way a triangle intersection would be off
+  std::vector<float> nx, ny, nz;
+  hemisphere(rng, n, 0.1f, nx, ny, nz);
+  std::vector<float> scale = uniform(rng, n, 1.f, 1000.f);
+  std::vector<float> jitter = uniform(rng, n, -1e-4f, 1e-4f);
+  std::vector<float3> hit(n), direction(n), normal(n), point(n);
+  std::uniform_real_distribution<float> offset(-1.f, 1.f);
+  for (int i = 0; i < n; ++i) {
+    normal[i] = make_float3(nx[i], ny[i], nz[i]);
+    point[i] = make_float3(offset(rng), offset(rng), offset(rng)) * scale[i] - normal[i] * scale[i];
+    direction[i] = normalize(point[i] - make_float3(offset(rng), offset(rng), offset(rng)));
+    float t = intersectPlane(make_float3(0.f), direction[i], normal[i], point[i]);
+    hit[i] = direction[i] * (t * (1.f + jitter[i]));
+  }
+  std::vector<float3> back(n), front(n);
+  double scalarNs = nsPerCall([&] {
+    float sum = 0.f;
+    for (int i = 0; i < n; ++i) {
+      float3 b, f;
+      refineHitpoint(hit[i], direction[i], normal[i], point[i], b, f);
+      sum += b.x + f.x;
+    }
+    sink = sum;
+  }, n);
+  double batchNs = nsPerCall([&] {
+    for (int i = 0; i < n; ++i) {
+      refineHitpoint(hit[i], direction[i], normal[i], point[i], back[i], front[i]);
+    }
+    sink = back[n / 2].x;
+  }, n);
+  // the front point must be on the side the ray came from, the back point
+  // on the other one
+  ErrorStats error;
+  for (int i = 0; i < n; ++i) {
+    Double3 nn = toDouble(normal[i]);
+    double planeD = dotRef(nn, toDouble(point[i]));
+    double side = dotRef(nn, toDouble(direction[i])) > 0.0 ? 1.0 : -1.0;
+    bool frontOk = (dotRef(nn, toDouble(front[i])) - planeD) * side < 0.0;
+    bool backOk = (dotRef(nn, toDouble(back[i])) - planeD) * side > 0.0;
+    error.add(frontOk && backOk ? 0.0 : 1.0);
+  }
+  return finish("refineHitpoint", scalarNs, batchNs, "fraction on wrong side", error);
+}
+
+struct DisneyInputs {
+  std::vector<DisneyParams> params;
+  std::vector<float3> baseColor, N, L, V, H;
+};
+
+DisneyParams randomDisneyParams(std::mt19937& rng) {
+  std::uniform_real_distribution<float> u(0.f, 1.f);
+  DisneyParams p = {};
+  p.metallic = u(rng);
+  p.subsurface = u(rng);
+  p.specular = u(rng);
+  p.roughness = 0.05f + 0.95f * u(rng);
+  p.specularTint = u(rng);
+  p.anisotropic = u(rng);
+  p.sheen = u(rng);
+  p.sheenTint = u(rng);
+  p.clearcoat = u(rng);
+  p.clearcoatGloss = u(rng);
+  return p;
+}
+
+// directions as Material.cu gets them, L sampled by disneySample and kept
+// only above the surface
+DisneyInputs disneyInputs(int n, std::mt19937& rng) {
+  DisneyInputs in;
+  std::uniform_real_distribution<float> u(0.f, 1.f);
+  int seed = int(rng());
+  while (int(in.N.size()) < n) {
+    float3 N = randomDirection(rng, -1.f);
+    Onb onb(N);
+    float3 V = randomDirection(rng, 0.05f);
+    onb.inverse_transform(V);
+    V = normalize(V);
+    DisneyParams params = randomDisneyParams(rng);
+    float3 L, H;
+    disneySample(seed, params, N, L, V, H);
+    if (dot(N, L) < 0.05f) {
+      continue;
+    }
+    in.params.push_back(params);
+    in.baseColor.push_back(make_float3(u(rng), u(rng), u(rng)));
+    in.N.push_back(N);
+    in.L.push_back(L);
+    in.V.push_back(V);
+    in.H.push_back(H);
+  }
+  return in;
+}
+
+Result benchDisneySample(const DisneyInputs& in, std::mt19937& rng) {
+  int n = int(in.N.size());
+  std::vector<DisneyParams> params = in.params;
+  std::vector<float3> N = in.N, V = in.V, L(n), H(n);
+  std::vector<int> seeds(n);
+  for (auto& seed : seeds) {
+    seed = int(rng());
+  }
+  double scalarNs = nsPerCall([&] {
+    int seed = seeds[0];
+    float sum = 0.f;
+    for (int i = 0; i < n; ++i) {
+      float3 l, h;
+      disneySample(seed, params[i], N[i], l, V[i], h);
+      sum += l.x;
+    }
+    sink = sum;
+  }, n);
+  double batchNs = nsPerCall([&] {
+    for (int i = 0; i < n; ++i) {
+      disneySample(seeds[i], params[i], N[i], L[i], V[i], H[i]);
+    }
+    sink = L[n / 2].x;
+  }, n);
+  ErrorStats error;
+  for (int i = 0; i < n; ++i) {
+    error.add(fabs(1.0 - sqrt(dotRef(toDouble(L[i]), toDouble(L[i])))));
+  }
+  return finish("disneySample", scalarNs, batchNs, "|1 - length(L)|", error);
+}
+
+Result benchDisneyPdf(const DisneyInputs& in) {
+  int n = int(in.N.size());
+  std::vector<DisneyParams> params = in.params;
+  std::vector<float3> N = in.N, L = in.L, V = in.V, H = in.H;
+  std::vector<float> out(n);
+  double scalarNs = nsPerCall([&] {
+    float sum = 0.f;
+    for (int i = 0; i < n; ++i) {
+      sum += disneyPdf(params[i], N[i], L[i], V[i], H[i]);
+    }
+    sink = sum;
+  }, n);
+  double batchNs = nsPerCall([&] {
+    for (int i = 0; i < n; ++i) {
+      out[i] = disneyPdf(params[i], N[i], L[i], V[i], H[i]);
+    }
+    sink = out[n / 2];
+  }, n);
+  ErrorStats error;
+  for (int i = 0; i < n; ++i) {
+    const DisneyParams& p = params[i];
+    double diffuseRatio = 0.5 * (1.0 - p.metallic);
+    double cosTheta = fabs(dotRef(toDouble(N[i]), toDouble(H[i])));
+    double pdfH = lerpRef(gtr1Ref(cosTheta, lerpRef(0.1, 0.001, p.clearcoatGloss)) * cosTheta,
+                          gtr2Ref(cosTheta, std::max(0.001, double(p.roughness))) * cosTheta,
+                          1.0 / (1.0 + p.clearcoat));
+    double pdfL = pdfH / (4.0 * fabs(dotRef(toDouble(L[i]), toDouble(H[i]))));
+    double pdfDiff = fabs(dotRef(toDouble(N[i]), toDouble(L[i]))) / kPi;
+    error.add(out[i], diffuseRatio * pdfDiff + (1.0 - diffuseRatio) * pdfL);
+  }
+  return finish("disneyPdf", scalarNs, batchNs, "relative to double", error);
+}
+
+Result benchDisneyEval(const DisneyInputs& in) {
+  int n = int(in.N.size());
+  std::vector<DisneyParams> params = in.params;
+  std::vector<float3> baseColor = in.baseColor, N = in.N, L = in.L, V = in.V, H = in.H;
+  std::vector<float3> out(n);
+  double scalarNs = nsPerCall([&] {
+    float sum = 0.f;
+    for (int i = 0; i < n; ++i) {
+      float3 f = disneyEval(params[i], baseColor[i], N[i], L[i], V[i], H[i]);
+      sum += f.x + f.y + f.z;
+    }
+    sink = sum;
+  }, n);
+  double batchNs = nsPerCall([&] {
+    for (int i = 0; i < n; ++i) {
+      out[i] = disneyEval(params[i], baseColor[i], N[i], L[i], V[i], H[i]);
+    }
+    sink = out[n / 2].x;
+  }, n);
+  ErrorStats error;
+  for (int i = 0; i < n; ++i) {
+    Onb onb(N[i]);
+    float3 X = normalize(onb.m_tangent);
+    float3 Y = normalize(cross(N[i], X));
+    Double3 ref = disneyEvalRef(params[i], baseColor[i], N[i], L[i], V[i], H[i], X, Y);
+    error.add(out[i].x, ref.x);
+    error.add(out[i].y, ref.y);
+    error.add(out[i].z, ref.z);
+  }
+  return finish("disneyEval", scalarNs, batchNs, "relative to double", error);
+}
+
+}
+
+void runMathBenchmark(const std::string& fileName, int nCalls) {
+  std::mt19937 rng(5);
+  int n = nCalls;
+  std::vector<Result> results;
+  results.push_back(benchTea(n, rng));
+  results.push_back(benchRand(n, rng));
+
+  {
+    // refraction into glass, cosThetaT from Snell's law
+    std::vector<float> cosI = uniform(rng, n, 0.f, 1.f);
+    std::vector<float> refIdx = uniform(rng, n, 1.f, 2.5f);
+    std::vector<float> cosT(n);
+    for (int i = 0; i < n; ++i) {
+      double sinT = sqrt(1.0 - double(cosI[i]) * cosI[i]) / refIdx[i];
+      cosT[i] = float(sqrt(1.0 - sinT * sinT));
+    }
+    results.push_back(benchFunction("fresnel", { cosI, cosT, refIdx },
+      [](const float* const* in, int i) { return fresnel(in[0][i], in[1][i], in[2][i]); },
+      [](const float* const* in, int i) { return fresnelRef(in[0][i], in[1][i], in[2][i]); }));
+  }
+  std::vector<float> cosine = uniform(rng, n, 0.f, 1.f);
+  std::vector<float> alpha = uniform(rng, n, 0.001f, 1.f);
+  results.push_back(benchFunction("GTR1", { cosine, alpha },
+    [](const float* const* in, int i) { return GTR1(in[0][i], in[1][i]); },
+    [](const float* const* in, int i) { return gtr1Ref(in[0][i], in[1][i]); }));
+  results.push_back(benchFunction("GTR2", { cosine, alpha },
+    [](const float* const* in, int i) { return GTR2(in[0][i], in[1][i]); },
+    [](const float* const* in, int i) { return gtr2Ref(in[0][i], in[1][i]); }));
+  results.push_back(benchFunction("schlickFresnel", { cosine },
+    [](const float* const* in, int i) { return schlickFresnel(in[0][i]); },
+    [](const float* const* in, int i) { return schlickRef(in[0][i]); }));
+  results.push_back(benchFunction("smithGGgx", { cosine, alpha },
+    [](const float* const* in, int i) { return smithGGgx(in[0][i], in[1][i]); },
+    [](const float* const* in, int i) { return smithRef(in[0][i], in[1][i]); }));
+  {
+    // unit half vectors and view directions in the tangent frame
+    std::vector<float> x, y, z;
+    hemisphere(rng, n, 0.01f, x, y, z);
+    std::vector<float> alphaY = uniform(rng, n, 0.001f, 1.f);
+    results.push_back(benchFunction("GTR2Aniso", { z, x, y, alpha, alphaY },
+      [](const float* const* in, int i) { return GTR2Aniso(in[0][i], in[1][i], in[2][i], in[3][i], in[4][i]); },
+      [](const float* const* in, int i) { return gtr2AnisoRef(in[0][i], in[1][i], in[2][i], in[3][i], in[4][i]); }));
+    results.push_back(benchFunction("smithGGgxAniso", { z, x, y, alpha, alphaY },
+      [](const float* const* in, int i) { return smithGGgxAniso(in[0][i], in[1][i], in[2][i], in[3][i], in[4][i]); },
+      [](const float* const* in, int i) { return smithAnisoRef(in[0][i], in[1][i], in[2][i], in[3][i], in[4][i]); }));
+  }
+  results.push_back(benchRefineHitpoint(n, rng));
+  DisneyInputs disney = disneyInputs(n, rng);
+  results.push_back(benchDisneySample(disney, rng));
+  results.push_back(benchDisneyPdf(disney));
+  results.push_back(benchDisneyEval(disney));
+
+  printf("%d calls each, best of %d runs\n", n, kRepeats);
+  printf("%-16s %10s %10s  %-24s %12s %12s\n", "function", "scalar ns", "batch ns", "error", "max", "mean");
+  QJsonArray functions;
+  for (auto& r : results) {
+    printf("%-16s %10.2f %10.2f  %-24s %12.3g %12.3g\n", r.name.c_str(), r.scalarNs, r.batchNs, r.metric.c_str(), r.maxError, r.meanError);
+    QJsonObject function;
+    function["name"] = QString::fromStdString(r.name);
+    function["scalarNs"] = r.scalarNs;
+    function["batchNs"] = r.batchNs;
+    function["errorMetric"] = QString::fromStdString(r.metric);
+    function["maxError"] = r.maxError;
+    function["meanError"] = r.meanError;
+    functions.append(function);
+  }
+  if (fileName.empty()) {
+    return;
+  }
+  QJsonObject json;
+  json["calls"] = n;
+  json["repeats"] = kRepeats;
+  json["functions"] = functions;
+  writeJson(fileName, json);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+// Times the shading math of utils_device.h and disney.h on the host and
+// checks it against double precision versions, so it can be tuned without a
+// GPU. Every function is timed in two forms over the same inputs: scalar,
+// one call at a time with the results folded into a running sum, and batch,
+// independent arrays in and out that the compiler is free to vectorize.
+// Prints a table and writes it to fileName as JSON unless that is empty.
+void runMathBenchmark(const std::string& fileName, int nCalls = 1 << 18);
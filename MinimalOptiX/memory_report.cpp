@@ -0,0 +1,117 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <cstdio>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#include "memory_report.h"
+
+namespace {
+
+const char* kCategoryNames[MEMORY_CATEGORY_COUNT] = {
+  "geometry", "indices", "textures", "framebuffers", "lights", "other"
+};
+
+}
+
+void MemoryReport::set(MemoryCategory category, const std::string& name, size_t bytes) {
+  entries[category][name] = bytes;
+}
+
+void MemoryReport::add(MemoryCategory category, const std::string& name, size_t bytes) {
+  entries[category][name] += bytes;
+}
+
+void MemoryReport::clear(MemoryCategory category) {
+  entries[category].clear();
+}
+
+size_t MemoryReport::total() const {
+  size_t sum = 0;
+  for (auto& category : entries) {
+    for (auto& entry : category) {
+      sum += entry.second;
+    }
+  }
+  return sum;
+}
+
+QJsonObject MemoryReport::toJson() const {
+  // sizes go out as doubles like the ray counters
+  QJsonObject device;
+  for (int c = 0; c < MEMORY_CATEGORY_COUNT; ++c) {
+    QJsonObject byName;
+    size_t sum = 0;
+    for (auto& entry : entries[c]) {
+      byName[QString::fromStdString(entry.first)] = double(entry.second);
+      sum += entry.second;
+    }
+    QJsonObject category;
+    category["bytes"] = double(sum);
+    category["byName"] = byName;
+    device[kCategoryNames[c]] = category;
+  }
+  size_t tracked = total();
+  device["trackedBytes"] = double(tracked);
+  device["firstLaunchBytes"] = double(firstLaunchDeviceBytes);
+  // acceleration structures, stacks and whatever else OptiX allocates itself
+  device["untrackedBytes"] = firstLaunchDeviceBytes > tracked ? double(firstLaunchDeviceBytes - tracked) : 0.0;
+
+  QJsonObject host;
+  host["sceneAssetBytes"] = double(sceneAssetBytes);
+  host["peakAfterLoadBytes"] = double(hostPeakBytes);
+  host["peakBytes"] = double(processPeakBytes());
+  host["currentBytes"] = double(processCurrentBytes());
+
+  QJsonObject json;
+  json["device"] = device;
+  json["host"] = host;
+  return json;
+}
+
+size_t bufferBytes(optix::Buffer buffer) {
+  RTsize dims[3] = { 1, 1, 1 };
+  buffer->getSize(buffer->getDimensionality(), dims);
+  return buffer->getElementSize() * dims[0] * dims[1] * dims[2];
+}
+
+size_t processCurrentBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.WorkingSetSize;
+#else
+  long pages = 0;
+  FILE* file = fopen("/proc/self/statm", "r");
+  if (!file) {
+    return 0;
+  }
+  if (fscanf(file, "%*s %ld", &pages) != 1) {
+    pages = 0;
+  }
+  fclose(file);
+  return size_t(pages) * size_t(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+size_t processPeakBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return size_t(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+}
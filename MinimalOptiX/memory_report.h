@@ -0,0 +1,45 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <optix_world.h>
+#include <QJsonObject>
+
+enum MemoryCategory {
+  MEMORY_GEOMETRY, // vertices, normals, texcoords and material tables
+  MEMORY_INDICES,
+  MEMORY_TEXTURES,
+  MEMORY_FRAMEBUFFERS, // accumulation, AOVs and other per-pixel state
+  MEMORY_LIGHTS, // light list and environment map
+  MEMORY_OTHER, // guiding, photons, counters
+  MEMORY_CATEGORY_COUNT
+};
+
+// Device buffers by category and by mesh, texture or variable name, plus
+// what loading costs on the host. OptiX does not expose the size of the
+// acceleration structures, so those are estimated from the drop in free
+// device memory over the first launch of a scene, camera or photon, which
+// uploads every buffer and builds the BVHs.
+class MemoryReport {
+public:
+  // replaces the entry, for buffers that are reallocated or resized
+  void set(MemoryCategory category, const std::string& name, size_t bytes);
+  // sums into the entry, for meshes made of several shapes
+  void add(MemoryCategory category, const std::string& name, size_t bytes);
+  void clear(MemoryCategory category);
+  size_t total() const;
+  QJsonObject toJson() const;
+
+  size_t firstLaunchDeviceBytes = 0; // free device memory lost over the first launch
+  size_t sceneAssetBytes = 0; // parsed meshes and textures, SceneAssets::bytes()
+  size_t hostPeakBytes = 0; // process peak right after the scene was uploaded
+
+private:
+  std::map<std::string, size_t> entries[MEMORY_CATEGORY_COUNT];
+};
+
+// element size times every dimension
+size_t bufferBytes(optix::Buffer buffer);
+// resident set of this process now and at its peak, 0 where unsupported
+size_t processCurrentBytes();
+size_t processPeakBytes();
@@ -1,12 +1,39 @@
-#include "Structures.h"
+#include "structures.h"
 #include <optix_world.h>
+#include "utils_device.h"
+#include "environment.h"
+#include "ray_stats.h"
 
 using namespace optix;
 
 rtDeclareVariable(float3, bgColor, , );
 rtDeclareVariable(Ray, ray, rtCurrentRay, );
 rtDeclareVariable(Payload, pld, rtPayload, );
+rtDeclareVariable(uint2, launchIdx, rtLaunchIndex, );
+rtBuffer<float3, 2> albedoAovBuffer;
+rtBuffer<float4, 2> gBuffer;
 
 RT_PROGRAM void staticMiss() {
+  RAY_STAT_PATH_END(RAY_STAT_END_MISS, pld.depth);
+  if (pld.depth == 1) {
+    albedoAovBuffer[launchIdx] += bgColor;
+    gBuffer[launchIdx] = make_float4(0.f, 0.f, 0.f, -2.f); // kMissObjectId
+  }
   pld.color *= bgColor;
 }
+
+// HDR environment, weighted against its light samples when the ray came
+// from a BSDF that also did next-event estimation
+RT_PROGRAM void envMiss() {
+  RAY_STAT_PATH_END(RAY_STAT_END_MISS, pld.depth);
+  float3 color = envLookup(ray.direction);
+  if (pld.depth == 1) {
+    albedoAovBuffer[launchIdx] += color;
+    gBuffer[launchIdx] = make_float4(0.f, 0.f, 0.f, -2.f); // kMissObjectId
+  }
+  float weight = 1.f;
+  if (pld.bsdfPdf > 0.f) {
+    weight = powerHeuristic(pld.bsdfPdf, envPdf(ray.direction));
+  }
+  pld.color *= color * weight;
+}
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cmath>
+#include "path_guide.h"
+#include "guiding.h"
+
+using namespace optix;
+
+namespace {
+
+struct HostCdf {
+  const float* row;
+  float operator()(int i) const { return row[i]; }
+};
+
+}
+
+PathGuide::PathGuide(const Aabb& bounds, int resolution) {
+  // slightly padded cube cells, hits on the bounds still land inside
+  float3 extent = bounds.extent() * 1.001f + make_float3(1e-4f);
+  params.origin = bounds.center() - 0.5f * extent;
+  params.invCellSize = make_float3(float(resolution)) / extent;
+  params.resolution = resolution;
+  params.enabled = 1;
+  params.training = 1;
+  cdf.resize(nCells() * (GUIDE_BINS + 1));
+  cellFraction.assign(nCells(), 0.f);
+  for (size_t c = 0; c < nCells(); ++c) {
+    for (int i = 0; i <= GUIDE_BINS; ++i) {
+      cdf[c * (GUIDE_BINS + 1) + i] = float(i) / GUIDE_BINS;
+    }
+  }
+}
+
+size_t PathGuide::nCells() const {
+  return size_t(params.resolution) * params.resolution * params.resolution;
+}
+
+void PathGuide::build(const float* accum, float guideFraction, float uniformWeight) {
+  int trained = 0;
+  #pragma omp parallel for schedule(dynamic, 64) reduction(+:trained)
+  for (int c = 0; c < int(nCells()); ++c) {
+    const float* bins = accum + size_t(c) * GUIDE_BINS;
+    float* row = &cdf[size_t(c) * (GUIDE_BINS + 1)];
+    double total = 0.0;
+    for (int i = 0; i < GUIDE_BINS; ++i) {
+      total += bins[i];
+    }
+    if (!(total > 0.0)) {
+      cellFraction[c] = 0.f;
+      continue;
+    }
+    double sum = 0.0;
+    row[0] = 0.f;
+    for (int i = 0; i < GUIDE_BINS; ++i) {
+      sum += (1.f - uniformWeight) * bins[i] / total + uniformWeight / GUIDE_BINS;
+      row[i + 1] = float(sum);
+    }
+    row[GUIDE_BINS] = 1.f;
+    cellFraction[c] = guideFraction;
+    ++trained;
+  }
+  trainedCells = trained;
+}
+
+float3 PathGuide::sample(int cell, float u0, float u1, float u2) const {
+  HostCdf row = { &cdf[size_t(cell) * (GUIDE_BINS + 1)] };
+  return sampleGuide(row, u0, u1, u2);
+}
+
+float PathGuide::pdf(int cell, const float3& d) const {
+  HostCdf row = { &cdf[size_t(cell) * (GUIDE_BINS + 1)] };
+  return guidePdf(row, d);
+}
+
+float PathGuide::normalizationError() const {
+  // 4 x 4 strata per bin put every sample well inside its bin
+  const int n = GUIDE_DIR_RES * 4;
+  float maxError = 0.f;
+  for (int c = 0; c < int(nCells()); ++c) {
+    if (cellFraction[c] == 0.f) {
+      continue;
+    }
+    double integral = 0.0;
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < n; ++j) {
+        float z = -1.f + 2.f * (i + 0.5f) / n;
+        float phi = 2.f * M_PIf * (j + 0.5f) / n;
+        float r = sqrtf(1.f - z * z);
+        integral += pdf(c, make_float3(r * cosf(phi), z, r * sinf(phi)));
+      }
+    }
+    integral *= 4.0 * M_PIf / (n * n);
+    maxError = std::max(maxError, float(fabs(1.0 - integral)));
+  }
+  return maxError;
+}
+
+float PathGuide::samplingError(int samplesPerBin) const {
+  const int n = GUIDE_BINS * samplesPerBin;
+  std::vector<float> cellError(nCells(), 0.f);
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int c = 0; c < int(nCells()); ++c) {
+    if (cellFraction[c] == 0.f) {
+      continue;
+    }
+    std::vector<int> counts(GUIDE_BINS, 0);
+    for (int k = 0; k < n; ++k) {
+      // u0 stratified over the cdf, u1 and u2 spread over the bin
+      float u0 = (k + 0.5f) / n;
+      float u1 = fmodf(k * 0.618034f, 1.f);
+      float u2 = fmodf(k * 0.754878f, 1.f);
+      ++counts[guideBin(sample(c, u0, u1, u2))];
+    }
+    float error = 0.f;
+    for (int b = 0; b < GUIDE_BINS; ++b) {
+      float z = -1.f + 2.f * (b / GUIDE_DIR_RES + 0.5f) / GUIDE_DIR_RES;
+      float phi = 2.f * M_PIf * (b % GUIDE_DIR_RES + 0.5f) / GUIDE_DIR_RES;
+      float r = sqrtf(1.f - z * z);
+      float probability = pdf(c, make_float3(r * cosf(phi), z, r * sinf(phi))) * GUIDE_BIN_SOLID_ANGLE;
+      error = std::max(error, fabsf(float(counts[b]) / n - probability));
+    }
+    cellError[c] = error;
+  }
+  return cellError.empty() ? 0.f : *std::max_element(cellError.begin(), cellError.end());
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <optix_world.h>
+#include <vector>
+#include "structures.h"
+
+// Host side of path guiding: a uniform grid over the scene with one
+// directional histogram of incident radiance per cell (guiding.h). The
+// device accumulates radiance / pdf into the histograms while training and
+// build() turns them into per-cell CDFs between progressive passes.
+class PathGuide {
+public:
+  PathGuide(const optix::Aabb& bounds, int resolution);
+  size_t nCells() const;
+
+  // Rebuilds every cell's CDF from the accumulated histograms. Cells that
+  // received no energy keep a guide fraction of 0, the rest mix in
+  // uniformWeight of a uniform distribution so no direction gets a zero
+  // guided pdf.
+  void build(const float* accum, float guideFraction, float uniformWeight);
+
+  // CPU reference of the device sampler, used to check the tables
+  optix::float3 sample(int cell, float u0, float u1, float u2) const;
+  float pdf(int cell, const optix::float3& d) const;
+  // largest |1 - integral of the pdf| over trained cells, by stratified quadrature
+  float normalizationError() const;
+  // largest difference over trained cells and bins between the fraction of
+  // sample() directions landing in a bin and that bin's pdf() probability,
+  // from GUIDE_BINS * samplesPerBin stratified draws per cell
+  float samplingError(int samplesPerBin = 4) const;
+
+  GuideParams params;
+  std::vector<float> cdf; // GUIDE_BINS + 1 entries per cell
+  std::vector<float> cellFraction; // probability of guided sampling per cell
+  int trainedCells = 0;
+};
@@ -0,0 +1,64 @@
+#include <optix_world.h>
+#include "structures.h"
+#include "utils_device.h"
+#include "ray_stats.h"
+#include "exception_log.h"
+
+using namespace optix;
+
+rtDeclareVariable(rtObject, topGroup, , );
+rtDeclareVariable(uint, sampleIndex, , );
+rtDeclareVariable(uint, frameIndex, , );
+rtDeclareVariable(uint, rayTypePhoton, , );
+rtDeclareVariable(uint, launchIdx, rtLaunchIndex, );
+rtDeclareVariable(uint, launchDim, rtLaunchDim, );
+rtDeclareVariable(float, rayEpsilonT, , );
+
+rtBuffer<LightParams> lights;
+rtBuffer<PhotonRecord> photonBuffer;
+
+// One photon per launch index, leaving a uniformly chosen light from a
+// uniform point on its surface in a cosine distributed direction. Quads
+// only emit on the side their normal points to, like next-event estimation
+// assumes. The material programs store it at the first diffuse hit after
+// at least one specular bounce.
+RT_PROGRAM void photonEmit() {
+  photonBuffer[launchIdx].power = make_float3(0.f);
+  uint nLights = lights.size();
+  if (nLights == 0) {
+    return;
+  }
+  int seed = tea<16>(launchIdx, tea<4>(sampleIndex, 0x70686fu + frameIndex));
+  uint lightIdx = min(uint(rand(seed) * nLights), nLights - 1);
+  LightParams light = lights[lightIdx];
+
+  float3 position, normal;
+  if (light.shape == SPHERE) {
+    normal = normalize(randInUnitSphere(seed));
+    position = light.position + light.radius * normal;
+  } else {
+    normal = light.normal;
+    position = light.position + rand(seed) * light.u + rand(seed) * light.v;
+  }
+  float3 local;
+  cosine_sample_hemisphere(rand(seed), rand(seed), local);
+  Onb onb(normal);
+  onb.inverse_transform(local);
+
+  PhotonPayload photon;
+  // flux of the light over the photons that are expected to leave it
+  photon.power = light.emission * light.area * M_PIf * float(nLights) / float(launchDim);
+  photon.depth = 1;
+  photon.randSeed = seed;
+  photon.slot = launchIdx;
+  photon.specularBounces = 0;
+  Ray ray(position, local, rayTypePhoton, rayEpsilonT);
+  RAY_STAT(RAY_STAT_PHOTON_RAYS);
+  rtTrace(topGroup, ray, photon);
+}
+
+// a photon that hit a stack or numeric limit is lost and logged
+RT_PROGRAM void photonException() {
+  photonBuffer[launchIdx].power = make_float3(0.f);
+  logException(make_uint2(launchIdx, 0u));
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <optix_world.h>
+#include "structures.h"
+
+// Spatial hash of the caustic photon map, shared by the gather in the
+// material programs and PhotonGrid on the host. Cells are cubes of twice
+// the gather radius, so a gather sphere overlaps at most 2x2x2 cells, and
+// cells are hashed into a power of two table. Different cells can share a
+// bucket; the gather rejects photons by distance anyway.
+
+RT_HOSTDEVICE inline int photonCellCoord(float v, float cellSize) {
+  return int(floorf(v / cellSize));
+}
+
+RT_HOSTDEVICE inline unsigned int photonCellHash(int x, int y, int z, unsigned int tableMask) {
+  return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^ (unsigned int)z * 83492791u) & tableMask;
+}
+
+RT_HOSTDEVICE inline unsigned int photonCellHash(const optix::float3& p, float cellSize, unsigned int tableMask) {
+  return photonCellHash(photonCellCoord(p.x, cellSize), photonCellCoord(p.y, cellSize), photonCellCoord(p.z, cellSize), tableMask);
+}
@@ -0,0 +1,73 @@
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "photon_map.h"
+#include "photon_grid.h"
+
+using namespace optix;
+
+namespace {
+
+const unsigned int kEmptySlot = ~0u;
+
+}
+
+void PhotonMap::build(const PhotonRecord* records, size_t nRecords, float gatherRadius) {
+  radius = gatherRadius;
+  cellSize = 2.f * gatherRadius;
+  unsigned int tableSize = 1u;
+  while (tableSize < nRecords) {
+    tableSize <<= 1;
+  }
+  tableMask = tableSize - 1u;
+
+  // each chunk of records counts into its own histogram, so the sort needs
+  // no atomics and keeps the records' order within a bucket
+  int nChunks = 1;
+#ifdef _OPENMP
+  nChunks = omp_get_max_threads();
+#endif
+  size_t chunkSize = (nRecords + nChunks - 1) / nChunks;
+  std::vector<unsigned int> buckets(nRecords);
+  std::vector<unsigned int> offsets(size_t(nChunks) * tableSize, 0u);
+  #pragma omp parallel for
+  for (int c = 0; c < nChunks; ++c) {
+    unsigned int* counts = &offsets[size_t(c) * tableSize];
+    size_t end = std::min(nRecords, (c + 1) * chunkSize);
+    for (size_t i = c * chunkSize; i < end; ++i) {
+      const PhotonRecord& record = records[i];
+      if (record.power.x + record.power.y + record.power.z <= 0.f) {
+        buckets[i] = kEmptySlot;
+        continue;
+      }
+      buckets[i] = photonCellHash(record.position, cellSize, tableMask);
+      ++counts[buckets[i]];
+    }
+  }
+
+  // bucket-major prefix sum turns the counts into each chunk's first slot
+  cellStart.resize(tableSize + 1);
+  unsigned int total = 0u;
+  for (unsigned int b = 0; b < tableSize; ++b) {
+    cellStart[b] = total;
+    for (int c = 0; c < nChunks; ++c) {
+      unsigned int count = offsets[size_t(c) * tableSize + b];
+      offsets[size_t(c) * tableSize + b] = total;
+      total += count;
+    }
+  }
+  cellStart[tableSize] = total;
+
+  photons.resize(total);
+  #pragma omp parallel for
+  for (int c = 0; c < nChunks; ++c) {
+    unsigned int* next = &offsets[size_t(c) * tableSize];
+    size_t end = std::min(nRecords, (c + 1) * chunkSize);
+    for (size_t i = c * chunkSize; i < end; ++i) {
+      if (buckets[i] != kEmptySlot) {
+        photons[next[buckets[i]]++] = records[i];
+      }
+    }
+  }
+}
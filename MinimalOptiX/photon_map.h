@@ -0,0 +1,20 @@
+#pragma once
+
+#include <optix_world.h>
+#include <vector>
+#include "structures.h"
+
+// Host side of the caustic photon map. Every progressive pass traces a new
+// set of photons on the device; build() drops the slots that stored
+// nothing and counting-sorts the rest by hash bucket (photon_grid.h), so
+// the gather walks one contiguous range per cell.
+class PhotonMap {
+public:
+  void build(const PhotonRecord* records, size_t nRecords, float gatherRadius);
+
+  float radius = 0.f;
+  float cellSize = 0.f;
+  unsigned int tableMask = 0u;
+  std::vector<unsigned int> cellStart; // tableMask + 2 entries, bucket b is [cellStart[b], cellStart[b + 1])
+  std::vector<PhotonRecord> photons;
+};
@@ -0,0 +1,107 @@
+#include "preloader.h"
+#include "trace.h"
+
+ScenePreloader::ScenePreloader(size_t budgetBytes)
+  : budgetBytes(budgetBytes), worker(&ScenePreloader::work, this) {}
+
+ScenePreloader::~ScenePreloader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  worker.join();
+}
+
+void ScenePreloader::enqueue(const std::string& sceneFolder, const std::string& sceneName) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& entry : entries) {
+      if (entry.name == sceneName && entry.folder == sceneFolder) {
+        ++entry.uses;
+        return;
+      }
+    }
+    Entry entry;
+    entry.folder = sceneFolder;
+    entry.name = sceneName;
+    entries.push_back(entry);
+  }
+  cv.notify_all();
+}
+
+std::shared_ptr<SceneAssets> ScenePreloader::take(const std::string& sceneName) {
+  std::unique_lock<std::mutex> lock(mutex);
+  auto it = entries.begin();
+  for (; it != entries.end(); ++it) {
+    if (it->name == sceneName) {
+      break;
+    }
+  }
+  if (it == entries.end()) {
+    return nullptr;
+  }
+  if (!it->done) {
+    it->wanted = true;
+    cv.notify_all();
+    cv.wait(lock, [&] { return it->done; });
+  }
+  std::shared_ptr<SceneAssets> assets = it->assets;
+  std::exception_ptr error = it->error;
+  if (--it->uses == 0) {
+    if (assets) {
+      readyBytes -= assets->bytes();
+    }
+    entries.erase(it);
+  }
+  lock.unlock();
+  cv.notify_all();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return assets;
+}
+
+void ScenePreloader::work() {
+  traceThreadName("preloader");
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    Entry* next = nullptr;
+    cv.wait(lock, [&] {
+      if (stopping) {
+        return true;
+      }
+      for (auto& entry : entries) {
+        if (!entry.done && (readyBytes < budgetBytes || entry.wanted)) {
+          next = &entry;
+          return true;
+        }
+      }
+      return false;
+    });
+    if (stopping) {
+      return;
+    }
+
+    // list nodes stay valid while unlocked, take() waits for done
+    std::string folder = next->folder;
+    std::string name = next->name;
+    lock.unlock();
+    std::shared_ptr<SceneAssets> assets;
+    std::exception_ptr error;
+    try {
+      TraceSpan span("preload", name);
+      assets = std::make_shared<SceneAssets>(folder, name);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    next->assets = assets;
+    next->error = error;
+    next->done = true;
+    if (assets) {
+      readyBytes += assets->bytes();
+    }
+    cv.notify_all();
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "scene.h"
+
+// Loads SceneAssets on a background thread in the order they are enqueued.
+// Loading of the next scene only starts while the already prepared scenes
+// stay under the memory budget, so at most one scene can exceed it. A scene
+// that take() is waiting for is loaded regardless of the budget.
+class ScenePreloader {
+public:
+  ScenePreloader(size_t budgetBytes = size_t(4) << 30);
+  ~ScenePreloader();
+
+  // Enqueuing a scene that is still queued adds a use instead of a second
+  // load, its assets are kept until every use is taken.
+  void enqueue(const std::string& sceneFolder, const std::string& sceneName);
+  // Blocks until the scene is ready. Returns nullptr if it was never enqueued.
+  std::shared_ptr<SceneAssets> take(const std::string& sceneName);
+
+  size_t budgetBytes;
+
+private:
+  struct Entry {
+    std::string folder;
+    std::string name;
+    std::shared_ptr<SceneAssets> assets;
+    std::exception_ptr error;
+    bool done = false;
+    bool wanted = false; // take() is waiting for it
+    int uses = 1;
+  };
+
+  void work();
+
+  std::list<Entry> entries; // pending and ready, in enqueue order
+  size_t readyBytes = 0;
+  bool stopping = false;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::thread worker;
+};
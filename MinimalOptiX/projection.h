@@ -0,0 +1,25 @@
+#pragma once
+
+#include <optix_world.h>
+#include "structures.h"
+
+// Pixel of camParams' image plane that sees p, false if p is behind the lens
+// or off screen. Mirrors the ray setup in camera.cu without the lens jitter.
+RT_HOSTDEVICE inline bool projectToPixel(const CamParams& camParams, const optix::float3& p, int width, int height, int& px, int& py) {
+  optix::float3 n = optix::cross(camParams.horizontal, camParams.vertical);
+  optix::float3 d = p - camParams.origin;
+  float dn = optix::dot(d, n);
+  if (fabsf(dn) < 1e-12f) {
+    return false;
+  }
+  float s = optix::dot(camParams.scrLowerLeftCorner - camParams.origin, n) / dn;
+  if (s <= 0.f) {
+    return false;
+  }
+  optix::float3 q = camParams.origin + s * d - camParams.scrLowerLeftCorner;
+  float x = optix::dot(q, camParams.horizontal) / optix::dot(camParams.horizontal, camParams.horizontal);
+  float y = optix::dot(q, camParams.vertical) / optix::dot(camParams.vertical, camParams.vertical);
+  px = int(floorf(x * width + 0.5f));
+  py = int(floorf(y * height + 0.5f));
+  return px >= 0 && px < width && py >= 0 && py < height;
+}
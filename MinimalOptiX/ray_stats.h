@@ -0,0 +1,77 @@
+#pragma once
+
+// Ray and path counters for --ray-stats and the per-pixel cost of
+// --heatmap. The counting code only exists when the programs are compiled
+// with -DRAY_STATS or -DCOST_HEATMAP, otherwise the macros below expand to
+// nothing. Counters are striped over the launch index so a warp does not
+// serialize on a single address; the host sums the stripes after every
+// launch and clears them.
+
+enum RayStatCounter {
+  RAY_STAT_RADIANCE_RAYS,
+  RAY_STAT_SHADOW_RAYS,
+  RAY_STAT_PHOTON_RAYS,
+  RAY_STAT_PATHS, // camera samples traced
+  // why a camera path ended
+  RAY_STAT_END_MAX_DEPTH,
+  RAY_STAT_END_MIN_INTENSITY,
+  RAY_STAT_END_MISS,
+  RAY_STAT_END_LIGHT,
+  RAY_STAT_END_ABSORBED, // the BSDF sample went below the surface
+  RAY_STAT_DEPTH_HISTOGRAM // first of RAY_STATS_DEPTH_BINS, by depth at the end
+};
+
+#define RAY_STATS_DEPTH_BINS 32
+#define RAY_STAT_COUNT (RAY_STAT_DEPTH_HISTOGRAM + RAY_STATS_DEPTH_BINS)
+#define RAY_STATS_STRIPES 64
+
+#if defined(RAY_STATS) || defined(COST_HEATMAP)
+
+rtDeclareVariable(optix::uint2, rayStatsLaunchIdx, rtLaunchIndex, );
+#ifdef RAY_STATS
+rtBuffer<unsigned int> rayStats;
+#endif
+#ifdef COST_HEATMAP
+// per-pixel sums of radiance rays, shadow rays, kilocycles spent tracing
+// and camera paths, see heatmap.h
+rtBuffer<optix::float4, 2> costBuffer;
+#endif
+
+__device__ __inline__ void rayStat(int counter) {
+#ifdef RAY_STATS
+  atomicAdd(&rayStats[(rayStatsLaunchIdx.x & (RAY_STATS_STRIPES - 1)) * RAY_STAT_COUNT + counter], 1u);
+#endif
+#ifdef COST_HEATMAP
+  // photons run in their own 1D launch and have no pixel
+  if (counter == RAY_STAT_RADIANCE_RAYS) {
+    costBuffer[rayStatsLaunchIdx].x += 1.f;
+  } else if (counter == RAY_STAT_SHADOW_RAYS) {
+    costBuffer[rayStatsLaunchIdx].y += 1.f;
+  } else if (counter == RAY_STAT_PATHS) {
+    costBuffer[rayStatsLaunchIdx].w += 1.f;
+  }
+#endif
+}
+
+__device__ __inline__ void rayStatPathEnd(int reason, int depth) {
+  rayStat(reason);
+  rayStat(RAY_STAT_DEPTH_HISTOGRAM + min(depth, RAY_STATS_DEPTH_BINS - 1));
+}
+
+#define RAY_STAT(counter) rayStat(counter)
+#define RAY_STAT_PATH_END(reason, depth) rayStatPathEnd(reason, depth)
+
+#else
+
+#define RAY_STAT(counter)
+#define RAY_STAT_PATH_END(reason, depth)
+
+#endif
+
+#ifdef COST_HEATMAP
+#define RAY_COST_TIMER_BEGIN() long long rayCostBegin = clock64()
+#define RAY_COST_TIMER_END() (costBuffer[rayStatsLaunchIdx].z += float(clock64() - rayCostBegin) * 1e-3f)
+#else
+#define RAY_COST_TIMER_BEGIN()
+#define RAY_COST_TIMER_END()
+#endif
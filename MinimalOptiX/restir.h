@@ -0,0 +1,114 @@
+#pragma once
+
+#include <optix_world.h>
+#include "structures.h"
+
+// Reservoir-based light resampling (Bitterli et al. 2020) shared by the
+// material programs and the host reference in utils_host.cpp. Candidates
+// are uniform points on uniformly chosen lights, resampled towards the
+// unshadowed contribution luminance(f * Le * G) at the shading point;
+// reservoirs of neighbouring pixels and the previous launch are merged by
+// re-weighting their selected point with this point's target.
+//
+// Lights is any container with size() and operator[] of LightParams, Rng a
+// functor returning uniform floats in [0, 1).
+
+RT_HOSTDEVICE inline void reservoirReset(Reservoir& r) {
+  r.lightIdx = -1;
+  r.wSum = 0.f;
+  r.M = 0.f;
+  r.W = 0.f;
+}
+
+// streams one candidate of weight w standing for M samples into r
+RT_HOSTDEVICE inline void reservoirUpdate(Reservoir& r, int lightIdx, const optix::float3& lightPoint, float w, float M, float u) {
+  r.wSum += w;
+  r.M += M;
+  if (w > 0.f && u * r.wSum < w) {
+    r.lightIdx = lightIdx;
+    r.lightPoint = lightPoint;
+  }
+}
+
+// uniform by area; spheres use their whole surface
+RT_HOSTDEVICE inline optix::float3 restirLightPoint(const LightParams& light, float u1, float u2) {
+  if (light.shape == SPHERE) {
+    float z = 1.f - 2.f * u1;
+    float r = sqrtf(fmaxf(0.f, 1.f - z * z));
+    float phi = 2.f * M_PIf * u2;
+    return light.position + light.radius * optix::make_float3(r * cosf(phi), r * sinf(phi), z);
+  }
+  return light.position + light.u * u1 + light.v * u2;
+}
+
+// geometry term cos(light) / dist^2 from p towards y, with the direction
+// and distance; 0 where y faces away from p
+RT_HOSTDEVICE inline float restirGeometry(const LightParams& light, const optix::float3& y, const optix::float3& p, optix::float3& L, float& dist) {
+  optix::float3 d = y - p;
+  dist = optix::length(d);
+  L = d / dist;
+  optix::float3 normal = light.shape == SPHERE ? (y - light.position) / light.radius : light.normal;
+  float cosLight = -optix::dot(L, normal);
+  return cosLight > 0.f ? cosLight / (dist * dist) : 0.f;
+}
+
+// unshadowed contribution of point y on light, measured by area
+template <typename Bsdf>
+RT_HOSTDEVICE inline float restirTarget(Bsdf& bsdf, const LightParams& light, const optix::float3& y, const optix::float3& p) {
+  optix::float3 L;
+  float dist;
+  float G = restirGeometry(light, y, p, L, dist);
+  if (G <= 0.f) {
+    return 0.f;
+  }
+  optix::float3 f = bsdf.eval(L) * light.emission * G;
+  return 0.2126f * f.x + 0.7152f * f.y + 0.0722f * f.z;
+}
+
+// reservoirs built for a surface too different from (p, N) are not reused
+RT_HOSTDEVICE inline bool restirSimilar(const Reservoir& r, const optix::float3& p, const optix::float3& N, float tolerance) {
+  return r.M > 0.f && optix::dot(r.hitNormal, N) > 0.9f && optix::length(r.hitPoint - p) < tolerance;
+}
+
+// Resamples nCandidates new light samples and the reusable neighbours into
+// one reservoir for (p, N). History weights are capped at maxM samples so
+// old reservoirs cannot dominate forever.
+template <typename Bsdf, typename Lights, typename Rng>
+RT_HOSTDEVICE inline Reservoir restirResample(
+  const optix::float3& p, const optix::float3& N, Bsdf& bsdf, const Lights& lights, int nCandidates,
+  const Reservoir* neighbours, int nNeighbours, float tolerance, float maxM, Rng& rng
+) {
+  Reservoir r;
+  reservoirReset(r);
+  r.hitPoint = p;
+  r.hitNormal = N;
+  int nLights = int(lights.size());
+  if (nLights == 0) {
+    return r;
+  }
+  for (int i = 0; i < nCandidates; ++i) {
+    int lightIdx = int(rng() * nLights);
+    lightIdx = lightIdx < nLights ? lightIdx : nLights - 1;
+    LightParams light = lights[lightIdx];
+    float u1 = rng();
+    float u2 = rng();
+    optix::float3 y = restirLightPoint(light, u1, u2);
+    // source pdf 1 / (nLights * area)
+    float w = restirTarget(bsdf, light, y, p) * light.area * nLights;
+    reservoirUpdate(r, lightIdx, y, w, 1.f, rng());
+  }
+  for (int k = 0; k < nNeighbours; ++k) {
+    const Reservoir& q = neighbours[k];
+    if (!restirSimilar(q, p, N, tolerance) || q.lightIdx < 0 || q.lightIdx >= nLights) {
+      continue;
+    }
+    float M = fminf(q.M, maxM);
+    float w = restirTarget(bsdf, lights[q.lightIdx], q.lightPoint, p) * q.W * M;
+    reservoirUpdate(r, q.lightIdx, q.lightPoint, w, M, rng());
+  }
+  if (r.lightIdx >= 0) {
+    float target = restirTarget(bsdf, lights[r.lightIdx], r.lightPoint, p);
+    r.W = target > 0.f ? r.wSum / (r.M * target) : 0.f;
+  }
+  return r;
+}
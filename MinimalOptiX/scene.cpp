@@ -1,8 +1,11 @@
+#define TINYOBJLOADER_IMPLEMENTATION
 #include "scene.h"
+#include "trace.h"
 
 static const int kMaxLineLength = 2048;
 
 Scene::Scene(const char* fileName) {
+  TraceSpan span("parse scene", fileName);
   FILE* file = fopen(fileName, "r");
 
   if (!file) {
@@ -122,3 +125,55 @@ Scene::Scene(const char* fileName) {
     }
   }
 }
+
+SceneAssets::SceneAssets(const std::string& sceneFolder, const std::string& sceneName)
+  : scene((sceneFolder + sceneName + ".scene").c_str()) {
+  meshes.resize(scene.meshNames.size());
+  for (int i = 0; i < scene.meshNames.size(); ++i) {
+    std::vector<tinyobj::material_t> materials;
+    std::string warn;
+    std::string err;
+    TraceSpan objSpan("LoadObj", scene.meshNames[i]);
+    bool ret = tinyobj::LoadObj(&meshes[i].attrib, &meshes[i].shapes, &materials, &warn, &err, (sceneFolder + scene.meshNames[i]).c_str());
+    if (!err.empty() || !ret) {
+      std::cerr << err << std::endl;
+      throw std::logic_error("Cannot load mesh file.");
+    }
+
+    if (scene.textures[i].empty() || textures.find(scene.textures[i]) != textures.end()) {
+      continue;
+    }
+    TraceSpan textureSpan("convert texture", scene.textures[i]);
+    QImage img((sceneFolder + scene.textures[i]).c_str());
+    TextureData& tex = textures[scene.textures[i]];
+    tex.width = img.width();
+    tex.height = img.height();
+    tex.rgba.resize(4 * size_t(img.width()) * img.height());
+    for (int x = 0; x < img.width(); ++x) {
+      for (int y = 0; y < img.height(); ++y) {
+        float* dst = tex.rgba.data() + 4 * (y * img.width() + x);
+        auto color = img.pixelColor(x, img.height() - y - 1);
+        dst[0] = color.redF();
+        dst[1] = color.greenF();
+        dst[2] = color.blueF();
+        dst[3] = 1.f;
+      }
+    }
+  }
+}
+
+size_t SceneAssets::bytes() const {
+  size_t total = 0;
+  for (auto& mesh : meshes) {
+    total += sizeof(tinyobj::real_t) * (mesh.attrib.vertices.size() + mesh.attrib.normals.size() + mesh.attrib.texcoords.size());
+    for (auto& shape : mesh.shapes) {
+      total += sizeof(tinyobj::index_t) * shape.mesh.indices.size();
+      total += sizeof(unsigned char) * shape.mesh.num_face_vertices.size();
+      total += sizeof(int) * shape.mesh.material_ids.size();
+    }
+  }
+  for (auto& tex : textures) {
+    total += sizeof(float) * tex.second.rgba.size();
+  }
+  return total;
+}
@@ -12,6 +12,7 @@
 
 #include "structures.h"
 #include "utils_host.h"
+#include "tiny_obj_loader.h"
 
 // Forked from https://github.com/knightcrawler25/Optix-PathTracer with modification
 
@@ -25,3 +26,25 @@ public:
   int width;
   int height;
 };
+
+struct MeshData {
+  tinyobj::attrib_t attrib;
+  std::vector<tinyobj::shape_t> shapes;
+};
+
+struct TextureData {
+  int width;
+  int height;
+  std::vector<float> rgba; // bottom-up rows, ready for a FLOAT4 buffer
+};
+
+// Everything setupScene(const char*) needs from disk, loaded without touching
+// the OptiX context so it can be prepared on a background thread.
+class SceneAssets {
+public:
+  SceneAssets(const std::string& sceneFolder, const std::string& sceneName);
+  size_t bytes() const;
+  Scene scene;
+  std::vector<MeshData> meshes;
+  std::map<std::string, TextureData> textures;
+};
@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <QColor>
+#include <QDir>
+#include <QImage>
+#include "scene_generator.h"
+#include "disk_hash.h"
+
+namespace {
+
+const size_t kTrianglesPerFile = size_t(1) << 20;
+const float kMaxRadius = 1.f;
+const float kMinRadius = 0.3f;
+
+struct Sphere {
+  float x, y, z, radius;
+};
+
+// Rings [ringBegin, ringEnd) of a UV sphere with 2 * rings segments, the
+// whole sphere has 4 * rings * (rings - 1) triangles. Pole rows are
+// included so the texture seam has its own vertices; a band repeats the
+// vertex row it shares with the next one, so it can go to its own file.
+void writeSphere(std::string& out, const Sphere& s, int rings, int ringBegin, int ringEnd, int& firstVertex) {
+  int segments = 2 * rings;
+  char line[128];
+  for (int j = ringBegin; j <= ringEnd; ++j) {
+    float theta = 3.14159265f * j / rings;
+    for (int k = 0; k <= segments; ++k) {
+      float phi = 2.f * 3.14159265f * k / segments;
+      float nx = sinf(theta) * cosf(phi);
+      float ny = cosf(theta);
+      float nz = -sinf(theta) * sinf(phi);
+      int n = snprintf(line, sizeof(line), "v %g %g %g\nvn %g %g %g\nvt %g %g\n",
+        s.x + s.radius * nx, s.y + s.radius * ny, s.z + s.radius * nz, nx, ny, nz, float(k) / segments, 1.f - float(j) / rings);
+      out.append(line, n);
+    }
+  }
+  auto vertex = [&](int j, int k) { return firstVertex + (j - ringBegin) * (segments + 1) + k; };
+  for (int j = ringBegin; j < ringEnd; ++j) {
+    for (int k = 0; k < segments; ++k) {
+      int a = vertex(j, k), b = vertex(j + 1, k), c = vertex(j + 1, k + 1), d = vertex(j, k + 1);
+      int n;
+      if (j != 0) {
+        n = snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, d, d, d);
+        out.append(line, n);
+      }
+      if (j != rings - 1) {
+        n = snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d\n", b, b, b, c, c, c, d, d, d);
+        out.append(line, n);
+      }
+    }
+  }
+  firstVertex += (ringEnd - ringBegin + 1) * (segments + 1);
+}
+
+// triangles writeSphere emits for rings [ringBegin, ringEnd)
+size_t bandTriangles(int rings, int ringBegin, int ringEnd) {
+  size_t triangles = 0;
+  for (int j = ringBegin; j < ringEnd; ++j) {
+    triangles += size_t(2 * rings) * ((j != 0) + (j != rings - 1));
+  }
+  return triangles;
+}
+
+void writeFile(const std::string& fileName, const std::string& content) {
+  FILE* file = fopen(fileName.c_str(), "wb");
+  if (!file) {
+    throw std::runtime_error("Cannot open " + fileName + " for writing.");
+  }
+  size_t written = fwrite(content.data(), 1, content.size(), file);
+  fclose(file);
+  if (written != content.size()) {
+    throw std::runtime_error("Cannot write " + fileName + ".");
+  }
+}
+
+// checkerboard tinted per texture with some value noise, so filtering and
+// cache behaviour look like a real albedo map
+void writeTexture(const std::string& fileName, int size, int index, std::mt19937& random) {
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  QColor tint = QColor::fromHsvF(uniform(random), 0.6, 0.9);
+  QImage image(size, size, QImage::Format_RGB888);
+  int checker = std::max(size / 16, 1);
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      float noise = 0.85f + 0.15f * float((x * 73856093u ^ y * 19349663u ^ index * 83492791u) % 1024u) / 1023.f;
+      float shade = ((x / checker + y / checker) % 2 ? 1.f : 0.35f) * noise;
+      image.setPixelColor(x, y, QColor::fromRgbF(tint.redF() * shade, tint.greenF() * shade, tint.blueF() * shade));
+    }
+  }
+  if (!image.save(QString::fromStdString(fileName))) {
+    throw std::runtime_error("Cannot write " + fileName + ".");
+  }
+}
+
+}
+
+size_t generateStressScene(const std::string& folder, const std::string& name, const StressSceneParams& params) {
+  if (!QDir().mkpath(QString::fromStdString(folder))) {
+    throw std::runtime_error("Cannot create " + folder + ".");
+  }
+  int nSpheres = int(std::max<size_t>(1, std::min<size_t>(params.spheres, params.triangles / 8)));
+  int nMaterials = std::max(params.materials, 1);
+  int nTextures = std::min(params.textures, nMaterials);
+  // 4 r (r - 1) triangles per sphere
+  size_t perSphere = params.triangles / nSpheres;
+  int rings = std::max(2, int(std::lround((1.0 + std::sqrt(1.0 + double(perSphere))) / 2.0)));
+  size_t sphereTriangles = size_t(4) * rings * (rings - 1);
+
+  // about 30% of the square covered, placement stays cheap
+  std::mt19937 random(params.seed);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  float side = std::sqrt(float(nSpheres)) * 2.5f * kMaxRadius;
+  DiskHash placed(2.f * kMaxRadius);
+  std::vector<std::vector<Sphere>> byMaterial(nMaterials);
+  for (int i = 0; i < nSpheres; ++i) {
+    float x, z, radius;
+    int attempts = 0;
+    do {
+      x = (uniform(random) - 0.5f) * side;
+      z = (uniform(random) - 0.5f) * side;
+      radius = std::min(kMinRadius + (kMaxRadius - kMinRadius) * uniform(random), placed.clearance(x, z, kMaxRadius));
+    } while (radius < kMinRadius && ++attempts < 1000);
+    if (radius < kMinRadius) {
+      break;
+    }
+    placed.insert(x, z, radius);
+    byMaterial[i % nMaterials].push_back({ x, radius, z, radius });
+  }
+
+  // One job per OBJ file, written in parallel. Small spheres are grouped
+  // into a file, spheres above the limit are split into bands of rings.
+  struct MeshFile {
+    std::string name;
+    int material;
+    size_t first, count;
+    int ringBegin, ringEnd;
+    size_t triangles;
+  };
+  std::vector<MeshFile> files;
+  int bands = int(std::min<size_t>((sphereTriangles + kTrianglesPerFile - 1) / kTrianglesPerFile, size_t(rings)));
+  size_t spheresPerFile = bands > 1 ? 1 : std::max<size_t>(1, kTrianglesPerFile / sphereTriangles);
+  for (int m = 0; m < nMaterials; ++m) {
+    size_t index = 0;
+    for (size_t first = 0; first < byMaterial[m].size(); first += spheresPerFile) {
+      size_t count = std::min(spheresPerFile, byMaterial[m].size() - first);
+      for (int b = 0; b < bands; ++b) {
+        int ringBegin = rings * b / bands;
+        int ringEnd = rings * (b + 1) / bands;
+        char fileName[64];
+        snprintf(fileName, sizeof(fileName), "spheres_%03d_%05zu.obj", m, index++);
+        files.push_back({ fileName, m, first, count, ringBegin, ringEnd, count * bandTriangles(rings, ringBegin, ringEnd) });
+      }
+    }
+  }
+  // exceptions must not leave the parallel region, the first one is rethrown
+  std::string error;
+  #pragma omp parallel for schedule(dynamic, 1)
+  for (int f = 0; f < int(files.size()); ++f) {
+    const MeshFile& file = files[f];
+    std::string content;
+    content.reserve(file.triangles * 64);
+    int firstVertex = 1;
+    for (size_t i = file.first; i < file.first + file.count; ++i) {
+      writeSphere(content, byMaterial[file.material][i], rings, file.ringBegin, file.ringEnd, firstVertex);
+    }
+    try {
+      writeFile(folder + "/" + file.name, content);
+    } catch (std::exception& e) {
+      #pragma omp critical
+      if (error.empty()) {
+        error = e.what();
+      }
+    }
+  }
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+  float ground = 0.6f * side + 2.f * kMaxRadius;
+  char groundObj[512];
+  snprintf(groundObj, sizeof(groundObj),
+    "v %g 0 %g\nv %g 0 %g\nv %g 0 %g\nv %g 0 %g\nvn 0 1 0\nvt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\nf 1/1/1 2/2/1 3/3/1\nf 1/1/1 3/3/1 4/4/1\n",
+    -ground, ground, ground, ground, ground, -ground, -ground, -ground);
+  writeFile(folder + "/ground.obj", groundObj);
+
+  for (int t = 0; t < nTextures; ++t) {
+    writeTexture(folder + "/texture_" + std::to_string(t) + ".png", params.textureSize, t, random);
+  }
+
+  std::string scene = "# generated stress scene\n\n";
+  char block[512];
+  for (int m = 0; m < nMaterials; ++m) {
+    float r = 0.2f + 0.8f * uniform(random), g = 0.2f + 0.8f * uniform(random), b = 0.2f + 0.8f * uniform(random);
+    // every fourth untextured material is glass, every third metal
+    bool glass = m >= nTextures && m % 4 == 3;
+    bool metal = m >= nTextures && m % 3 == 2;
+    snprintf(block, sizeof(block), "material Stress%03d\n{\n\tcolor %g %g %g\n\troughness %g\n\tmetallic %g\n%s%s}\n\n",
+      m, m < nTextures ? 1.f : r, m < nTextures ? 1.f : g, m < nTextures ? 1.f : b, 0.05f + 0.5f * uniform(random), metal ? 1.f : 0.f,
+      glass ? "\tbrdf 1\n" : "", m < nTextures ? ("\talbedoTex texture_" + std::to_string(m) + ".png\n").c_str() : "");
+    scene += block;
+  }
+  scene += "material Ground\n{\n\tcolor 0.6 0.6 0.6\n\troughness 0.5\n}\n\n";
+
+  // the lights share a fixed total area so the exposure does not depend on the count
+  int nLights = std::max(params.lights, 1);
+  int grid = int(std::ceil(std::sqrt(float(nLights))));
+  float spacing = side / grid;
+  float size = 0.5f * side / std::sqrt(float(nLights));
+  for (int l = 0; l < nLights; ++l) {
+    float x = -0.5f * side + spacing * (l % grid + 0.5f) - 0.5f * size;
+    float z = -0.5f * side + spacing * (l / grid + 0.5f) - 0.5f * size;
+    float y = 4.f * kMaxRadius + 0.25f * side;
+    snprintf(block, sizeof(block), "light\n{\n\tposition %g %g %g\n\tv1 %g %g %g\n\tv2 %g %g %g\n\temission 10 10 10\n\ttype Quad\n}\n\n",
+      x, y, z, x + size, y, z, x, y, z + size);
+    scene += block;
+  }
+
+  scene += "mesh\n{\n\tfile ground.obj\n\tmaterial Ground\n}\n\n";
+  size_t triangles = 2;
+  for (auto& file : files) {
+    snprintf(block, sizeof(block), "mesh\n{\n\tfile %s\n\tmaterial Stress%03d\n}\n\n", file.name.c_str(), file.material);
+    scene += block;
+    triangles += file.triangles;
+  }
+  writeFile(folder + "/" + name + ".scene", scene);
+  return triangles;
+}
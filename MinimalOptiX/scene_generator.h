@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+struct StressSceneParams {
+  size_t triangles = 1000000; // spread over the spheres, each at least 8
+  int spheres = 1000;
+  int lights = 4; // quads above the spheres
+  int materials = 8;
+  int textures = 2; // the first materials get a procedural albedo texture
+  int textureSize = 1024;
+  unsigned int seed = 1;
+};
+
+// Writes <folder>/<name>.scene with tessellated spheres resting on a ground
+// quad, grouped into OBJ files by material and split at about a million
+// triangles each, a sphere above that across several files by rings, plus
+// PNG textures. Spheres are placed without overlap
+// through a DiskHash, so large counts stay linear. Returns the number of
+// triangles actually written.
+size_t generateStressScene(const std::string& folder, const std::string& name, const StressSceneParams& params);
@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "temporal.h"
+#include "projection.h"
+
+using namespace optix;
+
+namespace {
+
+// relative distance between reprojected and stored hit points that still
+// counts as the same surface
+const float kPositionTolerance = 0.02f;
+
+int objectIdOf(const float4& g) {
+  return int(floorf(g.w + 0.5f));
+}
+
+}
+
+void reprojectHistory(
+  const TemporalHistory& history, const float4* gBuffer,
+  const std::vector<SphereParams>& spheresParams, int width, int height,
+  std::vector<float4>& reprojected
+) {
+  reprojected.assign(size_t(width) * height, make_float4(0.f));
+  if (!history.valid) {
+    return;
+  }
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      int i = y * width + x;
+      int id = objectIdOf(gBuffer[i]);
+      int prev = i;
+      if (id != kMissObjectId) {
+        // spheres only translate, so their points move with the center
+        float3 p = make_float3(gBuffer[i]);
+        if (id >= 0 && id < int(spheresParams.size()) && id < int(history.spheresParams.size())) {
+          p -= spheresParams[id].center - history.spheresParams[id].center;
+        }
+        int px, py;
+        if (!projectToPixel(history.camParams, p, width, height, px, py)) {
+          continue;
+        }
+        prev = py * width + px;
+        float3 stored = make_float3(history.gBuffer[prev]);
+        if (length(stored - p) > kPositionTolerance * length(p - history.camParams.origin)) {
+          continue;
+        }
+      }
+      if (objectIdOf(history.gBuffer[prev]) != id) {
+        continue;
+      }
+      reprojected[i] = history.radiance[prev];
+    }
+  }
+}
+
+void resolveTemporal(
+  TemporalHistory& history, const std::vector<float4>& reprojected,
+  const float* accu, const uint* budget, const float4* gBuffer,
+  const CamParams& camParams, const std::vector<SphereParams>& spheresParams,
+  int width, int height, float maxHistory, float* output
+) {
+  size_t nPixels = size_t(width) * height;
+  std::vector<float3> mean(nPixels);
+  #pragma omp parallel for
+  for (int i = 0; i < int(nPixels); ++i) {
+    mean[i] = make_float3(accu[3 * i], accu[3 * i + 1], accu[3 * i + 2]) / float(std::max(budget[i], 1u));
+  }
+
+  history.radiance.resize(nPixels);
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      int i = y * width + x;
+      float3 color = mean[i];
+      float count = float(budget[i]);
+      if (!reprojected.empty() && reprojected[i].w > 0.f) {
+        float3 lo = make_float3(std::numeric_limits<float>::max());
+        float3 hi = -lo;
+        for (int dy = -1; dy <= 1; ++dy) {
+          for (int dx = -1; dx <= 1; ++dx) {
+            int j = std::min(std::max(y + dy, 0), height - 1) * width + std::min(std::max(x + dx, 0), width - 1);
+            lo = fminf(lo, mean[j]);
+            hi = fmaxf(hi, mean[j]);
+          }
+        }
+        float3 past = clamp(make_float3(reprojected[i]), lo, hi);
+        float pastCount = std::min(reprojected[i].w, maxHistory);
+        color = (past * pastCount + mean[i] * count) / (pastCount + count);
+        count += pastCount;
+      }
+      output[3 * i] = color.x;
+      output[3 * i + 1] = color.y;
+      output[3 * i + 2] = color.z;
+      history.radiance[i] = make_float4(color, count);
+    }
+  }
+
+  history.gBuffer.assign(gBuffer, gBuffer + nPixels);
+  history.camParams = camParams;
+  history.spheresParams = spheresParams;
+  history.valid = true;
+}
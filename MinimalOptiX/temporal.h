@@ -0,0 +1,41 @@
+#pragma once
+
+#include <optix_world.h>
+#include <vector>
+#include "structures.h"
+
+// object id written to the G-buffer by the miss program; static geometry
+// keeps the context default of -1 and animated spheres use their index
+const int kMissObjectId = -2;
+
+// Previous video frame, kept so its accumulated radiance can be reused.
+// gBuffer holds the first-hit position (xyz) and object id (w) per pixel,
+// radiance holds the mean color (xyz) and its effective sample count (w).
+struct TemporalHistory {
+  bool valid = false;
+  uint frame = 0u;
+  CamParams camParams;
+  std::vector<SphereParams> spheresParams;
+  std::vector<optix::float4> gBuffer;
+  std::vector<optix::float4> radiance;
+};
+
+// Follows every current first hit back along the sphere and camera motion
+// into the previous frame. reprojected[i].w is the usable history sample
+// count, 0 where the surface was occluded, off screen or a different object.
+void reprojectHistory(
+  const TemporalHistory& history, const optix::float4* gBuffer,
+  const std::vector<SphereParams>& spheresParams, int width, int height,
+  std::vector<optix::float4>& reprojected
+);
+
+// Blends reprojected history with this frame's sample sums (accu, samples
+// per pixel in budget), writes the mean to output and makes the current
+// frame the new history. History is clamped to the 3x3 color range of the
+// new samples so shading that moved with the camera does not ghost.
+void resolveTemporal(
+  TemporalHistory& history, const std::vector<optix::float4>& reprojected,
+  const float* accu, const uint* budget, const optix::float4* gBuffer,
+  const CamParams& camParams, const std::vector<SphereParams>& spheresParams,
+  int width, int height, float maxHistory, float* output
+);
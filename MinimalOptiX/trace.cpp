@@ -0,0 +1,133 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <QJsonArray>
+#include <QJsonObject>
+#include "trace.h"
+#include "benchmark.h"
+
+namespace {
+
+struct TraceEvent {
+  const char* name;
+  std::string detail;
+  long long beginUs;
+  long long durationUs;
+};
+
+struct ThreadTrace {
+  int tid;
+  std::string name;
+  std::mutex mutex; // only contended while writeTrace() reads
+  std::vector<TraceEvent> events;
+};
+
+std::atomic<bool> enabled(false);
+std::chrono::steady_clock::time_point epoch;
+std::mutex threadsMutex;
+// shared with the thread_local handles so events outlive their threads
+std::vector<std::shared_ptr<ThreadTrace>> threads;
+
+ThreadTrace& threadTrace() {
+  thread_local std::shared_ptr<ThreadTrace> trace;
+  if (!trace) {
+    trace = std::make_shared<ThreadTrace>();
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    trace->tid = int(threads.size()) + 1;
+    threads.push_back(trace);
+  }
+  return *trace;
+}
+
+long long nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+}
+
+void traceStart() {
+  epoch = std::chrono::steady_clock::now();
+  enabled = true;
+  traceThreadName("main");
+}
+
+bool tracing() {
+  return enabled.load(std::memory_order_relaxed);
+}
+
+void traceThreadName(const char* name) {
+  if (!tracing()) {
+    return;
+  }
+  ThreadTrace& trace = threadTrace();
+  std::lock_guard<std::mutex> lock(trace.mutex);
+  trace.name = name;
+}
+
+void writeTrace(const std::string& fileName) {
+  QJsonArray events;
+  std::lock_guard<std::mutex> threadsLock(threadsMutex);
+  for (auto& thread : threads) {
+    std::lock_guard<std::mutex> lock(thread->mutex);
+    if (!thread->name.empty()) {
+      QJsonObject meta;
+      meta["name"] = "thread_name";
+      meta["ph"] = "M";
+      meta["pid"] = 1;
+      meta["tid"] = thread->tid;
+      QJsonObject args;
+      args["name"] = QString::fromStdString(thread->name);
+      meta["args"] = args;
+      events.append(meta);
+    }
+    for (auto& event : thread->events) {
+      // complete events, timestamps in microseconds since traceStart()
+      QJsonObject span;
+      span["name"] = event.name;
+      span["cat"] = "host";
+      span["ph"] = "X";
+      span["pid"] = 1;
+      span["tid"] = thread->tid;
+      span["ts"] = double(event.beginUs);
+      span["dur"] = double(event.durationUs);
+      if (!event.detail.empty()) {
+        QJsonObject args;
+        args["detail"] = QString::fromStdString(event.detail);
+        span["args"] = args;
+      }
+      events.append(span);
+    }
+  }
+  QJsonObject trace;
+  trace["traceEvents"] = events;
+  trace["displayTimeUnit"] = "ms";
+  writeJson(fileName, trace);
+}
+
+TraceSpan::TraceSpan(const char* name, const char* detail) : name(name), beginUs(-1) {
+  if (tracing()) {
+    if (detail) {
+      this->detail = detail;
+    }
+    beginUs = nowUs();
+  }
+}
+
+TraceSpan::TraceSpan(const char* name, const std::string& detail) : name(name), beginUs(-1) {
+  if (tracing()) {
+    this->detail = detail;
+    beginUs = nowUs();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (beginUs < 0) {
+    return;
+  }
+  long long endUs = nowUs();
+  ThreadTrace& trace = threadTrace();
+  std::lock_guard<std::mutex> lock(trace.mutex);
+  trace.events.push_back({ name, std::move(detail), beginUs, endUs - beginUs });
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+
+// Host pipeline spans written as Chrome trace events (chrome://tracing or
+// Perfetto), for --trace <file.json>. Tracing is off until traceStart(); a
+// span constructed while it is off costs one atomic load. Each thread
+// records into its own buffer and spans on one thread nest by time.
+
+void traceStart();
+bool tracing();
+// names the calling thread in the trace
+void traceThreadName(const char* name);
+// Writes every span that has ended so far, atomically replacing fileName.
+void writeTrace(const std::string& fileName);
+
+// Times its own lifetime. name must outlive the trace, pass a literal;
+// detail shows up as the span's argument (file, scene, sample) and is only
+// copied while tracing, so callers should not build a string just for it.
+class TraceSpan {
+public:
+  TraceSpan(const char* name, const char* detail = nullptr);
+  TraceSpan(const char* name, const std::string& detail);
+  ~TraceSpan();
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+  const char* name;
+  std::string detail;
+  long long beginUs; // -1 when tracing was off at construction
+};
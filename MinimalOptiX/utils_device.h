@@ -2,11 +2,47 @@
 
 #include <optix_world.h>
 #include "structures.h"
+#ifndef __CUDACC__
+#include <cmath>
+#include <cstring>
+#endif
 
 using namespace optix;
 
+// Everything here compiles for the device and for host C++, so math_bench.cpp
+// can time and check it without a GPU. The few CUDA intrinsics go through
+// the wrappers below, which fall back to portable code on the host.
+
+RT_HOSTDEVICE inline float saturate(float x) {
+#ifdef __CUDACC__
+  return __saturatef(x);
+#else
+  return fminf(fmaxf(x, 0.f), 1.f);
+#endif
+}
+
+RT_HOSTDEVICE inline int floatAsInt(float x) {
+#ifdef __CUDACC__
+  return __float_as_int(x);
+#else
+  int i;
+  memcpy(&i, &x, sizeof(i));
+  return i;
+#endif
+}
+
+RT_HOSTDEVICE inline float intAsFloat(int i) {
+#ifdef __CUDACC__
+  return __int_as_float(i);
+#else
+  float x;
+  memcpy(&x, &i, sizeof(x));
+  return x;
+#endif
+}
+
 template<unsigned int N>
-__device__ __inline__ unsigned int tea(unsigned int val0, unsigned int val1) {
+RT_HOSTDEVICE inline unsigned int tea(unsigned int val0, unsigned int val1) {
   unsigned int v0 = val0;
   unsigned int v1 = val1;
   unsigned int s0 = 0;
@@ -21,7 +57,7 @@ __device__ __inline__ unsigned int tea(unsigned int val0, unsigned int val1) {
 }
 
 // Generate random unsigned int in [0, 2^24)
-__device__ __inline__ unsigned int lcg(int& seed) {
+RT_HOSTDEVICE inline unsigned int lcg(int& seed) {
   const unsigned int LCG_A = 1664525u;
   const unsigned int LCG_C = 1013904223u;
   seed = (LCG_A * seed + LCG_C);
@@ -29,12 +65,12 @@ __device__ __inline__ unsigned int lcg(int& seed) {
 }
 
 // Generate random float in [0, 1)
-__device__ __inline__ float rand(int& seed) {
+RT_HOSTDEVICE inline float rand(int& seed) {
   return ((float)lcg(seed) / (float)0x01000000);
 }
 
-__device__ __inline__ float3 randInUnitSphere(int& seed) {
-  static float3 ones = { 1.f, 1.f, 1.f };
+RT_HOSTDEVICE inline float3 randInUnitSphere(int& seed) {
+  const float3 ones = make_float3(1.f, 1.f, 1.f);
   float3 res;
   do {
     res = make_float3(rand(seed), rand(seed), rand(seed)) * 2 - ones;
@@ -42,8 +78,8 @@ __device__ __inline__ float3 randInUnitSphere(int& seed) {
   return res;
 }
 
-__device__ __inline__ float3 randInUnitDisk(int& seed) {
-  static float3 ones = { 1.f, 1.f, 0.f };
+RT_HOSTDEVICE inline float3 randInUnitDisk(int& seed) {
+  const float3 ones = make_float3(1.f, 1.f, 0.f);
   float3 res;
   do {
     res = make_float3(rand(seed), rand(seed), 0) * 2 - ones;
@@ -51,16 +87,16 @@ __device__ __inline__ float3 randInUnitDisk(int& seed) {
   return res;
 }
 
-__device__ __inline__ uchar4 make_color(const float3& c) {
+RT_HOSTDEVICE inline uchar4 make_color(const float3& c) {
   return make_uchar4(
-    static_cast<unsigned char>(__saturatef(c.x)*255.99f),
-    static_cast<unsigned char>(__saturatef(c.y)*255.99f),
-    static_cast<unsigned char>(__saturatef(c.z)*255.99f),
+    static_cast<unsigned char>(saturate(c.x)*255.99f),
+    static_cast<unsigned char>(saturate(c.y)*255.99f),
+    static_cast<unsigned char>(saturate(c.z)*255.99f),
     255u
   );
 }
 
-__device__ __inline__ float fresnel(float cosThetaI, float cosThetaT, float refIdx) {
+RT_HOSTDEVICE inline float fresnel(float cosThetaI, float cosThetaT, float refIdx) {
   float rs = (cosThetaI - cosThetaT * refIdx) / (cosThetaI + refIdx * cosThetaT);
   float rp = (cosThetaI * refIdx - cosThetaT) / (cosThetaI * refIdx + cosThetaT);
   return 0.5f * (rs * rs + rp * rp);
@@ -69,7 +105,7 @@ __device__ __inline__ float fresnel(float cosThetaI, float cosThetaT, float refI
 // Plane intersection -- used for refining triangle hit points.  Note
 // that this skips zero denom check (for rays perpindicular to plane normal)
 // since we know that the ray intersects the plane.
-__device__ __inline__ float intersectPlane(
+RT_HOSTDEVICE inline float intersectPlane(
   const float3& origin,
   const float3& direction,
   const float3& normal,
@@ -79,33 +115,33 @@ __device__ __inline__ float intersectPlane(
 }
 
 // Offset the hit point using integer arithmetic
-__device__ __inline__ float3 offset(const float3& hit_point, const float3& normal) {
+RT_HOSTDEVICE inline float3 offset(const float3& hit_point, const float3& normal) {
   const float epsilon = 1.0e-4f;
   const float offset  = 4096.0f * 2.0f;
   float3 offset_point = hit_point;
-  if ((__float_as_int(hit_point.x) & 0x7fffffff) < __float_as_int(epsilon)) {
+  if ((floatAsInt(hit_point.x) & 0x7fffffff) < floatAsInt(epsilon)) {
     offset_point.x += epsilon * normal.x;
   } else {
-    offset_point.x = __int_as_float(__float_as_int(offset_point.x) + int(copysign(offset, hit_point.x) * normal.x));
+    offset_point.x = intAsFloat(floatAsInt(offset_point.x) + int(copysignf(offset, hit_point.x) * normal.x));
   }
 
-  if((__float_as_int(hit_point.y ) & 0x7fffffff) < __float_as_int(epsilon)) {
+  if((floatAsInt(hit_point.y ) & 0x7fffffff) < floatAsInt(epsilon)) {
     offset_point.y += epsilon * normal.y;
   } else {
-    offset_point.y = __int_as_float(__float_as_int(offset_point.y) + int(copysign(offset, hit_point.y) * normal.y) );
+    offset_point.y = intAsFloat(floatAsInt(offset_point.y) + int(copysignf(offset, hit_point.y) * normal.y) );
   }
 
-  if((__float_as_int(hit_point.z) & 0x7fffffff) < __float_as_int(epsilon)) {
+  if((floatAsInt(hit_point.z) & 0x7fffffff) < floatAsInt(epsilon)) {
     offset_point.z += epsilon * normal.z;
   } else {
-    offset_point.z = __int_as_float(__float_as_int(offset_point.z) + int(copysign(offset, hit_point.z) * normal.z));
+    offset_point.z = intAsFloat(floatAsInt(offset_point.z) + int(copysignf(offset, hit_point.z) * normal.z));
   }
   return offset_point;
 }
 
 // Refine the hit point to be more accurate and offset it for reflection and
 // refraction ray starting points.
-__device__ __inline__ void refineHitpoint(
+RT_HOSTDEVICE inline void refineHitpoint(
   const float3& original_hit_point,
   const float3& direction,
   const float3& normal,
@@ -127,7 +163,7 @@ __device__ __inline__ void refineHitpoint(
   }
 }
 
-__device__ __inline__ float GTR1(float NDotH, float a) {
+RT_HOSTDEVICE inline float GTR1(float NDotH, float a) {
   if (a >= 1.f) {
     return (1.f / M_PIf);
   }
@@ -136,63 +172,78 @@ __device__ __inline__ float GTR1(float NDotH, float a) {
   return (a2 - 1.0f) / (M_PIf * logf(a2) * t);
 }
 
-__device__ __inline__ float GTR2(float NDotH, float a) {
+RT_HOSTDEVICE inline float GTR2(float NDotH, float a) {
   float a2 = a * a;
   float t = 1.f + (a2 - 1.f) * NDotH * NDotH;
   return a2 / (M_PIf * t*t);
 }
 
-__device__  __inline__ float square(float x) {
+RT_HOSTDEVICE inline float square(float x) {
   return x * x;
 }
 
-__device__ __inline__ float GTR2Aniso(float NdotH, float HdotX, float HdotY, float ax, float ay) {
+RT_HOSTDEVICE inline float GTR2Aniso(float NdotH, float HdotX, float HdotY, float ax, float ay) {
   return 1 / (M_PIf * ax * ay * square(square(HdotX / ax) + square(HdotY / ay) + NdotH * NdotH));
 }
 
-__device__ __inline__ float schlickFresnel(float u) {
+RT_HOSTDEVICE inline float schlickFresnel(float u) {
   float m = clamp(1.f - u, 0.f, 1.f);
   float m2 = m * m;
   return m2 * m2 * m;
 }
 
-__device__ __inline__ float smithGGgx(float NdotV, float alphaG) {
+RT_HOSTDEVICE inline float smithGGgx(float NdotV, float alphaG) {
   float a = alphaG * alphaG;
   float b = NdotV * NdotV;
   return 1.f / (NdotV + sqrtf(a + b - a * b));
 }
 
-__device__ __inline__ float smithGGgxAniso(float NdotV, float VdotX, float VdotY, float ax, float ay) {
-    return 1.0 / (NdotV + sqrt(square(VdotX * ax) + square(VdotY * ay) + square(NdotV)));
+RT_HOSTDEVICE inline float smithGGgxAniso(float NdotV, float VdotX, float VdotY, float ax, float ay) {
+    return 1.f / (NdotV + sqrtf(square(VdotX * ax) + square(VdotY * ay) + square(NdotV)));
 }
 
-__device__ __inline__ float3 logf(float3 v) {
+RT_HOSTDEVICE inline float3 logf(float3 v) {
   return make_float3(logf(v.x), logf(v.y), logf(v.z));
 }
 
-__device__ __inline__ float3 srgb2lin(float3 v) {
-  return make_float3(pow(v.x, 2.2f), pow(v.y, 2.2f), pow(v.z, 2.2f));
+RT_HOSTDEVICE inline float3 srgb2lin(float3 v) {
+  return make_float3(powf(v.x, 2.2f), powf(v.y, 2.2f), powf(v.z, 2.2f));
 }
 
-__device__ __inline__ float3 lin2srgb(float3 v) {
+RT_HOSTDEVICE inline float3 lin2srgb(float3 v) {
   float kInvGamma = 1.f / 2.2f;
 	return make_float3(powf(v.x, kInvGamma), powf(v.y, kInvGamma), powf(v.z, kInvGamma));
 }
 
-__device__ __inline__ float powerHeuristic(float a, float b) {
+RT_HOSTDEVICE inline float powerHeuristic(float a, float b) {
 	float t = a * a;
 	return t / (b * b + t);
 }
 
-__device__ __inline__ float3 toneMap(const float3& c, float limit) {
+RT_HOSTDEVICE inline float3 toneMap(const float3& c, float limit) {
 	float luminance = 0.3f * c.x + 0.6f * c.y + 0.1f * c.z;
 	return c / (1.f + luminance / limit);
 }
 
-__device__ __inline__ Payload folkPayload(Payload& parent) {
+RT_HOSTDEVICE inline Payload folkPayload(Payload& parent) {
   Payload child;
   child.depth = parent.depth + 1;
   child.color = make_float3(1.f);
   child.randSeed = tea<16>(parent.randSeed, child.depth);
+  child.bsdfPdf = 0.f;
+  child.causticState = parent.causticState;
   return child;
 }
+
+// caustic state of a path leaving a diffuse vertex
+RT_HOSTDEVICE inline int causticAfterDiffuse(int state) {
+  return state == CAUSTIC_BEFORE_DIFFUSE ? CAUSTIC_AFTER_DIFFUSE : CAUSTIC_IGNORED;
+}
+
+// caustic state of a path leaving a specular vertex
+RT_HOSTDEVICE inline int causticAfterSpecular(int state) {
+  if (state == CAUSTIC_BEFORE_DIFFUSE || state == CAUSTIC_IGNORED) {
+    return state;
+  }
+  return CAUSTIC_SPECULAR_CHAIN;
+}
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <iterator>
+#include <QSaveFile>
+#include <QColor>
 #include "utils_host.h"
+#include "light_sampling.h"
+#include "restir.h"
 extern "C"
 {
 #include <libavcodec/avcodec.h>
@@ -20,7 +26,7 @@ void getStrFromFile(std::string& content, std::string& fileName) {
   content = buffer.str();
 }
 
-void getPtxStrFromCuStr(std::string& cuStr, std::string& ptxStr, std::string& fileName) {
+void getPtxStrFromCuStr(std::string& cuStr, std::string& ptxStr, std::string& fileName, const std::vector<std::string>& defines) {
   nvrtcProgram prog = 0;
   nvrtcCreateProgram(&prog, cuStr.c_str(), fileName.c_str(), 0, NULL, NULL);
   std::vector<const char*> options;
@@ -34,6 +40,9 @@ void getPtxStrFromCuStr(std::string& cuStr, std::string& ptxStr, std::string& fi
   options.push_back("-rdc");
   options.push_back("true");
   options.push_back("-D__x86_64");
+  for (auto& define : defines) {
+    options.push_back(define.c_str());
+  }
 
   const nvrtcResult compileRes = nvrtcCompileProgram(prog, (int)options.size(), options.data());
 
@@ -58,10 +67,10 @@ void getPtxStrFromCuStr(std::string& cuStr, std::string& ptxStr, std::string& fi
   nvrtcDestroyProgram(&prog);
 }
 
-void cuFileToPtxStr(std::string& fileName, std::string& ptxStr) {
+void cuFileToPtxStr(std::string& fileName, std::string& ptxStr, const std::vector<std::string>& defines) {
   std::string cuStr;
   getStrFromFile(cuStr, fileName);
-  getPtxStrFromCuStr(cuStr, ptxStr, fileName);
+  getPtxStrFromCuStr(cuStr, ptxStr, fileName, defines);
 }
 
 void setQuadParams(optix::float3& anchor, optix::float3& v1, optix::float3& v2, QuadParams& quadParams) {
@@ -74,6 +83,18 @@ void setQuadParams(optix::float3& anchor, optix::float3& v1, optix::float3& v2,
   quadParams.anchor = anchor;
 }
 
+void setQuadLightParams(optix::float3& anchor, optix::float3& v1, optix::float3& v2, optix::float3 emission, LightParams& lightParams) {
+  // same layout as quad lights read from scene files, emitting along cross(v1, v2)
+  lightParams.position = anchor;
+  lightParams.u = v1;
+  lightParams.v = v2;
+  lightParams.normal = optix::normalize(optix::cross(v1, v2));
+  lightParams.emission = emission;
+  lightParams.area = optix::length(optix::cross(v1, v2));
+  lightParams.radius = 0.f;
+  lightParams.shape = QUAD;
+}
+
 void setCamParams(
   optix::float3& lookFrom, optix::float3& lookAt, optix::float3& up,
   float vFoV, float aspect, float aperture, float focus, CamParams& camParams) {
@@ -115,23 +136,346 @@ void initDisneyParams(DisneyParams& disneyParams) {
   disneyParams.albedoID = RT_TEXTURE_ID_NULL;
 }
 
-int randSeed() {
-  static auto randSeed = std::minstd_rand(std::random_device{}());
-  static auto randGen = std::uniform_real_distribution<float>(-1.f, 1.f);
-  return int(randGen(randSeed) * (float)std::numeric_limits<int>::max());
+// the sampling disney() used before: area for quads, volume for spheres
+static float legacyLightPdf(const LightParams& light, const optix::float3& p, std::mt19937& random, optix::float3& L) {
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  optix::float3 pointOnLight;
+  optix::float3 normalOnLight;
+  if (light.shape == SPHERE) {
+    optix::float3 inBall;
+    do {
+      inBall = optix::make_float3(uniform(random), uniform(random), uniform(random)) * 2.f - optix::make_float3(1.f);
+    } while (optix::length(inBall) >= 1.f);
+    pointOnLight = light.position + inBall * light.radius;
+    normalOnLight = optix::normalize(pointOnLight - light.position);
+  } else {
+    pointOnLight = light.position + light.u * uniform(random) + light.v * uniform(random);
+    normalOnLight = optix::normalize(light.normal);
+  }
+  L = pointOnLight - p;
+  float dist = optix::length(L);
+  L = L / dist;
+  float cosLight = -optix::dot(L, normalOnLight);
+  return cosLight > 0.f ? dist * dist / light.area / cosLight : 0.f;
 }
 
-void generateVideo(std::vector<QImage>& images, const char* output_path) {
+void compareLightSampling(const std::string& sceneName, const std::vector<LightParams>& lights, int nSamples) {
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  double legacyRelVar = 0.0;
+  double solidRelVar = 0.0;
+  double maxMeanDiff = 0.0;
+  int nReceivers = 0;
+  for (auto& light : lights) {
+    // receivers in front of the light at close range, mid range and grazing
+    optix::float3 center, normal, tangent;
+    float size;
+    if (light.shape == SPHERE) {
+      center = light.position;
+      normal = optix::length(light.normal) > 0.f ? optix::normalize(light.normal) : optix::make_float3(0.f, -1.f, 0.f);
+      tangent = optix::normalize(optix::cross(normal, fabsf(normal.x) > 0.9f ? optix::make_float3(0.f, 1.f, 0.f) : optix::make_float3(1.f, 0.f, 0.f)));
+      size = light.radius;
+    } else {
+      center = light.position + 0.5f * (light.u + light.v);
+      normal = optix::normalize(light.normal);
+      tangent = optix::normalize(light.u);
+      size = std::max(optix::length(light.u), optix::length(light.v));
+    }
+    const float heights[] = { 1.05f, 1.5f, 4.f };
+    const float offsets[] = { 0.f, 1.f, 4.f };
+    for (float h : heights) {
+      for (float x : offsets) {
+        optix::float3 p = center + normal * (h * size) + tangent * (x * size);
+        optix::float3 receiverNormal = optix::normalize(center - p);
+        double sum[2] = { 0.0, 0.0 };
+        double sumSq[2] = { 0.0, 0.0 };
+        for (int i = 0; i < nSamples; ++i) {
+          optix::float3 L;
+          float pdf = legacyLightPdf(light, p, random, L);
+          double value = pdf > 0.f ? std::max(optix::dot(L, receiverNormal), 0.f) / pdf : 0.0;
+          sum[0] += value;
+          sumSq[0] += value * value;
+          LightSample sample = sampleLight(light, p, uniform(random), uniform(random));
+          value = sample.pdf > 0.f ? std::max(optix::dot(sample.direction, receiverNormal), 0.f) / sample.pdf : 0.0;
+          sum[1] += value;
+          sumSq[1] += value * value;
+        }
+        double mean[2], relVar[2];
+        for (int k = 0; k < 2; ++k) {
+          mean[k] = sum[k] / nSamples;
+          relVar[k] = mean[k] > 0.0 ? (sumSq[k] / nSamples - mean[k] * mean[k]) / (mean[k] * mean[k]) : 0.0;
+        }
+        if (mean[1] <= 0.0) {
+          continue;
+        }
+        legacyRelVar += relVar[0];
+        solidRelVar += relVar[1];
+        maxMeanDiff = std::max(maxMeanDiff, fabs(mean[0] - mean[1]) / mean[1]);
+        ++nReceivers;
+      }
+    }
+  }
+  if (nReceivers == 0) {
+    printf("%-14s no lights\n", sceneName.c_str());
+    return;
+  }
+  printf("%-14s %3d lights %4d receivers  relative variance area/volume %10.4f  solid angle %10.4f  (%.1fx)  max mean difference %.1f%%\n",
+    sceneName.c_str(), int(lights.size()), nReceivers, legacyRelVar / nReceivers, solidRelVar / nReceivers,
+    solidRelVar > 0.0 ? legacyRelVar / solidRelVar : 0.0, 100.0 * maxMeanDiff);
+}
+
+namespace {
+
+struct HostLambertian {
+  optix::float3 N;
+  optix::float3 eval(const optix::float3& L) { return optix::make_float3(std::max(optix::dot(N, L), 0.f) / M_PIf); }
+};
+
+struct HostRand {
+  std::mt19937& random;
+  std::uniform_real_distribution<float> uniform;
+  float operator()() { return uniform(random); }
+};
+
+float luminance(const optix::float3& c) {
+  return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+}
+
+void compareLightResampling(const std::string& sceneName, const std::vector<LightParams>& lights, int nSamples, int nCandidates, float maxM) {
+  std::mt19937 random(11);
+  HostRand rng = { random, std::uniform_real_distribution<float>(0.f, 1.f) };
+  double relVar[3] = { 0.0, 0.0, 0.0 };
+  double maxMeanDiff[3] = { 0.0, 0.0, 0.0 };
+  int nReceivers = 0;
+  // receivers in front of up to 8 of the lights, each lit by all of them
+  size_t stride = std::max<size_t>(1, lights.size() / 8);
+  for (size_t l = 0; l < lights.size(); l += stride) {
+    const LightParams& near = lights[l];
+    optix::float3 center = near.shape == SPHERE ? near.position : near.position + 0.5f * (near.u + near.v);
+    optix::float3 normal = near.shape == SPHERE || optix::length(near.normal) == 0.f ? optix::make_float3(0.f, -1.f, 0.f) : optix::normalize(near.normal);
+    float size = near.shape == SPHERE ? near.radius : std::max(optix::length(near.u), optix::length(near.v));
+    optix::float3 p = center + normal * (2.f * size);
+    HostLambertian bsdf = { -normal };
+
+    // reference: every light sampled by solid angle
+    double reference = 0.0;
+    for (auto& light : lights) {
+      for (int i = 0; i < nSamples; ++i) {
+        LightSample sample = sampleLight(light, p, rng(), rng());
+        if (sample.pdf > 0.f) {
+          reference += luminance(bsdf.eval(sample.direction) * light.emission) / sample.pdf / nSamples;
+        }
+      }
+    }
+    if (reference <= 0.0) {
+      continue;
+    }
+
+    // one shadow ray each: a uniformly chosen light, resampled candidates,
+    // and resampled candidates merged with the previous estimate's reservoir
+    double sum[3] = { 0.0, 0.0, 0.0 };
+    double sumSq[3] = { 0.0, 0.0, 0.0 };
+    Reservoir history;
+    reservoirReset(history);
+    for (int i = 0; i < nSamples; ++i) {
+      double value[3] = { 0.0, 0.0, 0.0 };
+      int lightIdx = std::min(int(rng() * lights.size()), int(lights.size()) - 1);
+      LightSample sample = sampleLight(lights[lightIdx], p, rng(), rng());
+      if (sample.pdf > 0.f) {
+        value[0] = luminance(bsdf.eval(sample.direction) * lights[lightIdx].emission) * lights.size() / sample.pdf;
+      }
+      Reservoir fresh = restirResample(p, bsdf.N, bsdf, lights, nCandidates, (const Reservoir*)nullptr, 0, 1.f, maxM, rng);
+      Reservoir reused = restirResample(p, bsdf.N, bsdf, lights, nCandidates, &history, 1, 1.f, maxM, rng);
+      const Reservoir* reservoirs[2] = { &fresh, &reused };
+      for (int k = 0; k < 2; ++k) {
+        const Reservoir& r = *reservoirs[k];
+        if (r.W > 0.f) {
+          value[k + 1] = restirTarget(bsdf, lights[r.lightIdx], r.lightPoint, p) * r.W;
+        }
+      }
+      history = reused;
+      for (int k = 0; k < 3; ++k) {
+        sum[k] += value[k];
+        sumSq[k] += value[k] * value[k];
+      }
+    }
+    for (int k = 0; k < 3; ++k) {
+      double mean = sum[k] / nSamples;
+      relVar[k] += (sumSq[k] / nSamples - mean * mean) / (reference * reference);
+      maxMeanDiff[k] = std::max(maxMeanDiff[k], fabs(mean - reference) / reference);
+    }
+    ++nReceivers;
+  }
+  if (nReceivers == 0) {
+    printf("%-14s no lights\n", sceneName.c_str());
+    return;
+  }
+  printf("%-14s %3d lights %4d receivers  relative variance uniform light %10.4f  resampled %10.4f  reused %10.4f  max mean difference %.1f%% %.1f%% %.1f%%\n",
+    sceneName.c_str(), int(lights.size()), nReceivers, relVar[0] / nReceivers, relVar[1] / nReceivers, relVar[2] / nReceivers,
+    100.0 * maxMeanDiff[0], 100.0 * maxMeanDiff[1], 100.0 * maxMeanDiff[2]);
+}
+
+void writePfm(const std::string& fileName, const float* rgb, int width, int height, const std::string& trailer) {
+  QSaveFile file(QString::fromStdString(fileName));
+  if (!file.open(QIODevice::WriteOnly)) {
+    throw std::runtime_error("Cannot open " + fileName + " for writing.");
+  }
+  // negative scale marks little-endian data
+  std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+  file.write(header.data(), header.size());
+  file.write((const char*)rgb, sizeof(float) * 3 * width * height);
+  file.write(trailer.data(), trailer.size());
+  if (!file.commit()) {
+    throw std::runtime_error("Cannot write " + fileName + ".");
+  }
+}
+
+bool readPfm(const std::string& fileName, std::vector<float>& rgb, int& width, int& height, std::string* trailer) {
+  std::ifstream file(fileName, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  std::string magic;
+  float scale;
+  file >> magic >> width >> height >> scale;
+  file.get(); // single whitespace before the data
+  if (magic != "PF" || scale >= 0.f) {
+    throw std::runtime_error(fileName + " is not a little-endian color PFM.");
+  }
+  rgb.resize(3 * size_t(width) * height);
+  file.read((char*)rgb.data(), sizeof(float) * rgb.size());
+  if (!file) {
+    return false;
+  }
+  if (trailer) {
+    trailer->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+  return true;
+}
+
+void saveCheckpoint(const std::string& prefix, const AccuCheckpoint& checkpoint) {
+  std::stringstream stream;
+  stream << "scene " << checkpoint.sceneId << "\n";
+  stream << "width " << checkpoint.width << "\n";
+  stream << "height " << checkpoint.height << "\n";
+  stream << "firstSample " << checkpoint.firstSample << "\n";
+  stream << "samples " << checkpoint.samples << "\n";
+  std::string content = stream.str();
+  writePfm(prefix + ".accu.pfm", checkpoint.accu.data(), checkpoint.width, checkpoint.height, content);
+  QSaveFile file(QString::fromStdString(prefix + ".accu.txt"));
+  if (!file.open(QIODevice::WriteOnly) || file.write(content.data(), content.size()) < 0 || !file.commit()) {
+    throw std::runtime_error("Cannot write checkpoint " + prefix + ".accu.txt.");
+  }
+}
+
+bool loadCheckpoint(const std::string& prefix, AccuCheckpoint& checkpoint) {
+  // the sample range comes from the PFM itself, a stale .accu.txt next to a
+  // newer image would divide it by too few samples
+  int width, height;
+  std::string trailer;
+  if (!readPfm(prefix + ".accu.pfm", checkpoint.accu, width, height, &trailer)) {
+    return false;
+  }
+  std::stringstream stream(trailer);
+  std::string key;
+  int found = 0;
+  while (stream >> key) {
+    if (key == "scene") {
+      stream >> checkpoint.sceneId;
+    } else if (key == "width") {
+      stream >> checkpoint.width;
+    } else if (key == "height") {
+      stream >> checkpoint.height;
+    } else if (key == "firstSample") {
+      stream >> checkpoint.firstSample;
+    } else if (key == "samples") {
+      stream >> checkpoint.samples;
+    } else {
+      continue;
+    }
+    ++found;
+  }
+  return stream.eof() && found == 5 && width == checkpoint.width && height == checkpoint.height;
+}
+
+void mergeCheckpoints(const std::vector<std::string>& inputs, const std::string& output) {
+  AccuCheckpoint merged;
+  std::vector<std::pair<unsigned int, unsigned int>> ranges;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    AccuCheckpoint partial;
+    if (!loadCheckpoint(inputs[i], partial)) {
+      throw std::runtime_error("Cannot load partial " + inputs[i] + ".");
+    }
+    if (i == 0) {
+      merged = partial;
+    } else {
+      if (partial.sceneId != merged.sceneId || partial.width != merged.width || partial.height != merged.height) {
+        throw std::runtime_error(inputs[i] + " belongs to a different render.");
+      }
+      for (size_t j = 0; j < merged.accu.size(); ++j) {
+        merged.accu[j] += partial.accu[j];
+      }
+      merged.firstSample = std::min(merged.firstSample, partial.firstSample);
+      merged.samples += partial.samples;
+    }
+    ranges.push_back(std::make_pair(partial.firstSample, partial.firstSample + partial.samples));
+  }
+  // overlapping ranges would count the same samples twice
+  std::sort(ranges.begin(), ranges.end());
+  for (size_t i = 1; i < ranges.size(); ++i) {
+    if (ranges[i].first < ranges[i - 1].second) {
+      throw std::runtime_error("Partial sample ranges overlap.");
+    }
+  }
+  if (merged.samples == 0) {
+    throw std::runtime_error("The partials hold no samples.");
+  }
+  saveCheckpoint(output, merged);
+
+  std::vector<float> mean(merged.accu);
+  QImage image(merged.width, merged.height, QImage::Format_RGB888);
+  for (int y = 0; y < merged.height; ++y) {
+    for (int x = 0; x < merged.width; ++x) {
+      float* src = mean.data() + 3 * (y * merged.width + x);
+      for (int c = 0; c < 3; ++c) {
+        src[c] /= merged.samples;
+      }
+      QColor color;
+      color.setRgbF(
+        std::min(std::max(src[0], 0.f), 1.f),
+        std::min(std::max(src[1], 0.f), 1.f),
+        std::min(std::max(src[2], 0.f), 1.f)
+      );
+      image.setPixelColor(x, merged.height - y - 1, color);
+    }
+  }
+  writePfm(output + ".pfm", mean.data(), merged.width, merged.height);
+  image.save(QString::fromStdString(output + ".png"));
+}
+
+VideoEncoder::VideoEncoder(const char* output_path, int width, int height) : width(width), height(height) {
+  try {
+    open(output_path);
+  } catch (...) {
+    // the destructor does not run for a constructor that throws
+    release();
+    throw;
+  }
+}
+
+VideoEncoder::~VideoEncoder() {
+  release();
+}
+
+void VideoEncoder::open(const char* output_path) {
   int ret;
-  const int width = 1920;
-  const int height = 1080;
-  const int in_linesize[1] = { 3 * width };
   AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_H264);
   if (!codec) {
     throw std::runtime_error("Codec init failed.");
   }
 
-  SwsContext* sws_context = NULL;
   sws_context = sws_getCachedContext(sws_context,
     width, height, AV_PIX_FMT_RGB24,
     width, height, AV_PIX_FMT_YUV420P,
@@ -140,7 +484,7 @@ void generateVideo(std::vector<QImage>& images, const char* output_path) {
     throw std::runtime_error("Create sws context failed.");
   }
 
-  AVCodecContext* c = avcodec_alloc_context3(codec);
+  c = avcodec_alloc_context3(codec);
   if (!c) {
     throw std::runtime_error("Allocate video codec context failed.");
   }
@@ -158,12 +502,12 @@ void generateVideo(std::vector<QImage>& images, const char* output_path) {
     throw std::runtime_error("Open codec failed.");
   }
 
-  FILE* file = fopen(output_path, "wb");
+  file = fopen(output_path, "wb");
   if (!file) {
     throw std::runtime_error("Open output file failed.");
   }
 
-  AVFrame* frame = av_frame_alloc();
+  frame = av_frame_alloc();
   if (!frame) {
     throw std::runtime_error("Allocate video frame failed.");
   }
@@ -175,33 +519,40 @@ void generateVideo(std::vector<QImage>& images, const char* output_path) {
   if (ret < 0) {
     throw std::runtime_error("Allocate raw picture buffer failed.");
   }
+}
 
+void VideoEncoder::addFrame(QImage& image) {
+  int ret;
+  const int in_linesize[1] = { 3 * width };
   AVPacket pkt;
-
-  uint8_t* rgb = NULL;
-
-  for (int pts = 0; pts < images.size(); pts++) {
-    frame->pts = pts;
-    rgb = images[pts].bits();
-    int got_output;
-    sws_scale(sws_context, (const uint8_t * const *)&rgb, in_linesize, 0,
-      c->height, frame->data, frame->linesize);
-    av_init_packet(&pkt);
-    pkt.data = NULL;
-    pkt.size = 0;
-    ret = avcodec_encode_video2(c, &pkt, frame, &got_output);
-    if (ret < 0) {
-      throw std::runtime_error("Encoding frame failed.");
-    }
-    if (got_output) {
-      fwrite(pkt.data, 1, pkt.size, file);
-      av_packet_unref(&pkt);
-    }
+  frame->pts = pts++;
+  uint8_t* rgb = image.bits();
+  int got_output;
+  sws_scale(sws_context, (const uint8_t * const *)&rgb, in_linesize, 0,
+    c->height, frame->data, frame->linesize);
+  av_init_packet(&pkt);
+  pkt.data = NULL;
+  pkt.size = 0;
+  ret = avcodec_encode_video2(c, &pkt, frame, &got_output);
+  if (ret < 0) {
+    throw std::runtime_error("Encoding frame failed.");
+  }
+  if (got_output) {
+    fwrite(pkt.data, 1, pkt.size, file);
+    av_packet_unref(&pkt);
   }
+}
+
+void VideoEncoder::finish() {
+  int ret;
+  AVPacket pkt;
   uint8_t endcode[] = { 0, 0, 1, 0xb7 };
   int got_output;
   do {
     fflush(stdout);
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
     ret = avcodec_encode_video2(c, &pkt, NULL, &got_output);
     if (ret < 0) {
       fprintf(stderr, "Error encoding frame\n");
@@ -213,9 +564,33 @@ void generateVideo(std::vector<QImage>& images, const char* output_path) {
     }
   } while (got_output);
   fwrite(endcode, 1, sizeof(endcode), file);
-  fclose(file);
-  avcodec_close(c);
-  av_free(c);
-  av_freep(&frame->data[0]);
-  av_frame_free(&frame);
-}
\ No newline at end of file
+  release();
+}
+
+void VideoEncoder::release() {
+  if (file) {
+    fclose(file);
+    file = nullptr;
+  }
+  if (c) {
+    avcodec_close(c);
+    av_free(c);
+    c = nullptr;
+  }
+  if (frame) {
+    av_freep(&frame->data[0]);
+    av_frame_free(&frame);
+  }
+  if (sws_context) {
+    sws_freeContext(sws_context);
+    sws_context = nullptr;
+  }
+}
+
+void generateVideo(std::vector<QImage>& images, const char* output_path) {
+  VideoEncoder encoder(output_path, 1920, 1080);
+  for (auto& image : images) {
+    encoder.addFrame(image);
+  }
+  encoder.finish();
+}
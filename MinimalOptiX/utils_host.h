@@ -9,17 +9,22 @@
 #include <vector>
 #include <limits>
 #include <random>
+#include <cstdint>
+#include <cstdio>
 #include <QImage>
 #include "structures.h"
 
 void getStrFromFile(std::string& content, std::string& fileName);
 
-void getPtxStrFromCuStr(std::string& cuStr, std::string& ptxStr, std::string& fileName);
+// defines are extra "-DNAME" options for NVRTC
+void getPtxStrFromCuStr(std::string& cuStr, std::string& ptxStr, std::string& fileName, const std::vector<std::string>& defines = {});
 
-void cuFileToPtxStr(std::string& fileName, std::string& ptxStr);
+void cuFileToPtxStr(std::string& fileName, std::string& ptxStr, const std::vector<std::string>& defines = {});
 
 void setQuadParams(optix::float3& anchor, optix::float3& v1, optix::float3& v2, QuadParams& quadParams);
 
+void setQuadLightParams(optix::float3& anchor, optix::float3& v1, optix::float3& v2, optix::float3 emission, LightParams& lightParams);
+
 void setCamParams(
   optix::float3& lookFrom, optix::float3& lookAt, optix::float3& up,
   float vFoV, float aspect, float aperture, float focus, CamParams& camParams
@@ -27,6 +32,71 @@ void setCamParams(
 
 void initDisneyParams(DisneyParams& disneyParams);
 
+// Prints the relative variance of unoccluded direct irradiance estimates for
+// the old area/volume light sampling and the solid angle sampling in
+// light_sampling.h, at receivers placed close to and grazing each light.
+void compareLightSampling(const std::string& sceneName, const std::vector<LightParams>& lights, int nSamples);
+
+// CPU reference of the reservoir resampling in restir.h at one receiver in
+// front of each of up to 8 lights, lit by all of them. Prints the relative
+// variance and mean error, against solid angle sampling of every light, of
+// one-shadow-ray estimates: a uniformly picked light, nCandidates resampled
+// candidates, and candidates merged with the previous estimate's reservoir.
+void compareLightResampling(const std::string& sceneName, const std::vector<LightParams>& lights, int nSamples, int nCandidates, float maxM);
+
+struct AVCodecContext;
+struct AVFrame;
+struct SwsContext;
+
+// H.264 encoder fed one RGB888 frame at a time, in presentation order.
+class VideoEncoder {
+public:
+  VideoEncoder(const char* output_path, int width, int height);
+  // closes the file and frees the encoder if finish() was not reached
+  ~VideoEncoder();
+  VideoEncoder(const VideoEncoder&) = delete;
+  VideoEncoder& operator=(const VideoEncoder&) = delete;
+  void addFrame(QImage& image);
+  void finish();
+
+private:
+  void open(const char* output_path);
+  void release();
+
+  int width;
+  int height;
+  int64_t pts = 0;
+  AVCodecContext* c = nullptr;
+  AVFrame* frame = nullptr;
+  SwsContext* sws_context = nullptr;
+  FILE* file = nullptr;
+};
+
 void generateVideo(std::vector<QImage>& images, const char*);
 
-int randSeed();
+// PFM stores rows bottom-up, the same order as accuBuffer. The trailer is
+// written after the pixels, where PFM readers ignore it.
+void writePfm(const std::string& fileName, const float* rgb, int width, int height, const std::string& trailer = std::string());
+
+bool readPfm(const std::string& fileName, std::vector<float>& rgb, int& width, int& height, std::string* trailer = nullptr);
+
+// Raw accumulation state of a progressive render, enough to resume it.
+struct AccuCheckpoint {
+  int sceneId;
+  int width;
+  int height;
+  unsigned int firstSample;
+  unsigned int samples; // sample indices [firstSample, firstSample + samples)
+  std::vector<float> accu; // float3 sums, not divided by samples
+};
+
+// Writes <prefix>.accu.pfm with the sample range in its trailer, so pixels
+// and sample count are replaced in one atomic save. <prefix>.accu.txt is a
+// readable copy of the trailer that loading does not use.
+void saveCheckpoint(const std::string& prefix, const AccuCheckpoint& checkpoint);
+
+bool loadCheckpoint(const std::string& prefix, AccuCheckpoint& checkpoint);
+
+// Sums partial checkpoints of disjoint sample ranges into <output>.accu.*,
+// and writes the mean image to <output>.pfm and <output>.png.
+void mergeCheckpoints(const std::vector<std::string>& inputs, const std::string& output);